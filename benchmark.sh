@@ -0,0 +1,41 @@
+#!/bin/bash
+
+# Throughput of short jobs, with the jobs started by posix_spawn() and by
+# fork(). Run it from where ts was built, as testbench.sh:
+#   ../benchmark.sh [jobs] [slots]
+# The jobs get queued behind a job that holds the only slot, so only their
+# run is timed, not the ts runs that queue them.
+
+JOBS=${1:-500}
+SLOTS=${2:-8}
+
+export TS_SOCKET=${TMPDIR:-/tmp}/ts-benchmark.$$
+export TS_MAXFINISHED=$((JOBS + 1))
+FLAG=$TS_SOCKET.go
+
+kill_server() {
+  ./ts -K 2> /dev/null
+  while [ -e $TS_SOCKET ]; do sleep 0.1; done
+}
+
+run() {
+  kill_server
+  rm -f $FLAG
+  ./ts -S 1
+  ./ts -n sh -c "while [ ! -e $FLAG ]; do sleep 0.1; done" > /dev/null
+  for i in `seq $JOBS`; do
+    TS_SPAWN=$1 ./ts -n true > /dev/null
+  done
+  START=`date +%s%N`
+  touch $FLAG
+  ./ts -S $SLOTS
+  ./ts -w --all
+  END=`date +%s%N`
+  MS=$(( (END - START) / 1000000 ))
+  echo "$2: $JOBS jobs in $MS ms, $(( JOBS * 1000 / (MS > 0 ? MS : 1) )) jobs/s"
+}
+
+run 0 "fork       "
+run 1 "posix_spawn"
+kill_server
+rm -f $FLAG
@@ -0,0 +1,88 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2013  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "main.h"
+
+/* The strings the server keeps for its jobs (commands, labels, TS_ENV
+ * outputs...), kept once however many jobs have them. They are found by
+ * their content, and freed when the last job goes. Nobody changes them. */
+
+struct Blob {
+    struct HashEntry entry; /* First, hash.c sees it */
+    int refs;
+    char data[];
+};
+
+static struct HashTable blobs = {0, 0, 0};
+
+static struct Blob *blob_of(char *str) {
+    return (struct Blob *) (str - offsetof(struct Blob, data));
+}
+
+/* Returns the shared copy of str, which gets freed */
+char *blob_take(char *str) {
+    struct Blob *b;
+    unsigned int h;
+    size_t len;
+
+    if (str == 0)
+        return 0;
+
+    h = hash_string(str);
+    for (b = (struct Blob *) hash_bucket(&blobs, h); b != 0;
+         b = (struct Blob *) b->entry.next)
+        if (b->entry.hash == h && strcmp(b->data, str) == 0) {
+            ++b->refs;
+            free(str);
+            return b->data;
+        }
+
+    len = strlen(str);
+    b = (struct Blob *) malloc(sizeof(*b) + len + 1);
+    if (b == 0)
+        error("Cannot allocate a blob of %lu bytes", (unsigned long) len);
+    memcpy(b->data, str, len + 1);
+    free(str);
+    b->entry.hash = h;
+    b->refs = 1;
+    hash_insert(&blobs, &b->entry);
+    return b->data;
+}
+
+/* One job less has it */
+void blob_release(char *str) {
+    struct Blob *b;
+
+    if (str == 0)
+        return;
+
+    b = blob_of(str);
+    if (--b->refs > 0)
+        return;
+
+    hash_remove(&blobs, &b->entry);
+    free(b);
+}
+
+/* For ts --mem-stats. The bytes count the headers. */
+void blob_stats(int *count, long *bytes, long *uses) {
+    unsigned int i;
+    struct Blob *b;
+
+    *count = blobs.count;
+    *bytes = (long) blobs.num_buckets * sizeof(struct HashEntry *);
+    *uses = 0;
+    for (i = 0; i < blobs.num_buckets; ++i)
+        for (b = (struct Blob *) blobs.buckets[i]; b != 0;
+             b = (struct Blob *) b->entry.next) {
+            *bytes += sizeof(*b) + strlen(b->data) + 1;
+            *uses += b->refs;
+        }
+}
@@ -11,8 +11,11 @@
 #include <sys/socket.h>
 #include <signal.h>
 #include <time.h>
+#include <errno.h>
+#include <poll.h>
 
 #include "main.h"
+#include "cjson/cJSON.h"
 
 static void c_end_of_job(const struct Result *res);
 
@@ -56,13 +59,21 @@ char *build_command_string() {
 void c_new_job() {
     struct Msg m = default_msg();
     char *new_command;
-    char *myenv;
+    char *myenv = NULL;
+    int env_cached = 0;
 
     m.type = NEWJOB;
 
     new_command = build_command_string();
 
-    myenv = get_environment();
+    /* The server may have the TS_ENV output of a job just like this */
+    m.u.newjob.env_ttl = env_cache_ttl();
+    if (getenv("TS_ENV") != NULL && m.u.newjob.env_ttl > 0) {
+        env_cache_key(m.u.newjob.env_key);
+        env_cached = c_env_cached(m.u.newjob.env_key, m.u.newjob.env_ttl);
+    }
+    if (!env_cached)
+        myenv = get_environment();
 
     /* global */
     m.u.newjob.command_size = strlen(new_command) + 1; /* add null */
@@ -82,26 +93,17 @@ void c_new_job() {
     m.u.newjob.num_slots = command_line.num_slots;
     m.u.newjob.gpus = command_line.gpus;
     m.u.newjob.wait_free_gpus = command_line.wait_free_gpus;
-
-    /* Send the message */
-    send_msg(server_socket, &m);
-
-    /* send GPU IDs */
-    if (!command_line.wait_free_gpus)
-        send_ints(server_socket, command_line.gpu_nums, command_line.gpus);
-
-    /* send dependencies */
-    if (command_line.depend_on_size)
-        send_ints(server_socket, command_line.depend_on, command_line.depend_on_size);
-
-    /* Send the command */
-    send_bytes(server_socket, new_command, m.u.newjob.command_size);
-
-    /* Send the label */
-    send_bytes(server_socket, command_line.label, m.u.newjob.label_size);
-
-    /* Send the environment */
-    send_bytes(server_socket, myenv, m.u.newjob.env_size);
+    m.u.newjob.stdin_from = command_line.stdin_from;
+    m.u.newjob.deadline = command_line.deadline;
+    if (command_line.pool)
+        m.u.newjob.pool_size = strlen(command_line.pool) + 1; /* add null */
+
+    /* Send the message, with the GPU IDs, the dependencies, the command,
+     * the label, the environment and the pool */
+    if (libts_send_newjob(server_socket, &m, command_line.gpu_nums,
+                          command_line.depend_on, new_command,
+                          command_line.label, myenv, command_line.pool) == -1)
+        error("Sending the new job");
 
     free(new_command);
     free(myenv);
@@ -144,8 +146,17 @@ int c_wait_server_commands() {
             struct Result result = default_result();
 
             freeGpuList = recv_ints(server_socket, &num_gpus);
+            command_line.stream_output = m.u.runjob.stream;
+            command_line.worker.pid = m.u.runjob.worker_pid;
+            if (command_line.worker.pid != 0) {
+                command_line.worker.in = recv_fd(server_socket);
+                command_line.worker.out = recv_fd(server_socket);
+                if (command_line.worker.in == -1
+                    || command_line.worker.out == -1)
+                    error("Receiving the pool worker");
+            }
             result.skipped = 0;
-            if (command_line.depend_on_size && command_line.require_elevel && m.u.last_errorlevel != 0) {
+            if (command_line.depend_on_size && command_line.require_elevel && m.u.runjob.last_errorlevel != 0) {
                 result.errorlevel = -1;
                 result.user_ms = 0.f;
                 result.system_ms = 0.f;
@@ -169,12 +180,61 @@ int c_wait_server_commands() {
             }
 
             c_end_of_job(&result);
+            if (!result.skipped)
+                run_job_hooks(&result);
             return result.errorlevel;
         }
     }
     return -1;
 }
 
+/* ts --libts-runner: for each job that a program queued with libts, a
+ * process that does what ts does after NEWJOB_OK, on the connection of
+ * the job. It ends when the program closes the socket from. */
+void c_libts_runner(int from) {
+    struct RunnerJob rj;
+    char *args;
+    char *label;
+    int s;
+
+    /* Nobody waits for the job processes */
+    signal(SIGCHLD, SIG_IGN);
+
+    while ((s = libts_recv_runner_job(from, &rj, &args, &label)) != -1) {
+        int pid = fork();
+
+        if (pid == 0) {
+            char **argv;
+            char *arg = args;
+            int i;
+
+            signal(SIGCHLD, SIG_DFL);
+            close(from);
+            argv = (char **) malloc((rj.argc + 1) * sizeof(char *));
+            if (argv == NULL)
+                error("Cannot allocate the arguments of the job %i", rj.jobid);
+            for (i = 0; i < rj.argc; ++i) {
+                argv[i] = arg;
+                arg += strlen(arg) + 1;
+            }
+            argv[rj.argc] = NULL;
+
+            server_socket = s;
+            command_line.jobid = rj.jobid;
+            command_line.label = label;
+            command_line.command.array = argv;
+            command_line.command.num = rj.argc;
+            exit(c_wait_server_commands());
+        }
+        /* Without the process, the server takes the job as killed */
+        if (pid == -1)
+            warning("Cannot fork the runner of the job %i", rj.jobid);
+        close(s);
+        free(args);
+        free(label);
+    }
+}
+
 void c_wait_server_lines() {
     struct Msg m = default_msg();
     int res;
@@ -215,32 +275,17 @@ void c_list_gpu_jobs() {
 
 /* Exits if wrong */
 void c_check_version() {
-    struct Msg m = default_msg();
-    int res;
+    int version = -1;
 
-    m.type = GET_VERSION;
-    /* Double send, so an old ts will answer for sure at least once */
-    send_msg(server_socket, &m);
-    send_msg(server_socket, &m);
-
-    /* Set up a 2 second timeout to receive the
-    version msg. */
-
-    res = recv_msg(server_socket, &m);
-    if (res == -1)
-        error("Error calling recv_msg in c_check_version");
-    if (m.type != VERSION || m.u.version != PROTOCOL_VERSION) {
-        printf("Wrong server version. Received %i, expecting %i\n",
-               m.u.version, PROTOCOL_VERSION);
+    if (libts_check_version(server_socket, &version) == 0)
+        return;
+    if (errno != EPROTO)
+        error("Error receiving the version in c_check_version");
 
-        error("Wrong server version. Received %i, expecting %i",
-              m.u.version, PROTOCOL_VERSION);
-    }
-
-    /* Receive also the 2nd send_msg if we got the right version */
-    res = recv_msg(server_socket, &m);
-    if (res == -1)
-        error("Error calling the 2nd recv_msg in c_check_version");
+    printf("Wrong server version. Received %i, expecting %i\n",
+           version, PROTOCOL_VERSION);
+    error("Wrong server version. Received %i, expecting %i",
+          version, PROTOCOL_VERSION);
 }
 
 void c_show_info() {
@@ -318,6 +363,7 @@ void c_send_runjob_ok(const char *ofname, int pid) {
     else
         m.u.output.store_output = 0;
     m.u.output.pid = pid;
+    m.u.output.peek_size = command_line.peek_size;
     if (m.u.output.store_output)
         m.u.output.ofilename_size = strlen(ofname) + 1;
     else
@@ -339,6 +385,38 @@ static void c_end_of_job(const struct Result *res) {
     send_msg(server_socket, &m);
 }
 
+/* Until the server lets the hooks of the job run. While waiting, the
+ * runner keeps no connection: it asks again, less and less often. If the
+ * server is gone, they run anyway. */
+void c_wait_hook_turn() {
+    struct Msg m;
+    int delay = 50; /* ms */
+    int res;
+
+    while (1) {
+        m = default_msg();
+        m.type = HOOK_WAIT;
+        m.u.jobid = command_line.jobid;
+        send_msg(server_socket, &m);
+
+        res = recv_msg(server_socket, &m);
+        if (res != sizeof(m) || m.type == HOOK_GO)
+            return;
+        if (m.type != HOOK_LATER) {
+            warning("Wrong internal message waiting for the hook turn");
+            return;
+        }
+
+        close(server_socket);
+        poll(NULL, 0, delay);
+        if (delay < 500)
+            delay *= 2;
+        server_socket = try_connect_server();
+        if (server_socket == -1)
+            return;
+    }
+}
+
 void c_shutdown_server() {
     struct Msg m = default_msg();
 
@@ -346,11 +424,20 @@ void c_shutdown_server() {
     send_msg(server_socket, &m);
 }
 
+/* The server closes once the change is in the snapshot */
+static void wait_end_of_write() {
+    struct Msg m = default_msg();
+
+    if (recv_msg(server_socket, &m) != 0)
+        warning("Wrong internal message after a change");
+}
+
 void c_clear_finished() {
     struct Msg m = default_msg();
 
     m.type = CLEAR_FINISHED;
     send_msg(server_socket, &m);
+    wait_end_of_write();
 }
 
 static char *get_output_file(int *pid) {
@@ -410,7 +497,9 @@ int c_tail() {
 
     c_wait_running_job_send();
 
-    return tail_file(str, 10 /* Last lines to show */);
+    if (command_line.tail_lines == -1)
+        return tail_file(str, 10 /* Last lines to show */);
+    return tail_file(str, command_line.tail_lines);
 }
 
 int c_cat() {
@@ -423,7 +512,264 @@ int c_cat() {
     }
     c_wait_running_job_send();
 
-    return tail_file(str, -1 /* All the lines */);
+    return tail_file(str, command_line.tail_lines /* All the lines if -1 */);
+}
+
+/* Follows the output of all the jobs in command_line.job_list, using one
+ * server connection per job to know when each of them ends. */
+int c_follow_many() {
+    char **fnames;
+    int *sockets;
+    int main_socket = server_socket;
+    int num = command_line.job_list_size;
+    int pid;
+    int i;
+    int res;
+
+    fnames = (char **) malloc(num * sizeof(char *));
+    sockets = (int *) malloc(num * sizeof(int));
+
+    for (i = 0; i < num; ++i) {
+        if (i == 0)
+            sockets[i] = main_socket;
+        else {
+            sockets[i] = connect_server();
+            server_socket = sockets[i];
+            c_check_version();
+        }
+
+        command_line.jobid = command_line.job_list[i];
+        fnames[i] = get_output_file(&pid);
+        if (fnames[i] == 0) {
+            fprintf(stderr, "The output of job %i is not stored. Cannot follow.\n",
+                    command_line.jobid);
+            exit(-1);
+        }
+        c_wait_running_job_send();
+    }
+    server_socket = main_socket;
+
+    res = tail_many(fnames, command_line.job_list, sockets, num,
+                    command_line.tail_lines == -1 ? 10 : command_line.tail_lines,
+                    command_line.head_lines);
+
+    for (i = 1; i < num; ++i)
+        close(sockets[i]);
+    free(sockets);
+    free(fnames);
+    return res;
+}
+
+/* Asks the server for the output files of the jobs matching --label,
+ * --state and the job list. Returns how many. */
+int c_list_outputs(int **jobids, char ***fnames) {
+    struct Msg m = default_msg();
+    int allocated = 0;
+    int num = 0;
+    int res;
+
+    m.type = LIST_OUTPUTS;
+    m.u.filter.state = command_line.job_state;
+    m.u.filter.label_size = command_line.label ? strlen(command_line.label) + 1 : 0;
+    send_msg(server_socket, &m);
+    if (m.u.filter.label_size > 0)
+        send_bytes(server_socket, command_line.label, m.u.filter.label_size);
+    send_ints(server_socket, command_line.job_list, command_line.job_list_size);
+
+    *jobids = NULL;
+    *fnames = NULL;
+    while (1) {
+        char *line;
+        int jobid;
+        int pos;
+
+        res = recv_msg(server_socket, &m);
+        if (res == -1)
+            error("Error in list_outputs");
+        if (res == 0)
+            break;
+        if (res != sizeof(m) || m.type != LIST_LINE)
+            error("Wrong message in list_outputs");
+
+        line = (char *) malloc(m.u.size);
+        recv_bytes(server_socket, line, m.u.size);
+        if (sscanf(line, "%i %n", &jobid, &pos) < 1) {
+            free(line);
+            continue;
+        }
+        line[strcspn(line, "\n")] = '\0';
+
+        if (num == allocated) {
+            allocated = allocated ? allocated * 2 : 64;
+            *jobids = (int *) realloc(*jobids, allocated * sizeof(int));
+            *fnames = (char **) realloc(*fnames, allocated * sizeof(char *));
+        }
+        (*jobids)[num] = jobid;
+        (*fnames)[num] = (char *) malloc(strlen(line + pos) + 1);
+        strcpy((*fnames)[num], line + pos);
+        ++num;
+        free(line);
+    }
+    return num;
+}
+
+/* Writes into fd the output of the job command_line.stdin_from, following
+ * its file until the job ends, from a child process */
+static void follow_into(int fd) {
+    char *fname;
+    int pid;
+
+    pid = fork();
+    if (pid == -1)
+        error("Cannot fork to follow the input job");
+    if (pid != 0)
+        return;
+
+    dup2(fd, 1);
+    close(fd);
+    close(server_socket);
+    server_socket = connect_server();
+    c_check_version();
+    command_line.jobid = command_line.stdin_from;
+    command_line.head_lines = -1;
+    command_line.time_since = -1;
+    fname = get_output_file(&pid);
+    if (fname != 0) {
+        c_wait_running_job_send();
+        tail_many(&fname, &command_line.jobid, &server_socket, 1,
+                  TAIL_NO_HEADER, -1);
+    }
+    _exit(0);
+}
+
+/* Sets up a pipe with the output of the job command_line.stdin_from, and
+ * returns its read end, for the input of our job */
+int c_stdin_pipe() {
+    struct Msg m = default_msg();
+    int p[2];
+    int res;
+
+    if (pipe(p) == -1)
+        error("Cannot create the input pipe");
+
+    m.type = STDIN_PIPE;
+    m.u.jobid = command_line.stdin_from;
+    send_msg(server_socket, &m);
+    send_fd(server_socket, p[1]);
+
+    res = recv_msg(server_socket, &m);
+    if (res != sizeof(m) || m.type != STDIN_PIPE_OK)
+        error("Wrong answer to the input pipe request");
+    /* With STREAM_LIVE, the job runner of the other job got the pipe */
+    if (m.u.stream == STREAM_FILE)
+        follow_into(p[1]);
+    close(p[1]);
+    return p[0];
+}
+
+/* The last output the server keeps of a running job, or of all of them */
+void c_peek() {
+    struct Msg m = default_msg();
+    int res;
+
+    m.type = PEEK;
+    m.u.jobid = command_line.jobid;
+    send_msg(server_socket, &m);
+
+    while (1) {
+        char *buffer;
+
+        res = recv_msg(server_socket, &m);
+        if (res == -1)
+            error("Error in peek");
+        if (res == 0)
+            break;
+        if (res != sizeof(m) || (m.type != LIST_LINE && m.type != PEEK_NOK))
+            error("Wrong message in peek");
+        buffer = (char *) malloc(m.u.size);
+        recv_bytes(server_socket, buffer, m.u.size);
+        if (m.type == PEEK_NOK) {
+            fprintf(stderr, "Error in the request: %s", buffer);
+            exit(-1);
+        }
+        fwrite(buffer, 1, m.u.size, stdout);
+        free(buffer);
+    }
+}
+
+/* Whether the event ends the watch of its job. Leaves the errorlevel in
+ * *errorlevel. */
+static int event_ends_job(const char *line, int *jobid, int *errorlevel) {
+    cJSON *o;
+    cJSON *field;
+    const char *event;
+    int ends = 0;
+
+    o = cJSON_Parse(line);
+    if (o == NULL)
+        return 0;
+    field = cJSON_GetObjectItem(o, "Event");
+    event = cJSON_IsString(field) ? field->valuestring : "";
+    if (strcmp(event, "finished") == 0 || strcmp(event, "skipped") == 0
+        || strcmp(event, "removed") == 0) {
+        ends = 1;
+        field = cJSON_GetObjectItem(o, "ID");
+        *jobid = cJSON_IsNumber(field) ? field->valueint : -1;
+        field = cJSON_GetObjectItem(o, "E-Level");
+        *errorlevel = cJSON_IsNumber(field) ? field->valueint : 0;
+    }
+    cJSON_Delete(o);
+    return ends;
+}
+
+/* Shows the events of the jobs as the server sends them, as JSON lines.
+ * With a job list, it ends when all of them have ended, returning the
+ * last non-zero errorlevel. */
+int c_watch() {
+    struct Msg m = default_msg();
+    int left = command_line.job_list_size;
+    int errorlevel = 0;
+    int res;
+
+    m.type = WATCH;
+    m.u.filter.state = -1;
+    m.u.filter.label_size = command_line.label ? strlen(command_line.label) + 1 : 0;
+    send_msg(server_socket, &m);
+    if (m.u.filter.label_size > 0)
+        send_bytes(server_socket, command_line.label, m.u.filter.label_size);
+    send_ints(server_socket, command_line.job_list, command_line.job_list_size);
+
+    while (command_line.job_list_size == 0 || left > 0) {
+        char *line;
+        int jobid;
+        int level;
+        int i;
+
+        res = recv_msg(server_socket, &m);
+        if (res == -1)
+            error("Error in watch");
+        if (res == 0)
+            break;
+        if (res != sizeof(m) || m.type != LIST_LINE)
+            error("Wrong message in watch");
+        line = (char *) malloc(m.u.size);
+        recv_bytes(server_socket, line, m.u.size);
+        fputs(line, stdout);
+        fflush(stdout);
+
+        if (command_line.job_list_size > 0
+            && event_ends_job(line, &jobid, &level))
+            for (i = 0; i < command_line.job_list_size; ++i)
+                if (command_line.job_list[i] == jobid) {
+                    /* Each job counts once */
+                    command_line.job_list[i] = -1;
+                    if (level != 0)
+                        errorlevel = level;
+                    --left;
+                }
+        free(line);
+    }
+    return errorlevel;
 }
 
 void c_show_output_file() {
@@ -520,12 +866,16 @@ void c_remove_job() {
 }
 
 int c_wait_job_recv() {
+    return c_wait_job_recv_from(server_socket);
+}
+
+int c_wait_job_recv_from(int s) {
     struct Msg m = default_msg();
     int res;
     char *string = 0;
 
     /* Receive the answer */
-    res = recv_msg(server_socket, &m);
+    res = recv_msg(s, &m);
     if (res != sizeof(m))
         error("Error in wait_job");
     switch (m.type) {
@@ -534,7 +884,7 @@ int c_wait_job_recv() {
             /* WILL NOT GO FURTHER */
         case LIST_LINE: /* Only ONE line accepted */
             string = (char *) malloc(m.u.size);
-            res = recv_bytes(server_socket, string, m.u.size);
+            res = recv_bytes(s, string, m.u.size);
             if (res != m.u.size)
                 error("Error in wait_job - line size");
             fprintf(stderr, "Error in the request: %s",
@@ -567,6 +917,98 @@ static void c_wait_running_job_send() {
     send_msg(server_socket, &m);
 }
 
+/* Returns the last errorlevel not zero of the jobs */
+int c_wait_jobs() {
+    struct Msg m = default_msg();
+
+    m.type = WAITJOBS;
+    m.u.filter.state = -1;
+    m.u.filter.label_size = command_line.label ? strlen(command_line.label) + 1 : 0;
+    send_msg(server_socket, &m);
+    if (m.u.filter.label_size > 0)
+        send_bytes(server_socket, command_line.label, m.u.filter.label_size);
+    send_ints(server_socket, command_line.job_list, command_line.job_list_size);
+
+    return c_wait_job_recv();
+}
+
+/* The server answers only on error. Returns the errorlevel. */
+static int c_pool_answer() {
+    struct Msg m = default_msg();
+    int errorlevel = 0;
+    char *line;
+
+    while (recv_msg(server_socket, &m) == sizeof(m)) {
+        if (m.type != LIST_LINE)
+            error("Wrong answer about the pool");
+        line = (char *) malloc(m.u.size);
+        recv_bytes(server_socket, line, m.u.size);
+        fprintf(stderr, "%s", line);
+        free(line);
+        errorlevel = -1;
+    }
+    return errorlevel;
+}
+
+/* Returns the errorlevel */
+int c_pool_start() {
+    struct Msg m = default_msg();
+    char *command;
+
+    command = build_command_string();
+    m.type = POOL_START;
+    m.u.pool.size = command_line.pool_size;
+    m.u.pool.name_size = strlen(command_line.pool) + 1;
+    m.u.pool.command_size = strlen(command) + 1;
+    send_msg(server_socket, &m);
+    send_bytes(server_socket, command_line.pool, m.u.pool.name_size);
+    send_bytes(server_socket, command, m.u.pool.command_size);
+    free(command);
+
+    return c_pool_answer();
+}
+
+/* Returns the errorlevel */
+int c_pool_stop() {
+    struct Msg m = default_msg();
+
+    m.type = POOL_STOP;
+    m.u.pool.name_size = strlen(command_line.pool) + 1;
+    send_msg(server_socket, &m);
+    send_bytes(server_socket, command_line.pool, m.u.pool.name_size);
+
+    return c_pool_answer();
+}
+
+void c_list_pools() {
+    struct Msg m = default_msg();
+
+    m.type = LIST_POOLS;
+    send_msg(server_socket, &m);
+
+    c_wait_server_lines();
+}
+
+void c_mem_stats() {
+    struct Msg m = default_msg();
+
+    m.type = MEM_STATS;
+    send_msg(server_socket, &m);
+
+    c_wait_server_lines();
+}
+
+void c_stats() {
+    struct Msg m = default_msg();
+
+    m.type = STATS;
+    m.u.stats.by = command_line.stats_by;
+    m.u.stats.format = command_line.list_format;
+    send_msg(server_socket, &m);
+
+    c_wait_server_lines();
+}
+
 /* Returns the errorlevel */
 int c_wait_job() {
     c_wait_job_send();
@@ -586,6 +1028,7 @@ void c_send_max_slots(int max_slots) {
     m.type = SET_MAX_SLOTS;
     m.u.max_slots = command_line.max_slots;
     send_msg(server_socket, &m);
+    wait_end_of_write();
 }
 
 void c_get_max_slots() {
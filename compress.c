@@ -0,0 +1,273 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2009  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "main.h"
+
+/* The compressed output files are:
+ *   magic (4 bytes), format version, algorithm, 2 bytes unused
+ * followed by independent frames of:
+ *   raw length (4 bytes, LE), compressed length (4 bytes, LE), data
+ * Each frame can be decompressed on its own, so a reader can skip
+ * to any frame by walking the frame headers. */
+static const char magic[4] = { '\x89', 'T', 'S', 'Z' };
+
+enum
+{
+    ZFORMAT_VERSION = 1
+};
+
+enum Compression compress_default()
+{
+#if defined(HAVE_ZSTD)
+    return COMPRESS_ZSTD;
+#elif defined(HAVE_ZLIB)
+    return COMPRESS_ZLIB;
+#else
+    return COMPRESS_NONE;
+#endif
+}
+
+static void put_u32(unsigned char *p, unsigned int v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static unsigned int get_u32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+static int write_all(int fd, const char *buf, int len)
+{
+    while(len > 0)
+    {
+        int res;
+        res = write(fd, buf, len);
+        if (res == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += res;
+        len -= res;
+    }
+    return 0;
+}
+
+int zframes_write_header(int fd, enum Compression c)
+{
+    char header[ZHEADER_SIZE];
+
+    memcpy(header, magic, sizeof magic);
+    header[4] = ZFORMAT_VERSION;
+    header[5] = c;
+    header[6] = 0;
+    header[7] = 0;
+    return write_all(fd, header, ZHEADER_SIZE);
+}
+
+static int compress_bound(enum Compression c, int len)
+{
+    switch(c)
+    {
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD:
+            return ZSTD_compressBound(len);
+#endif
+#ifdef HAVE_ZLIB
+        case COMPRESS_ZLIB:
+            return compressBound(len);
+#endif
+        default:
+            return -1;
+    }
+}
+
+/* Compresses buf as a new frame, written in a single write() so the
+ * readers rarely see it half done. Returns the bytes written, or -1. */
+int zframes_write(int fd, enum Compression c, int level, const char *buf,
+        int len)
+{
+    unsigned char *out;
+    int bound;
+    long comp_len = -1;
+    int res;
+
+    bound = compress_bound(c, len);
+    if (bound < 0)
+        return -1;
+    out = (unsigned char *) malloc(ZFRAME_HEADER_SIZE + bound);
+    if (out == NULL)
+        return -1;
+
+    switch(c)
+    {
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD:
+        {
+            size_t zres;
+            zres = ZSTD_compress(out + ZFRAME_HEADER_SIZE, bound, buf, len,
+                    level == -1 ? ZSTD_CLEVEL_DEFAULT : level);
+            if (!ZSTD_isError(zres))
+                comp_len = zres;
+            break;
+        }
+#endif
+#ifdef HAVE_ZLIB
+        case COMPRESS_ZLIB:
+        {
+            uLongf dlen = bound;
+            if (level > 9)
+                level = 9;
+            if (compress2(out + ZFRAME_HEADER_SIZE, &dlen,
+                        (const Bytef *) buf, len,
+                        level == -1 ? Z_DEFAULT_COMPRESSION : level) == Z_OK)
+                comp_len = dlen;
+            break;
+        }
+#endif
+        default:
+            break;
+    }
+
+    if (comp_len < 0)
+    {
+        free(out);
+        return -1;
+    }
+
+    put_u32(out, len);
+    put_u32(out + 4, comp_len);
+    res = write_all(fd, (char *) out, ZFRAME_HEADER_SIZE + comp_len);
+    free(out);
+    if (res == -1)
+        return -1;
+    return ZFRAME_HEADER_SIZE + comp_len;
+}
+
+/* The algorithm of the compressed output in fd, or COMPRESS_NONE if it is
+ * a plain output file (or we could not read it) */
+enum Compression zframes_check(int fd)
+{
+    char header[ZHEADER_SIZE];
+
+    if (pread(fd, header, ZHEADER_SIZE, 0) != ZHEADER_SIZE)
+        return COMPRESS_NONE;
+    if (memcmp(header, magic, sizeof magic) != 0
+            || header[4] != ZFORMAT_VERSION)
+        return COMPRESS_NONE;
+    switch(header[5])
+    {
+        case COMPRESS_ZLIB:
+        case COMPRESS_ZSTD:
+            return (enum Compression) header[5];
+        default:
+            return COMPRESS_NONE;
+    }
+}
+
+/* Reads the header of the frame at 'off'.
+ * Returns 1 if the whole frame is in the file, 0 if it is not there yet,
+ * and -1 if the frame is bad. */
+int zframes_read_header(int fd, off_t off, unsigned int *raw_len,
+        unsigned int *comp_len)
+{
+    unsigned char header[ZFRAME_HEADER_SIZE];
+    struct stat st;
+    ssize_t res;
+
+    do
+        res = pread(fd, header, ZFRAME_HEADER_SIZE, off);
+    while(res == -1 && errno == EINTR);
+    if (res == -1)
+        return -1;
+    if (res < ZFRAME_HEADER_SIZE)
+        return 0;
+
+    *raw_len = get_u32(header);
+    *comp_len = get_u32(header + 4);
+    if (*raw_len > ZFRAME_MAX || *comp_len == 0)
+        return -1;
+
+    if (fstat(fd, &st) == -1)
+        return -1;
+    if (st.st_size < off + ZFRAME_HEADER_SIZE + (off_t) *comp_len)
+        return 0;
+    return 1;
+}
+
+/* Returns the decompressed frame at 'off', of raw_len bytes, in a newly
+ * allocated buffer. NULL on error. */
+char *zframes_decode(int fd, enum Compression c, off_t off,
+        unsigned int raw_len, unsigned int comp_len)
+{
+    char *in;
+    char *out;
+    ssize_t res;
+    int ok = 0;
+
+    in = (char *) malloc(comp_len);
+    out = (char *) malloc(raw_len + 1);
+    if (in == NULL || out == NULL)
+    {
+        free(in);
+        free(out);
+        return NULL;
+    }
+
+    do
+        res = pread(fd, in, comp_len, off + ZFRAME_HEADER_SIZE);
+    while(res == -1 && errno == EINTR);
+
+    if (res == (ssize_t) comp_len)
+    {
+        switch(c)
+        {
+#ifdef HAVE_ZSTD
+            case COMPRESS_ZSTD:
+                ok = ZSTD_decompress(out, raw_len, in, comp_len) == raw_len;
+                break;
+#endif
+#ifdef HAVE_ZLIB
+            case COMPRESS_ZLIB:
+            {
+                uLongf dlen = raw_len;
+                ok = uncompress((Bytef *) out, &dlen, (const Bytef *) in,
+                        comp_len) == Z_OK && dlen == raw_len;
+                break;
+            }
+#endif
+            default:
+                break;
+        }
+    }
+
+    free(in);
+    if (!ok)
+    {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
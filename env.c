@@ -12,8 +12,38 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "main.h"
 
+extern char **environ;
+
+/* The outputs of TS_ENV, kept once in the server for all the jobs with the
+ * same one. For TS_ENVTTL seconds, the clients with the same key reuse
+ * the last one instead of running TS_ENV again.
+ * Only -i shows them, so once a job with it finished, a long one goes to a
+ * file next to the socket, not to weigh on the history of finished jobs. */
+struct SharedEnv
+{
+    char key[ENV_KEY_SIZE]; /* Empty if not for reuse */
+    int ttl;
+    time_t time;
+    char *text; /* A blob, or 0 if in the file */
+    char *file; /* Where the text went, or 0 */
+    unsigned long long hash; /* Of the text in the file */
+    size_t length;
+    int refs; /* Jobs with it */
+    struct SharedEnv *next;
+};
+
+enum
+{
+    ENV_SPILL_MIN = 512 /* Shorter texts stay in memory */
+};
+
+static struct SharedEnv *first_env = 0;
+static char *spill_prefix = 0;
+
 static int fork_command(const char *command)
 {
     int pid;
@@ -94,3 +124,262 @@ char * get_environment()
 
     return ptr;
 }
+
+/* The TS_ENVTTL seconds. 0 for no reuse. */
+int env_cache_ttl()
+{
+    const char *str = getenv("TS_ENVTTL");
+
+    if (str == NULL || atoi(str) <= 0)
+        return 0;
+    return atoi(str);
+}
+
+static const unsigned long long fnv1a_basis = 14695981039346656037ULL;
+
+static unsigned long long fnv1a(unsigned long long h, const char *str)
+{
+    /* The final '\0' too, to separate the strings */
+    do
+    {
+        h ^= (unsigned char) *str;
+        h *= 1099511628211ULL;
+    } while (*str++ != '\0');
+    return h;
+}
+
+/* The TS_ENV output depends on the command, on where it runs and on our
+ * environment. Their hash is the key. */
+void env_cache_key(char *key)
+{
+    unsigned long long h = fnv1a_basis;
+    char cwd[4096];
+    int i;
+
+    h = fnv1a(h, getenv("TS_ENV"));
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+        h = fnv1a(h, cwd);
+    for (i = 0; environ[i] != NULL; ++i)
+        h = fnv1a(h, environ[i]);
+    sprintf(key, "%016llx", h);
+}
+
+/* Whether the server has the TS_ENV output for the key, fresh */
+int c_env_cached(const char *key, int ttl)
+{
+    struct Msg m = default_msg();
+    int res;
+
+    m.type = ASK_ENV_CACHE;
+    strcpy(m.u.env.key, key);
+    m.u.env.ttl = ttl;
+    send_msg(server_socket, &m);
+
+    res = recv_msg(server_socket, &m);
+    if (res != sizeof(m) || m.type != ANSWER_ENV_CACHE)
+        error("Error in c_env_cached");
+    return m.u.env.cached;
+}
+
+static int env_expired(const struct SharedEnv *e, time_t now)
+{
+    return now - e->time >= e->ttl;
+}
+
+/* Those of no job, which cannot be reused */
+static void forget_unused_envs()
+{
+    struct SharedEnv **pe = &first_env;
+    time_t now = time(NULL);
+
+    while (*pe != 0)
+    {
+        struct SharedEnv *e = *pe;
+        if (e->refs == 0 && env_expired(e, now))
+        {
+            *pe = e->next;
+            blob_release(e->text);
+            if (e->file != 0)
+            {
+                unlink(e->file);
+                free(e->file);
+            }
+            free(e);
+        } else
+            pe = &e->next;
+    }
+}
+
+/* Keeps the text for the job, shared with the others with the same one.
+ * It takes the text. */
+struct SharedEnv *s_env_store(const char *key, int ttl, char *text)
+{
+    struct SharedEnv *e;
+    unsigned long long hash;
+    size_t length;
+
+    forget_unused_envs();
+
+    text = blob_take(text);
+    for (e = first_env; e != 0; e = e->next)
+        if (e->text == text)
+            break;
+
+    if (e == 0)
+    {
+        hash = fnv1a(fnv1a_basis, text);
+        length = strlen(text);
+        for (e = first_env; e != 0; e = e->next)
+            if (e->file != 0 && e->hash == hash && e->length == length)
+                break;
+    }
+
+    if (e == 0)
+    {
+        e = (struct SharedEnv *) malloc(sizeof(*e));
+        if (e == 0)
+            error("Cannot allocate the shared environment");
+        e->text = text;
+        e->file = 0;
+        e->refs = 0;
+        e->key[0] = '\0';
+        e->ttl = 0;
+        e->time = time(NULL);
+        e->next = first_env;
+        first_env = e;
+    } else
+        blob_release(text);
+
+    if (key[0] != '\0')
+    {
+        strcpy(e->key, key);
+        e->ttl = ttl;
+        e->time = time(NULL);
+    }
+    ++e->refs;
+    return e;
+}
+
+static struct SharedEnv *find_env(const char *key)
+{
+    struct SharedEnv *e;
+
+    if (key[0] == '\0')
+        return 0;
+    for (e = first_env; e != 0; e = e->next)
+        if (strcmp(e->key, key) == 0)
+            return e;
+    return 0;
+}
+
+/* The one the client was told to reuse, or 0 if it went meanwhile */
+struct SharedEnv *s_env_cached(const char *key)
+{
+    struct SharedEnv *e = find_env(key);
+
+    if (e != 0)
+        ++e->refs;
+    return e;
+}
+
+void s_env_release(struct SharedEnv *e)
+{
+    if (e == 0)
+        return;
+    --e->refs;
+    forget_unused_envs();
+}
+
+void s_ask_env_cache(int s, const char *key, int ttl)
+{
+    struct Msg m = default_msg();
+    struct SharedEnv *e = find_env(key);
+
+    m.type = ANSWER_ENV_CACHE;
+    m.u.env.cached = e != 0 && time(NULL) - e->time < ttl;
+    send_msg(s, &m);
+}
+
+/* Where the texts go, when spilled */
+void s_env_init(const char *socket_path)
+{
+    spill_prefix = (char *) malloc(strlen(socket_path) + sizeof(".env"));
+    if (spill_prefix == 0)
+        error("Cannot allocate the environment file prefix");
+    sprintf(spill_prefix, "%s.env", socket_path);
+}
+
+/* A job with it finished. The text goes to a file, if long. */
+void s_env_spill(struct SharedEnv *e)
+{
+    char *file;
+    size_t length;
+    int fd;
+
+    if (e == 0 || e->text == 0 || spill_prefix == 0)
+        return;
+    length = strlen(e->text);
+    if (length < ENV_SPILL_MIN)
+        return;
+
+    file = (char *) malloc(strlen(spill_prefix) + sizeof(".XXXXXX"));
+    if (file == 0)
+        return;
+    sprintf(file, "%s.XXXXXX", spill_prefix);
+    fd = mkstemp(file);
+    if (fd == -1)
+    {
+        free(file);
+        return;
+    }
+    if (write(fd, e->text, length) != (ssize_t) length)
+    {
+        close(fd);
+        unlink(file);
+        free(file);
+        return;
+    }
+    close(fd);
+
+    e->hash = fnv1a(fnv1a_basis, e->text);
+    e->length = length;
+    e->file = file;
+    blob_release(e->text);
+    e->text = 0;
+}
+
+void s_env_dump(int fd, const struct SharedEnv *e)
+{
+    char buf[4096];
+    int in;
+    int res;
+
+    if (e == 0)
+        return;
+    write(fd, "Environment:\n", 13);
+    if (e->text != 0)
+    {
+        write(fd, e->text, strlen(e->text));
+        return;
+    }
+
+    in = open(e->file, O_RDONLY);
+    if (in == -1)
+    {
+        fd_nprintf(fd, 100, "(lost: %s)\n", e->file);
+        return;
+    }
+    while ((res = read(in, buf, sizeof(buf))) > 0)
+        write(fd, buf, res);
+    close(in);
+}
+
+/* At the server end */
+void s_env_end()
+{
+    struct SharedEnv *e;
+
+    for (e = first_env; e != 0; e = e->next)
+        if (e->file != 0)
+            unlink(e->file);
+}
@@ -0,0 +1,216 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2013  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+
+/* How long the jobs run, learnt by the server from those that finished
+ * (and, at first, from the history of TS_HISTORY). It keeps a moving
+ * average of the run time for each label and for each command with its
+ * numbers taken out, so "train.sh --epoch 3" learns from "train.sh
+ * --epoch 2". The jobs take the estimate of their command, else that of
+ * their label, else that of all the jobs.
+ * The estimates give the ETA of ts -l, and order the jobs for TS_POLICY=sjf
+ * (see next_run_job()). */
+
+struct Estimate {
+    struct HashEntry entry; /* First, hash.c sees it */
+    int refs;  /* Jobs pointing to it */
+    int count; /* Jobs learnt from */
+    unsigned int used; /* The tick of its last use */
+    float seconds;
+    char key[]; /* "c" and the command, or "l" and the label */
+};
+
+/* Weight of the last run in the average */
+static const float estimate_alpha = 0.3f;
+
+/* Estimates kept before forgetting those not used for long. More, if the
+ * jobs point to them. */
+enum {
+    ESTIMATE_MAX = 4096
+};
+
+static struct HashTable estimates = {0, 0, 0};
+static unsigned int max_estimates = ESTIMATE_MAX;
+static unsigned int tick = 0; /* One more for each lookup */
+static struct Estimate all_jobs;
+static int history_learnt = 0;
+
+static void free_estimate(struct Estimate *e) {
+    hash_remove(&estimates, &e->entry);
+    free(e);
+}
+
+/* Forgets those no job points to, and not used in the last ESTIMATE_MAX/2
+ * lookups: at least half of them, if the jobs do not hold them. */
+static void forget_old() {
+    unsigned int i;
+
+    for (i = 0; i < estimates.num_buckets; ++i) {
+        struct Estimate *e = (struct Estimate *) estimates.buckets[i];
+        while (e != 0) {
+            struct Estimate *next = (struct Estimate *) e->entry.next;
+            if (e->refs == 0 && tick - e->used > ESTIMATE_MAX / 2)
+                free_estimate(e);
+            e = next;
+        }
+    }
+    if (estimates.count >= max_estimates)
+        max_estimates *= 2;
+    else if (max_estimates > ESTIMATE_MAX
+             && estimates.count < max_estimates / 4)
+        max_estimates /= 2;
+}
+
+static struct Estimate *find_estimate(const char *key) {
+    struct Estimate *e;
+    unsigned int h = hash_string(key);
+    size_t len;
+
+    ++tick;
+    for (e = (struct Estimate *) hash_bucket(&estimates, h); e != 0;
+         e = (struct Estimate *) e->entry.next)
+        if (e->entry.hash == h && strcmp(e->key, key) == 0) {
+            e->used = tick;
+            return e;
+        }
+
+    if (estimates.count >= max_estimates)
+        forget_old();
+
+    len = strlen(key);
+    e = (struct Estimate *) malloc(sizeof(*e) + len + 1);
+    if (e == 0)
+        error("Cannot allocate an estimate");
+    memcpy(e->key, key, len + 1);
+    e->entry.hash = h;
+    e->refs = 0;
+    e->count = 0;
+    e->used = tick;
+    e->seconds = 0;
+    hash_insert(&estimates, &e->entry);
+    return e;
+}
+
+/* The command with each run of digits as one '#' */
+static struct Estimate *command_estimate(const char *command) {
+    struct Estimate *e;
+    char *key;
+    char *k;
+
+    key = (char *) malloc(strlen(command) + 2);
+    if (key == 0)
+        error("Cannot allocate an estimate key");
+    k = key;
+    *k++ = 'c';
+    while (*command != '\0') {
+        if (*command >= '0' && *command <= '9') {
+            *k++ = '#';
+            while (*command >= '0' && *command <= '9')
+                ++command;
+        } else
+            *k++ = *command++;
+    }
+    *k = '\0';
+    e = find_estimate(key);
+    free(key);
+    return e;
+}
+
+static struct Estimate *label_estimate(const char *label) {
+    struct Estimate *e;
+    char *key;
+
+    if (label == 0)
+        return 0;
+    key = (char *) malloc(strlen(label) + 2);
+    if (key == 0)
+        error("Cannot allocate an estimate key");
+    key[0] = 'l';
+    strcpy(key + 1, label);
+    e = find_estimate(key);
+    free(key);
+    return e;
+}
+
+static void add_run(struct Estimate *e, float seconds) {
+    if (e->count == 0)
+        e->seconds = seconds;
+    else
+        e->seconds += estimate_alpha * (seconds - e->seconds);
+    ++e->count;
+}
+
+/* Learns from the job, if it ended by itself */
+static void learn(const struct Job *p, void *data) {
+    struct Estimate *command = p->est_command;
+    struct Estimate *label = p->est_label;
+
+    if (p->state != FINISHED || p->result.died_by_signal
+        || p->info.start_time.tv_sec == 0)
+        return;
+    if (command == 0)
+        command = command_estimate(p->command);
+    if (label == 0)
+        label = label_estimate(p->label);
+
+    add_run(command, p->result.real_ms);
+    if (label != 0)
+        add_run(label, p->result.real_ms);
+    add_run(&all_jobs, p->result.real_ms);
+}
+
+static void learn_history() {
+    if (history_learnt)
+        return;
+    history_learnt = 1;
+    history_each(learn, 0);
+}
+
+/* For the new job, where its estimates are */
+void estimate_attach(struct Job *p) {
+    learn_history();
+    p->est_command = command_estimate(p->command);
+    ++p->est_command->refs;
+    p->est_label = label_estimate(p->label);
+    if (p->est_label != 0)
+        ++p->est_label->refs;
+}
+
+static void release(struct Estimate *e) {
+    if (e == 0)
+        return;
+    /* Nothing learnt: not worth keeping */
+    if (--e->refs == 0 && e->count == 0)
+        free_estimate(e);
+}
+
+/* The job goes */
+void estimate_release(struct Job *p) {
+    release(p->est_command);
+    release(p->est_label);
+    p->est_command = 0;
+    p->est_label = 0;
+}
+
+void estimate_learn(const struct Job *p) {
+    learn_history();
+    learn(p, 0);
+}
+
+/* Seconds the job is expected to run. -1 if nothing is known. */
+float estimate_of(const struct Job *p) {
+    if (p->est_command != 0 && p->est_command->count > 0)
+        return p->est_command->seconds;
+    if (p->est_label != 0 && p->est_label->count > 0)
+        return p->est_label->seconds;
+    if (all_jobs.count > 0)
+        return all_jobs.seconds;
+    return -1;
+}
@@ -4,6 +4,7 @@
 
     Please find the license in the provided COPYING file.
 */
+#define _GNU_SOURCE /* POSIX_SPAWN_SETSID */
 #include <unistd.h>
 #include <stdio.h>
 #include <signal.h>
@@ -17,23 +18,35 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
 #include <assert.h>
+#include <spawn.h>
 
 #include "main.h"
 
 /* from signals.c */
 extern int signals_child_pid; /* 0, not set. otherwise, set. */
+extern sigset_t normal_sigmask;
 
-/* Returns errorlevel */
-static void run_parent(int fd_read_filename, int pid, struct Result *result) {
+extern char **environ;
+
+/* The output file of the job run, for its hooks */
+static char *job_ofname = 0;
+
+/* Returns errorlevel.
+ * fd_output is the job output to be copied into the output file,
+ * or -1 if the job writes straight into it */
+static void run_parent(int fd_read_filename, int fd_output, int pid,
+                       struct Result *result) {
     int status;
     char *ofname = 0;
     int namesize;
     int res;
-    char *command;
     struct timeval starttv;
     struct timeval endtv;
     struct tms cpu_times;
+    int job_pid;
 
     /* Read the filename */
     /* This is linked with the write() in this same file, in run_child() */
@@ -53,13 +66,19 @@ static void run_parent(int fd_read_filename, int pid, struct Result *result) {
         error("Reading the the struct timeval");
     close(fd_read_filename);
 
+    /* Of a pool job, the worker running it is the process to signal */
+    job_pid = command_line.worker.pid != 0 ? command_line.worker.pid : pid;
+
     /* All went fine - prepare the SIGINT and send runjob_ok */
-    signals_child_pid = pid;
+    signals_child_pid = job_pid;
     unblock_sigint_and_install_handler();
 
-    c_send_runjob_ok(ofname, pid);
+    c_send_runjob_ok(ofname, job_pid);
 
-    wait(&status);
+    if (fd_output != -1)
+        output_supervise(fd_output, ofname, pid, &status);
+    else
+        waitpid(pid, &status, 0); /* Not the follower of --stdin-from */
 
     /* Set the errorlevel */
     if (WIFEXITED(status)) {
@@ -79,14 +98,8 @@ static void run_parent(int fd_read_filename, int pid, struct Result *result) {
         result->errorlevel = -1;
     }
 
-    command = build_command_string();
-    if (command_line.send_output_by_mail) {
-        send_mail(command_line.jobid, result->errorlevel, ofname, command);
-    }
-    hook_on_finish(command_line.jobid, result->errorlevel, ofname, command);
-    free(command);
-
-    free(ofname);
+    /* The hooks run once the server knows the job ended (run_job_hooks()) */
+    job_ofname = ofname;
 
     /* Calculate times */
     gettimeofday(&endtv, NULL);
@@ -101,6 +114,29 @@ static void run_parent(int fd_read_filename, int pid, struct Result *result) {
                         (float) sysconf(_SC_CLK_TCK);
 }
 
+/* The mail of -m and TS_ONFINISH, after the end of the job reached the
+ * server: they do not keep the slot of the job. They wait for a turn of
+ * the server (TS_HOOKSLOTS). */
+void run_job_hooks(const struct Result *result) {
+    char *command;
+
+    if (command_line.send_output_by_mail || getenv("TS_ONFINISH") != NULL) {
+        c_wait_hook_turn();
+
+        command = build_command_string();
+        if (command_line.send_output_by_mail) {
+            send_mail(command_line.jobid, result->errorlevel, job_ofname,
+                      command);
+        }
+        hook_on_finish(command_line.jobid, result->errorlevel, job_ofname,
+                       command);
+        free(command);
+    }
+
+    free(job_ofname);
+    job_ofname = 0;
+}
+
 void create_closed_read_on(int dest) {
     int p[2];
     /* Closing input */
@@ -114,6 +150,13 @@ void create_closed_read_on(int dest) {
 /* This will close fd_out and fd_in in the parent */
 static void run_gzip(int fd_out, int fd_in) {
     int pid;
+    char level[16] = "-6";
+
+    /* gzip goes up to 9; the level may be for zstd */
+    if (command_line.compress_level != -1)
+        snprintf(level, sizeof level, "-%i",
+                 command_line.compress_level > 9 ? 9
+                 : command_line.compress_level);
     pid = fork();
 
     switch (pid) {
@@ -125,7 +168,7 @@ static void run_gzip(int fd_out, int fd_in) {
             close(fd_out);
             /* Without stderr */
             close(2);
-            execlp("gzip", "gzip", NULL);
+            execlp("gzip", "gzip", level, NULL);
             exit(-1);
             /* Won't return */
         case -1:
@@ -136,97 +179,236 @@ static void run_gzip(int fd_out, int fd_in) {
     }
 }
 
-static void run_child(int fd_send_filename, char* tmpdir) {
-    char *outfname;
-    char errfname[sizeof outfname + 2]; /* .e */
-    int namesize;
+/* Like mkdir -p */
+static void make_dirs(char *path) {
+    char *p;
+
+    for (p = path + 1; *p != '\0'; ++p) {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        mkdir(path, 0700);
+        *p = '/';
+    }
+    if (mkdir(path, 0700) == -1 && errno != EEXIST)
+        error("Cannot create the output directory %s", path);
+}
+
+/* The directory of the output file in the layout given by TS_LOGLAYOUT:
+ *   flat (default): outdir itself. Returns NULL.
+ *   sharded: outdir/<jobid/1000>
+ *   label: outdir/<label>/<jobid/1000>, or as sharded without label */
+static char *output_dir(const char *outdir) {
+    const char *layout = getenv("TS_LOGLAYOUT");
+    char *dir;
+    char *label = NULL;
+    char *p;
+
+    if (layout == NULL || strcmp(layout, "flat") == 0)
+        return NULL;
+    if (strcmp(layout, "sharded") != 0 && strcmp(layout, "label") != 0)
+        error("Wrong TS_LOGLAYOUT %s. Choices: {flat, sharded, label}", layout);
+
+    if (strcmp(layout, "label") == 0 && command_line.label != NULL
+        && command_line.label[0] != '\0') {
+        /* Keep the label a single path component */
+        label = (char *) malloc(strlen(command_line.label) + 1);
+        strcpy(label, command_line.label);
+        for (p = label; *p != '\0'; ++p)
+            if (*p == '/')
+                *p = '_';
+        if (label[0] == '.')
+            label[0] = '_';
+    }
+
+    dir = (char *) malloc(strlen(outdir) + (label ? strlen(label) : 0) + 20);
+    if (label)
+        sprintf(dir, "%s/%s/%i", outdir, label, command_line.jobid / 1000);
+    else
+        sprintf(dir, "%s/%i", outdir, command_line.jobid / 1000);
+    free(label);
+    make_dirs(dir);
+    return dir;
+}
+
+/* Creates the output file, and returns its descriptor and its name */
+static int create_output_file(const char *outdir, char **name) {
+    char *dir;
+    int fd;
+
+    dir = output_dir(outdir);
+    if (dir == NULL) {
+        *name = (char *) malloc(strlen(outdir) + 1
+                + (command_line.logfile ? strlen(command_line.logfile) : 6)
+                + strlen(".XXXXXX") + 1);
+        sprintf(*name, "%s/%s.XXXXXX", outdir,
+                command_line.logfile ? command_line.logfile : "ts-out");
+        return mkstemp(*name);
+    }
+
+    *name = (char *) malloc(strlen(dir) + 1
+                + (command_line.logfile ? strlen(command_line.logfile) : 20)
+                + strlen(".XXXXXX") + 1);
+
+    if (command_line.logfile)
+        sprintf(*name, "%s/%s.XXXXXX", dir, command_line.logfile);
+    else {
+        /* The job id makes the name */
+        sprintf(*name, "%s/%i.out", dir, command_line.jobid);
+        fd = open(*name, O_CREAT | O_EXCL | O_WRONLY, 0600);
+        if (fd != -1 || errno != EEXIST) {
+            free(dir);
+            return fd;
+        }
+        /* Some old server had the job id. Don't overwrite its output. */
+        strcat(*name, ".XXXXXX");
+    }
+    free(dir);
+    return mkstemp(*name);
+}
+
+/* The stdout and stderr of the job (-1 to leave them as they are), and the
+ * name of its output file, if kept. For all but the gzip run. */
+static void output_fds(int fd_output, char *tmpdir, const char *cmd,
+                       int *out, int *err, char **ofname) {
+    char *errfname; /* .e */
     int outfd;
-    int err;
-    struct timeval starttv;
-    char *cmd = build_command_string();
 
-    if (command_line.logfile) {
-        outfname = malloc(1 + strlen(command_line.logfile) + strlen(".XXXXXX") + 1);
-        sprintf(outfname, "/%s.XXXXXX", command_line.logfile);
-    } else
-        outfname = "/ts-out.XXXXXX";
+    *err = -1;
+    *ofname = NULL;
+    if (!command_line.store_output) {
+        /* The parent passes stdout on, keeping its last part for the
+         * server. stderr stays as it is. */
+        *out = fd_output;
+        return;
+    }
 
-    if (command_line.store_output) {
-        /* Prepare path */
-        int lname;
-        char *outfname_full;
-        char *outdir = tmpdir == NULL ? "/tmp" : tmpdir;
-
-        lname = strlen(outdir) + strlen(outfname) + 1 /* \0 */;
-        outfname_full = (char *) malloc(lname);
-        strcpy(outfname_full, outdir);
-        strcat(outfname_full, outfname);
-
-        /* Prepare the filename */
-        outfd = mkstemp(outfname_full); /* stdout */
-        assert(outfd != -1);
+    /* Prepare the filename */
+    outfd = create_output_file(tmpdir == NULL ? "/tmp" : tmpdir, ofname);
+    assert(outfd != -1);
+    errfname = (char *) malloc(strlen(*ofname) + 3);
+    sprintf(errfname, "%s.e", *ofname);
+    if (fd_output != -1) {
+        /* The parent writes the output, command line included.
+         * The header of a compressed file goes now, so the readers
+         * know what to expect. */
+        if (output_compression() != COMPRESS_NONE)
+            zframes_write_header(outfd, output_compression());
+        close(outfd);
+        *out = fd_output;
+    } else {
         write(outfd, cmd, strlen(cmd));
         write(outfd, "\n", 2);
-        free(cmd);
-        free(tmpdir);
-        if (command_line.gzip) {
-            int p[2];
-            /* We assume that all handles are closed*/
-            err = pipe(p);
-            assert(err == 0);
-
-            /* Program stdout and stderr */
-            /* which go to pipe write handle */
-            err = dup2(p[1], 1);
-            assert(err != -1);
-            if (command_line.stderr_apart) {
-                int errfd;
-                strncpy(errfname, outfname_full, sizeof errfname);
-                strncat(errfname, ".e", 2 + 1);
-                errfd = open(errfname, O_CREAT | O_WRONLY | O_TRUNC, 0600);
-                assert(err == 0);
-                err = dup2(errfd, 2);
-                assert(err == 0);
-                err = close(errfd);
-                assert(err == 0);
-            } else {
-                err = dup2(p[1], 2);
-                assert(err != -1);
-            }
-            err = close(p[1]);
-            assert(err == 0);
-
-            /* run gzip.
-             * This wants p[0] in 0, so gzip will read
-             * from it */
-            run_gzip(outfd, p[0]);
-        } else {
-            dup2(outfd, 1); /* stdout */
-            if (command_line.stderr_apart) {
-                int errfd;
-                strncpy(errfname, outfname_full, sizeof errfname);
-                strncat(errfname, ".e", 2 + 1);
-                errfd = open(errfname, O_CREAT | O_WRONLY | O_TRUNC, 0600);
-                dup2(errfd, 2);
-                close(errfd);
-            } else
-                dup2(outfd, 2);
-            close(outfd);
-        }
+        *out = outfd;
+    }
+    if (command_line.stderr_apart)
+        *err = open(errfname, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    else
+        *err = *out;
+    free(errfname);
+}
 
-        /* Send the filename */
-        namesize = strlen(outfname_full) + 1;
+/* Tells run_parent() the output file name, if any, and the start time */
+static void send_start(int fd_send_filename, const char *ofname) {
+    struct timeval starttv;
+    int namesize;
+
+    if (ofname != NULL) {
+        namesize = strlen(ofname) + 1;
         write(fd_send_filename, (char *) &namesize, sizeof(namesize));
-        write(fd_send_filename, outfname_full, namesize);
-        free(outfname_full);
+        write(fd_send_filename, ofname, namesize);
     }
     /* Times */
     gettimeofday(&starttv, NULL);
     write(fd_send_filename, &starttv, sizeof(starttv));
+}
+
+/* The output goes through a gzip run apart */
+static void gzip_output(const char *cmd, char *tmpdir, char **ofname) {
+    char *errfname; /* .e */
+    int outfd;
+    int err;
+    int p[2];
+
+    outfd = create_output_file(tmpdir == NULL ? "/tmp" : tmpdir, ofname);
+    assert(outfd != -1);
+    errfname = (char *) malloc(strlen(*ofname) + 3);
+    sprintf(errfname, "%s.e", *ofname);
+
+    write(outfd, cmd, strlen(cmd));
+    write(outfd, "\n", 2);
+    /* We assume that all handles are closed*/
+    err = pipe(p);
+    assert(err == 0);
+
+    /* Program stdout and stderr */
+    /* which go to pipe write handle */
+    err = dup2(p[1], 1);
+    assert(err != -1);
+    if (command_line.stderr_apart) {
+        int errfd;
+        errfd = open(errfname, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+        assert(err == 0);
+        err = dup2(errfd, 2);
+        assert(err == 0);
+        err = close(errfd);
+        assert(err == 0);
+    } else {
+        err = dup2(p[1], 2);
+        assert(err != -1);
+    }
+    err = close(p[1]);
+    assert(err == 0);
+
+    /* run gzip.
+     * This wants p[0] in 0, so gzip will read
+     * from it */
+    run_gzip(outfd, p[0]);
+    free(errfname);
+}
+
+/* Sets stdout and stderr for the job, and tells run_parent() where
+ * they go. fd_output is where the output has to go, if not straight to
+ * the file. */
+static void child_output(int fd_send_filename, int fd_output, char *tmpdir) {
+    char *ofname;
+    int out;
+    int err;
+    char *cmd = build_command_string();
+
+    if (command_line.store_output && fd_output == -1 && command_line.gzip)
+        gzip_output(cmd, tmpdir, &ofname);
+    else {
+        output_fds(fd_output, tmpdir, cmd, &out, &err, &ofname);
+        if (out != -1)
+            dup2(out, 1); /* stdout */
+        if (err != -1)
+            dup2(err, 2);
+        if (err != -1 && err != out)
+            close(err);
+        if (out != -1)
+            close(out);
+    }
+    free(tmpdir);
+    free(cmd);
+
+    /* Send the filename */
+    send_start(fd_send_filename, ofname);
+    free(ofname);
     close(fd_send_filename);
+}
+
+/* fd_output is where the output has to go, if not straight to the file.
+ * fd_input is the input of the job (--stdin-from), or -1 */
+static void run_child(int fd_send_filename, int fd_output, int fd_input,
+                      char* tmpdir) {
+    child_output(fd_send_filename, fd_output, tmpdir);
 
     /* Closing input */
-    if (command_line.should_go_background)
+    if (fd_input != -1) {
+        dup2(fd_input, 0);
+        close(fd_input);
+    } else if (command_line.should_go_background)
         create_closed_read_on(0);
 
     /* We create a new session, so we can kill process groups as:
@@ -236,10 +418,248 @@ static void run_child(int fd_send_filename, char* tmpdir) {
     execvp(command_line.command.array[0], command_line.command.array);
 }
 
+/* The job as the pool worker reads it: the job id, the working directory
+ * and the words of the command, separated by tabs, in a line */
+static char *pool_job_line() {
+    char cwd[4096];
+    char *line;
+    char *p;
+    const char *word;
+    int size;
+    int i;
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+        strcpy(cwd, "/");
+    size = strlen(cwd) + 30;
+    for (i = 0; i < command_line.command.num; ++i)
+        size += strlen(command_line.command.array[i]) + 1;
+    line = (char *) malloc(size);
+    if (line == NULL)
+        error("Cannot allocate the line for the pool worker");
+
+    p = line + sprintf(line, "%i\t%s", command_line.jobid, cwd);
+    for (i = 0; i < command_line.command.num; ++i) {
+        *p++ = '\t';
+        /* Tabs and newlines in the words would break the line */
+        for (word = command_line.command.array[i]; *word != '\0'; ++word)
+            *p++ = (*word == '\t' || *word == '\n') ? ' ' : *word;
+    }
+    *p++ = '\n';
+    *p = '\0';
+    return line;
+}
+
+static int write_all(int fd, const char *data, int len) {
+    int res;
+
+    while (len > 0) {
+        res = write(fd, data, len);
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return -1;
+        data += res;
+        len -= res;
+    }
+    return 0;
+}
+
+/* Gives the job to the pool worker, and copies what it answers to stdout
+ * until its line "#ts-done <exit code>". Returns the exit code, or -1 if
+ * the worker ended before. */
+static int pool_relay(int in, int out) {
+    static const char mark[] = "#ts-done ";
+    const int mark_len = sizeof(mark) - 1;
+    char buf[4096];
+    char held[40]; /* What may be the line of the exit code */
+    int nheld = 0; /* -1 if not at the start of a line */
+    char *line;
+    int res;
+    int i;
+    int from;
+
+    line = pool_job_line();
+    res = write_all(in, line, strlen(line));
+    free(line);
+    close(in);
+
+    while (res == 0 && (res = read(out, buf, sizeof(buf))) != 0) {
+        if (res == -1) {
+            if (errno != EINTR)
+                break;
+            res = 0;
+            continue;
+        }
+        from = 0;
+        for (i = 0; i < res; ++i) {
+            if (nheld == -1) {
+                if (buf[i] == '\n')
+                    nheld = 0;
+                continue;
+            }
+            if (nheld < mark_len && buf[i] != mark[nheld]) {
+                /* Not the mark. What was held is output. */
+                write_all(1, held, nheld);
+                nheld = buf[i] == '\n' ? 0 : -1;
+                continue;
+            }
+            if (nheld == 0)
+                write_all(1, buf + from, i - from);
+            if (buf[i] == '\n') {
+                held[nheld] = '\0';
+                return atoi(held + mark_len);
+            }
+            if (nheld < (int) sizeof(held) - 1)
+                held[nheld++] = buf[i];
+            from = i + 1;
+        }
+        if (nheld == -1 || nheld == 0)
+            write_all(1, buf + from, res - from);
+        res = 0;
+    }
+    write_all(1, held, nheld > 0 ? nheld : 0);
+    fprintf(stderr, "ts: the pool worker ended\n");
+    return -1;
+}
+
+/* As run_child(), for a job given to a pool worker. This process goes
+ * between the worker and the output, and ends with the job exit code. */
+static void run_pool_child(int fd_send_filename, int fd_output, char *tmpdir) {
+    child_output(fd_send_filename, fd_output, tmpdir);
+    exit(pool_relay(command_line.worker.in, command_line.worker.out));
+}
+
+#ifdef POSIX_SPAWN_SETSID
+/* The environment of the job: ours, with PYTHONUNBUFFERED=1 */
+static char **job_environment() {
+    char **env;
+    int n;
+    int i;
+    int j = 0;
+
+    for (n = 0; environ[n] != NULL; ++n)
+        ;
+    env = (char **) malloc((n + 2) * sizeof(char *));
+    if (env == NULL)
+        error("Cannot allocate the job environment");
+    for (i = 0; i < n; ++i)
+        if (strncmp(environ[i], "PYTHONUNBUFFERED=", 17) != 0)
+            env[j++] = environ[i];
+    env[j++] = "PYTHONUNBUFFERED=1";
+    env[j] = NULL;
+    return env;
+}
+
+/* Whether the job can start with posix_spawn(). TS_SPAWN=0 asks for
+ * fork() always. */
+static int can_spawn(int fd_output) {
+    const char *str = getenv("TS_SPAWN");
+
+    if (str != NULL && strcmp(str, "0") == 0)
+        return 0;
+    /* The relay to a pool worker is a copy of us */
+    if (command_line.worker.pid != 0)
+        return 0;
+    /* gzip is another process to fork */
+    return !(command_line.store_output && fd_output == -1
+             && command_line.gzip);
+}
+
+/* As run_child(), but without copying this process: the output is prepared
+ * here, and the job gets it through the file actions of posix_spawn().
+ * The descriptors in 'unused' are not for the job. Returns its pid. */
+static int spawn_child(int fd_send_filename, int fd_output, int fd_input,
+                       char *tmpdir, const int *unused, int num_unused) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    char **env;
+    char *ofname;
+    char *cmd;
+    int closed[2] = {-1, -1};
+    int in = fd_input;
+    int out;
+    int err;
+    int pid;
+    int res;
+    int i;
+
+    cmd = build_command_string();
+    output_fds(fd_output, tmpdir, cmd, &out, &err, &ofname);
+    free(cmd);
+
+    /* Closing input */
+    if (in == -1 && command_line.should_go_background) {
+        if (pipe(closed) == -1)
+            error("Cannot create the input pipe");
+        close(closed[1]);
+        in = closed[0];
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    for (i = 0; i < num_unused; ++i)
+        if (unused[i] != -1)
+            posix_spawn_file_actions_addclose(&actions, unused[i]);
+    if (in != -1)
+        posix_spawn_file_actions_adddup2(&actions, in, 0);
+    if (out != -1)
+        posix_spawn_file_actions_adddup2(&actions, out, 1);
+    if (err != -1)
+        posix_spawn_file_actions_adddup2(&actions, err, 2);
+    if (in != -1)
+        posix_spawn_file_actions_addclose(&actions, in);
+    if (out != -1)
+        posix_spawn_file_actions_addclose(&actions, out);
+    if (err != -1 && err != out)
+        posix_spawn_file_actions_addclose(&actions, err);
+
+    /* We create a new session, so we can kill process groups as:
+         kill -- -`ts -p` */
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID
+                                    | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setsigmask(&attr, &normal_sigmask);
+
+    env = job_environment();
+    send_start(fd_send_filename, ofname);
+    res = posix_spawnp(&pid, command_line.command.array[0], &actions, &attr,
+                       command_line.command.array, env);
+    if (res != 0) {
+        /* As when the exec fails after fork(): the job says so in its
+         * output, and ends with -1 */
+        pid = fork();
+        if (pid == 0) {
+            if (out != -1)
+                dup2(out, 1);
+            if (err != -1)
+                dup2(err, 2);
+            fprintf(stderr, "ts could not run the command\n");
+            exit(-1);
+        }
+        if (pid == -1)
+            error("forking");
+    }
+    free(env);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    /* Ours; fd_output and fd_input are of the caller */
+    if (err != -1 && err != out && err != fd_output)
+        close(err);
+    if (out != -1 && out != fd_output)
+        close(out);
+    if (closed[0] != -1)
+        close(closed[0]);
+    free(ofname);
+    return pid;
+}
+#endif
+
 int run_job(struct Result *res) {
     int pid;
     int errorlevel;
     int p[2];
+    int out[2] = {-1, -1};
+    int in = -1;
     char *tmpdir = get_logdir();
 
     /* For the parent */
@@ -250,14 +670,39 @@ int run_job(struct Result *res) {
     /* Prepare the output filename sending */
     pipe(p);
 
-    pid = fork();
+    /* Compress, limit or peek the output here, instead of through gzip */
+    if (output_supervised())
+        if (pipe(out) == -1)
+            error("Cannot create the output pipe");
+
+    /* The output of another job as input */
+    if (command_line.stdin_from != -1)
+        in = c_stdin_pipe();
+
+#ifdef POSIX_SPAWN_SETSID
+    if (can_spawn(out[1])) {
+        int unused[4];
+
+        unused[0] = server_socket;
+        unused[1] = p[0];
+        unused[2] = p[1];
+        unused[3] = out[0];
+        pid = spawn_child(p[1], out[1], in, tmpdir,
+                          unused, sizeof(unused) / sizeof(unused[0]));
+    } else
+#endif
+        pid = fork();
 
     switch (pid) {
         case 0:
             restore_sigmask();
             close(server_socket);
             close(p[0]);
-            run_child(p[1], tmpdir);
+            if (out[0] != -1)
+                close(out[0]);
+            if (command_line.worker.pid != 0)
+                run_pool_child(p[1], out[1], tmpdir);
+            run_child(p[1], out[1], in, tmpdir);
             /* Not reachable, if the 'exec' of the command
              * works. Thus, command exists, etc. */
             fprintf(stderr, "ts could not run the command\n");
@@ -271,7 +716,15 @@ int run_job(struct Result *res) {
             error("forking");
         default:
             close(p[1]);
-            run_parent(p[0], pid, res);
+            if (out[1] != -1)
+                close(out[1]);
+            if (in != -1)
+                close(in);
+            if (command_line.worker.pid != 0) {
+                close(command_line.worker.in);
+                close(command_line.worker.out);
+            }
+            run_parent(p[0], out[0], pid, res);
             break;
     }
     free((char*) tmpdir);
@@ -0,0 +1,357 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2009  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#define _GNU_SOURCE /* memmem */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "main.h"
+
+/* ts --grep: looks for a pattern in the outputs of many jobs, scanning
+ * them in parallel. The matches are shown by job, in job order, each line
+ * with the job id in front. The command line at the start of the outputs
+ * is not looked into. */
+
+enum
+{
+    READ_SIZE = 1024 * 1024
+};
+
+struct GrepJob
+{
+    int jobid;
+    char *fname;
+    char *out;   /* The matching lines to show */
+    size_t out_len;
+    size_t out_size;
+    int done;
+};
+
+struct Scan
+{
+    struct GrepJob *job;
+    char *carry; /* Start of a line not ended yet */
+    size_t carry_len;
+    size_t carry_size;
+    char *line;  /* A line as a string, for regexec */
+    size_t line_size;
+    int skip;    /* The command line is still to be skipped (SKIP_*) */
+};
+
+/* The pattern is compiled as a regex if it has any of its special
+ * characters, and otherwise searched as a literal, with memmem(). */
+static const char *pattern;
+static size_t pattern_len;
+static int use_regex;
+static regex_t regex;
+
+static struct GrepJob *jobs;
+static int num_jobs;
+static int next_job;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+
+static void append(char **buf, size_t *len, size_t *size,
+        const char *data, size_t n)
+{
+    if (*len + n > *size)
+    {
+        *size = (*len + n) * 2;
+        *buf = (char *) realloc(*buf, *size);
+        if (*buf == NULL)
+            error("Not enough memory for the grep results");
+    }
+    memcpy(*buf + *len, data, n);
+    *len += n;
+}
+
+static void show_line(struct Scan *sc, const char *start, const char *end)
+{
+    struct GrepJob *j = sc->job;
+    char prefix[20];
+    int n;
+
+    n = sprintf(prefix, "%i:", j->jobid);
+    append(&j->out, &j->out_len, &j->out_size, prefix, n);
+    append(&j->out, &j->out_len, &j->out_size, start, end - start);
+    append(&j->out, &j->out_len, &j->out_size, "\n", 1);
+}
+
+static int regex_matches(struct Scan *sc, const char *start, const char *end)
+{
+    size_t len = end - start;
+
+    if (len + 1 > sc->line_size)
+    {
+        sc->line_size = (len + 1) * 2;
+        sc->line = (char *) realloc(sc->line, sc->line_size);
+        if (sc->line == NULL)
+            error("Not enough memory for the grep lines");
+    }
+    memcpy(sc->line, start, len);
+    sc->line[len] = '\0';
+    return regexec(&regex, sc->line, 0, NULL, 0) == 0;
+}
+
+/* Looks into whole lines. The last one may lack its newline. */
+static void scan_lines(struct Scan *sc, const char *buf, size_t len)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+
+    while(p < end)
+    {
+        const char *start;
+        const char *stop;
+
+        if (use_regex)
+        {
+            start = p;
+            stop = (const char *) memchr(p, '\n', end - p);
+            if (stop == NULL)
+                stop = end;
+            if (regex_matches(sc, start, stop))
+                show_line(sc, start, stop);
+        }
+        else
+        {
+            const char *hit;
+
+            /* Jump to the next match, not line by line */
+            hit = (const char *) memmem(p, end - p, pattern, pattern_len);
+            if (hit == NULL)
+                break;
+            start = last_newline(p, hit - p);
+            start = start == NULL ? p : start + 1;
+            stop = (const char *) memchr(hit, '\n', end - hit);
+            if (stop == NULL)
+                stop = end;
+            show_line(sc, start, stop);
+        }
+        if (stop == end)
+            break;
+        p = stop + 1;
+    }
+}
+
+/* Passes the whole lines in data to scan_lines(), keeping the last one
+ * for later if it is not ended yet */
+static void scan_feed(struct Scan *sc, const char *data, size_t len)
+{
+    const char *nl;
+
+    /* The command line is not of the output, as in tail */
+    if (sc->skip != SKIP_NONE)
+    {
+        int n = skip_length(&sc->skip, data, len);
+        data += n;
+        len -= n;
+    }
+
+    if (sc->carry_len > 0)
+    {
+        nl = (const char *) memchr(data, '\n', len);
+        if (nl == NULL)
+        {
+            append(&sc->carry, &sc->carry_len, &sc->carry_size, data, len);
+            return;
+        }
+        append(&sc->carry, &sc->carry_len, &sc->carry_size,
+                data, nl - data + 1);
+        scan_lines(sc, sc->carry, sc->carry_len);
+        sc->carry_len = 0;
+        len -= nl - data + 1;
+        data = nl + 1;
+    }
+
+    nl = last_newline(data, len);
+    if (nl != NULL)
+    {
+        scan_lines(sc, data, nl - data + 1);
+        len -= nl - data + 1;
+        data = nl + 1;
+    }
+    if (len > 0)
+        append(&sc->carry, &sc->carry_len, &sc->carry_size, data, len);
+}
+
+static void scan_frames(struct Scan *sc, int fd, enum Compression comp)
+{
+    unsigned int raw_len, comp_len;
+    off_t off = ZHEADER_SIZE;
+
+    while(zframes_read_header(fd, off, &raw_len, &comp_len) == 1)
+    {
+        char *data;
+
+        data = zframes_decode(fd, comp, off, raw_len, comp_len);
+        if (data == NULL)
+            break;
+        scan_feed(sc, data, raw_len);
+        free(data);
+        off += ZFRAME_HEADER_SIZE + comp_len;
+    }
+}
+
+static void scan_file(struct GrepJob *j, char *buf)
+{
+    struct Scan sc;
+    enum Compression comp;
+    int fd;
+
+    fd = open(j->fname, O_RDONLY);
+    if (fd == -1)
+        return; /* Removed, or not created yet */
+
+    memset(&sc, 0, sizeof sc);
+    sc.job = j;
+    sc.skip = SKIP_LINE;
+    comp = zframes_check(fd);
+    if (comp != COMPRESS_NONE)
+        scan_frames(&sc, fd, comp);
+    else
+    {
+        ssize_t res;
+        while((res = read(fd, buf, READ_SIZE)) != 0)
+        {
+            if (res == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            scan_feed(&sc, buf, res);
+        }
+    }
+    if (sc.carry_len > 0)
+        scan_lines(&sc, sc.carry, sc.carry_len);
+
+    close(fd);
+    free(sc.carry);
+    free(sc.line);
+}
+
+static void *grep_worker(void *arg)
+{
+    char *buf;
+
+    buf = (char *) malloc(READ_SIZE);
+    if (buf == NULL)
+        error("Not enough memory for the grep buffers");
+
+    while(1)
+    {
+        int i;
+
+        pthread_mutex_lock(&lock);
+        i = next_job++;
+        pthread_mutex_unlock(&lock);
+        if (i >= num_jobs)
+            break;
+
+        scan_file(&jobs[i], buf);
+
+        pthread_mutex_lock(&lock);
+        jobs[i].done = 1;
+        pthread_cond_broadcast(&job_done);
+        pthread_mutex_unlock(&lock);
+    }
+    free(buf);
+    return arg;
+}
+
+static int compare_jobs(const void *a, const void *b)
+{
+    return ((const struct GrepJob *) a)->jobid
+        - ((const struct GrepJob *) b)->jobid;
+}
+
+static int nthreads()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n < 1)
+        n = 1;
+    if (n > num_jobs)
+        n = num_jobs;
+    return n;
+}
+
+/* Returns 0 if some line matched, 1 otherwise, as grep */
+int c_grep()
+{
+    pthread_t *threads;
+    int *jobids;
+    char **fnames;
+    int found = 0;
+    int n;
+    int i;
+
+    pattern = command_line.grep_pattern;
+    pattern_len = strlen(pattern);
+    use_regex = strpbrk(pattern, ".[]()*+?{}|^$\\") != NULL;
+    if (use_regex)
+    {
+        int res = regcomp(&regex, pattern, REG_EXTENDED | REG_NOSUB);
+        if (res != 0)
+        {
+            char msg[200];
+            regerror(res, &regex, msg, sizeof msg);
+            fprintf(stderr, "Wrong pattern %s: %s\n", pattern, msg);
+            exit(-1);
+        }
+    }
+
+    num_jobs = c_list_outputs(&jobids, &fnames);
+    jobs = (struct GrepJob *) calloc(num_jobs ? num_jobs : 1, sizeof(*jobs));
+    for(i = 0; i < num_jobs; ++i)
+    {
+        jobs[i].jobid = jobids[i];
+        jobs[i].fname = fnames[i];
+    }
+    free(jobids);
+    free(fnames);
+    qsort(jobs, num_jobs, sizeof(*jobs), compare_jobs);
+
+    n = nthreads();
+    threads = (pthread_t *) malloc((n ? n : 1) * sizeof(*threads));
+    for(i = 0; i < n; ++i)
+        if (pthread_create(&threads[i], NULL, grep_worker, NULL) != 0)
+            error("Cannot create the grep threads");
+
+    /* Show the results in job order, as they get ready */
+    for(i = 0; i < num_jobs; ++i)
+    {
+        pthread_mutex_lock(&lock);
+        while(!jobs[i].done)
+            pthread_cond_wait(&job_done, &lock);
+        pthread_mutex_unlock(&lock);
+
+        if (jobs[i].out_len > 0)
+        {
+            found = 1;
+            fwrite(jobs[i].out, 1, jobs[i].out_len, stdout);
+        }
+        free(jobs[i].out);
+        free(jobs[i].fname);
+    }
+
+    for(i = 0; i < n; ++i)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    free(jobs);
+    if (use_regex)
+        regfree(&regex);
+    return found ? 0 : 1;
+}
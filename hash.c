@@ -0,0 +1,80 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2013  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <stdlib.h>
+
+#include "main.h"
+
+/* Hash tables of the records starting with a HashEntry, chained in
+ * buckets. The records are found by the users, who know what they keep:
+ * they look in hash_bucket() for the hash, and compare. The buckets double
+ * when there are as many records. */
+
+/* FNV-1a */
+unsigned int hash_string(const char *str) {
+    unsigned int h = 2166136261u;
+
+    for (; *str != '\0'; ++str) {
+        h ^= (unsigned char) *str;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void grow_buckets(struct HashTable *t) {
+    struct HashEntry **old = t->buckets;
+    unsigned int old_num = t->num_buckets;
+    unsigned int i;
+
+    t->num_buckets = t->num_buckets == 0 ? 256 : t->num_buckets * 2;
+    t->buckets = (struct HashEntry **) calloc(t->num_buckets,
+                                              sizeof(struct HashEntry *));
+    if (t->buckets == 0)
+        error("Cannot allocate %u hash buckets", t->num_buckets);
+
+    for (i = 0; i < old_num; ++i) {
+        struct HashEntry *e = old[i];
+        while (e != 0) {
+            struct HashEntry *next = e->next;
+            unsigned int n = e->hash & (t->num_buckets - 1);
+            e->next = t->buckets[n];
+            t->buckets[n] = e;
+            e = next;
+        }
+    }
+    free(old);
+}
+
+/* The first record of the bucket of the hash, or 0 */
+struct HashEntry *hash_bucket(const struct HashTable *t, unsigned int hash) {
+    if (t->num_buckets == 0)
+        return 0;
+    return t->buckets[hash & (t->num_buckets - 1)];
+}
+
+/* The entry has its hash set */
+void hash_insert(struct HashTable *t, struct HashEntry *e) {
+    unsigned int n;
+
+    if (t->count >= t->num_buckets)
+        grow_buckets(t);
+    n = e->hash & (t->num_buckets - 1);
+    e->next = t->buckets[n];
+    t->buckets[n] = e;
+    ++t->count;
+}
+
+void hash_remove(struct HashTable *t, struct HashEntry *e) {
+    struct HashEntry **pe;
+
+    for (pe = &t->buckets[e->hash & (t->num_buckets - 1)]; *pe != 0;
+         pe = &(*pe)->next)
+        if (*pe == e) {
+            *pe = e->next;
+            --t->count;
+            return;
+        }
+}
@@ -0,0 +1,459 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2013  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "main.h"
+
+/* The finished jobs the server forgets (TS_MAXFINISHED, -C, the server
+ * end) go to the history file of TS_HISTORY, for ts --history.
+ *
+ * The file has a header and fixed size records, in the order the jobs got
+ * forgotten, so by the time they ended. Their strings go to another file,
+ * TS_HISTORY with ".strings", and the records have their offsets there.
+ * The server only appends to them; the clients map them to read, with no
+ * server. Servers sharing the files take turns through a lock; as their
+ * records interleave, the header tells once they are not in order. */
+
+enum {
+    HISTORY_MAGIC = 0x54534831, /* "TSH1" */
+    HISTORY_VERSION = 1
+};
+
+enum {
+    HISTORY_UNSORTED = 1 /* A record ended before the one written before */
+};
+
+struct HistoryHeader {
+    int magic;
+    int version;
+    int record_size;
+    int flags;
+};
+
+struct HistoryRecord {
+    int jobid;
+    int state;
+    int store_output;
+    int errorlevel;
+    int died_by_signal;
+    int signal;
+    float real_ms;
+    int num_gpus;
+    unsigned int label_hash; /* To look for a label without its string */
+    float queue_wait; /* Seconds queued before it ran. -1 if it did not */
+    long long enqueue_time;
+    long long start_time;
+    long long end_time;
+    /* Offsets in the strings. -1 for none */
+    long long command;
+    long long label;
+    long long output;
+};
+
+/* Server side */
+static int history_fd = -1;
+static int strings_fd = -1;
+static int history_broken = 0; /* Not to warn again and again */
+
+static char *strings_path(const char *path) {
+    char *p;
+
+    p = (char *) malloc(strlen(path) + sizeof(".strings"));
+    if (p == 0)
+        error("Cannot allocate the history strings path");
+    sprintf(p, "%s.strings", path);
+    return p;
+}
+
+static int check_header(int fd) {
+    struct HistoryHeader h;
+    struct stat st;
+
+    if (fstat(fd, &st) == -1)
+        return -1;
+    if (st.st_size == 0) {
+        h.magic = HISTORY_MAGIC;
+        h.version = HISTORY_VERSION;
+        h.record_size = sizeof(struct HistoryRecord);
+        h.flags = 0;
+        return write(fd, &h, sizeof(h)) == sizeof(h) ? 0 : -1;
+    }
+    if (pread(fd, &h, sizeof(h), 0) != sizeof(h)
+        || h.magic != HISTORY_MAGIC || h.version != HISTORY_VERSION
+        || h.record_size != sizeof(struct HistoryRecord))
+        return -1;
+    return 0;
+}
+
+static int history_open() {
+    const char *path = getenv("TS_HISTORY");
+    char *spath;
+
+    if (history_fd != -1)
+        return 0;
+    if (path == NULL || history_broken)
+        return -1;
+
+    /* The server runs in the directory of the socket */
+    history_broken = 1;
+    if (path[0] != '/') {
+        warning("TS_HISTORY is not an absolute path: %s", path);
+        return -1;
+    }
+    /* Not O_APPEND, to set the flags of the header */
+    history_fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (history_fd == -1) {
+        warning("Cannot open the history %s", path);
+        return -1;
+    }
+    spath = strings_path(path);
+    strings_fd = open(spath, O_RDWR | O_APPEND | O_CREAT, 0600);
+    free(spath);
+    if (strings_fd == -1) {
+        warning("Cannot open the strings of the history %s", path);
+        close(history_fd);
+        history_fd = -1;
+        return -1;
+    }
+
+    lockf(history_fd, F_LOCK, 0);
+    if (check_header(history_fd) == -1) {
+        warning("The history %s is not of this ts", path);
+        lockf(history_fd, F_ULOCK, 0);
+        close(history_fd);
+        close(strings_fd);
+        history_fd = -1;
+        strings_fd = -1;
+        return -1;
+    }
+    lockf(history_fd, F_ULOCK, 0);
+    history_broken = 0;
+    return 0;
+}
+
+static long long add_string(const char *str) {
+    off_t offset;
+    size_t len;
+
+    if (str == 0)
+        return -1;
+    offset = lseek(strings_fd, 0, SEEK_END);
+    len = strlen(str) + 1;
+    if (offset == -1 || write(strings_fd, str, len) != (ssize_t) len)
+        return -1;
+    return offset;
+}
+
+/* Flags the header, if the record to add at 'size' ended before the last */
+static void check_order(off_t size, long long end_time) {
+    struct HistoryHeader h;
+    long long last_end;
+    off_t last = size - sizeof(struct HistoryRecord);
+
+    if (last < (off_t) sizeof(h))
+        return;
+    if (pread(history_fd, &last_end, sizeof(last_end),
+              last + offsetof(struct HistoryRecord, end_time))
+            != sizeof(last_end)
+        || last_end <= end_time)
+        return;
+    if (pread(history_fd, &h, sizeof(h), 0) != sizeof(h)
+        || (h.flags & HISTORY_UNSORTED))
+        return;
+    h.flags |= HISTORY_UNSORTED;
+    if (pwrite(history_fd, &h, sizeof(h), 0) != sizeof(h))
+        warning("Cannot update the header of the history");
+}
+
+static long long seconds(const struct timeval *t) {
+    return t->tv_sec;
+}
+
+/* The server forgets the finished job */
+void s_history_add(const struct Job *p) {
+    struct HistoryRecord r;
+    struct stat st;
+    off_t size = -1;
+    off_t extra;
+
+    if (history_open() == -1)
+        return;
+
+    /* From the start, to lock the whole file */
+    lseek(history_fd, 0, SEEK_SET);
+    lockf(history_fd, F_LOCK, 0);
+
+    /* A record cut by a crash would shift all the next */
+    if (fstat(history_fd, &st) == 0) {
+        extra = (st.st_size - sizeof(struct HistoryHeader))
+                % sizeof(struct HistoryRecord);
+        size = st.st_size - extra;
+        if (extra != 0)
+            ftruncate(history_fd, size);
+    }
+
+    memset(&r, 0, sizeof(r));
+    r.jobid = p->jobid;
+    r.state = p->state;
+    r.store_output = p->store_output;
+    r.errorlevel = p->result.errorlevel;
+    r.died_by_signal = p->result.died_by_signal;
+    r.signal = p->result.signal;
+    r.real_ms = p->result.real_ms;
+    r.num_gpus = p->num_gpus;
+    r.label_hash = p->label != 0 ? hash_string(p->label) : 0;
+    r.queue_wait = pinfo_time_queued(&p->info);
+    r.enqueue_time = seconds(&p->info.enqueue_time);
+    r.start_time = seconds(&p->info.start_time);
+    r.end_time = seconds(&p->info.end_time);
+    r.command = add_string(p->command);
+    r.label = add_string(p->label);
+    r.output = add_string(p->output_filename);
+    if (size != -1)
+        check_order(size, r.end_time);
+    lseek(history_fd, 0, SEEK_END);
+    if (write(history_fd, &r, sizeof(r)) != sizeof(r))
+        warning("Cannot write the job %i to the history", p->jobid);
+
+    lseek(history_fd, 0, SEEK_SET);
+    lockf(history_fd, F_ULOCK, 0);
+}
+
+/* Reading it: the clients, and the server for ts --stats */
+
+struct History {
+    const struct HistoryRecord *records;
+    int num_records;
+    const char *strings;
+    size_t strings_size;
+    int unsorted;
+    void *map;
+    size_t map_size;
+};
+
+/* The string at the offset, if all of it was written */
+static char *history_string(const struct History *h, long long offset) {
+    if (offset < 0 || (size_t) offset >= h->strings_size)
+        return 0;
+    if (memchr(h->strings + offset, '\0', h->strings_size - offset) == 0)
+        return 0;
+    return (char *) h->strings + offset;
+}
+
+/* The first record ended at 'since' or later. Records of many servers may
+ * be out of order: then all have to be looked at. */
+static int first_since(const struct History *h, time_t since) {
+    int low = 0;
+    int high = h->num_records;
+
+    if (h->unsorted)
+        return 0;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (h->records[mid].end_time < since)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+static int record_matches(const struct History *h,
+                          const struct HistoryRecord *r) {
+    if (command_line.time_since != -1 && r->end_time < command_line.time_since)
+        return 0;
+    if (command_line.history_failed
+        && (r->state != FINISHED
+            || (r->errorlevel == 0 && !r->died_by_signal)))
+        return 0;
+    if (command_line.label != 0) {
+        const char *label;
+
+        if (r->label_hash != hash_string(command_line.label))
+            return 0;
+        label = history_string(h, r->label);
+        if (label == 0 || strcmp(label, command_line.label) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+static void print_headers() {
+#ifndef CPU
+    printf("%-19s %-4s %-10s %-20s %-8s %-6s %-5s %s\n", "End", "ID",
+           "State", "Output", "E-Level", "Time", "GPUs", "Command");
+#else
+    printf("%-19s %-4s %-10s %-20s %-8s %-6s %s\n", "End", "ID", "State",
+           "Output", "E-Level", "Time", "Command");
+#endif
+}
+
+/* The record as a job, with pointers into the strings */
+static void record_job(const struct History *h, const struct HistoryRecord *r,
+                       struct Job *job) {
+    long long wait_us;
+
+    memset(job, 0, sizeof(*job));
+    job->jobid = r->jobid;
+    job->state = r->state;
+    job->store_output = r->store_output;
+    job->result.errorlevel = r->errorlevel;
+    job->result.died_by_signal = r->died_by_signal;
+    job->result.signal = r->signal;
+    job->result.real_ms = r->real_ms;
+    job->num_gpus = r->num_gpus;
+    job->command = history_string(h, r->command);
+    if (job->command == 0)
+        job->command = "";
+    job->label = history_string(h, r->label);
+    job->output_filename = history_string(h, r->output);
+
+    job->info.end_time.tv_sec = r->end_time;
+    if (r->queue_wait >= 0) {
+        job->info.start_time.tv_sec = r->start_time;
+        wait_us = (long long) (r->queue_wait * 1000000);
+        job->info.enqueue_time.tv_sec = r->start_time - wait_us / 1000000;
+        job->info.enqueue_time.tv_usec = -(wait_us % 1000000);
+        if (job->info.enqueue_time.tv_usec < 0) {
+            job->info.enqueue_time.tv_sec -= 1;
+            job->info.enqueue_time.tv_usec += 1000000;
+        }
+    } else
+        job->info.enqueue_time.tv_sec = r->enqueue_time;
+}
+
+static void print_record(const struct History *h,
+                         const struct HistoryRecord *r) {
+    struct Job job;
+    char end[30];
+    time_t t = (time_t) r->end_time;
+    char *line;
+
+    record_job(h, r, &job);
+    strftime(end, sizeof(end), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    line = joblist_line(&job);
+    printf("%-19s %s", end, line);
+    free(line);
+}
+
+/* Maps the history and its strings. Returns -1 if there is none, and -2
+ * if it is not of this ts. */
+static int history_map(const char *path, struct History *h) {
+    struct HistoryHeader header;
+    struct stat st;
+    char *spath;
+    int fd;
+
+    memset(h, 0, sizeof(*h));
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(header)) {
+        close(fd);
+        return -1;
+    }
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header)
+        || header.magic != HISTORY_MAGIC
+        || header.version != HISTORY_VERSION
+        || header.record_size != sizeof(struct HistoryRecord)) {
+        close(fd);
+        return -2;
+    }
+    h->unsorted = (header.flags & HISTORY_UNSORTED) != 0;
+    h->num_records = (st.st_size - sizeof(header))
+                     / sizeof(struct HistoryRecord);
+    if (h->num_records > 0) {
+        h->map_size = st.st_size;
+        h->map = mmap(NULL, h->map_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (h->map == MAP_FAILED)
+            error("Cannot map the history %s", path);
+        h->records = (const struct HistoryRecord *)
+                     ((const char *) h->map + sizeof(header));
+    }
+    close(fd);
+
+    /* After the records: it has all their strings */
+    spath = strings_path(path);
+    fd = open(spath, O_RDONLY);
+    free(spath);
+    if (fd != -1 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        h->strings_size = st.st_size;
+        h->strings = (const char *) mmap(NULL, h->strings_size, PROT_READ,
+                                         MAP_SHARED, fd, 0);
+        if (h->strings == MAP_FAILED) {
+            h->strings = 0;
+            h->strings_size = 0;
+        }
+    }
+    if (fd != -1)
+        close(fd);
+    return 0;
+}
+
+static void history_unmap(struct History *h) {
+    if (h->map != 0)
+        munmap(h->map, h->map_size);
+    if (h->strings != 0)
+        munmap((void *) h->strings, h->strings_size);
+}
+
+/* Calls fn for each job in the history, as the server does for ts --stats.
+ * Nothing, if there is none. */
+void history_each(void (*fn)(const struct Job *p, void *data), void *data) {
+    const char *path = getenv("TS_HISTORY");
+    struct History h;
+    struct Job job;
+    int i;
+
+    if (path == NULL || path[0] != '/' || history_map(path, &h) != 0)
+        return;
+    for (i = 0; i < h.num_records; ++i) {
+        record_job(&h, &h.records[i], &job);
+        fn(&job, data);
+    }
+    history_unmap(&h);
+}
+
+void c_history() {
+    const char *path = getenv("TS_HISTORY");
+    struct History h;
+    int i;
+
+    if (path == NULL) {
+        fprintf(stderr, "--history needs TS_HISTORY, the file of the "
+                        "history\n");
+        exit(-1);
+    }
+    if (path[0] != '/') {
+        fprintf(stderr, "TS_HISTORY must be an absolute path\n");
+        exit(-1);
+    }
+
+    switch (history_map(path, &h)) {
+        case -1:
+            print_headers();
+            return;
+        case -2:
+            fprintf(stderr, "The history %s is not of this ts\n", path);
+            exit(-1);
+    }
+    print_headers();
+    i = command_line.time_since != -1 ? first_since(&h, command_line.time_since)
+                                      : 0;
+    for (; i < h.num_records; ++i)
+        if (record_matches(&h, &h.records[i]))
+            print_record(&h, &h.records[i]);
+    history_unmap(&h);
+}
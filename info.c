@@ -4,19 +4,11 @@
 
     Please find the license in the provided COPYING file.
 */
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <stdio.h>
-#include <stdarg.h>
 #include <sys/time.h>
 #include "main.h"
 
 void pinfo_init(struct Procinfo *p)
 {
-    p->ptr = 0;
-    p->nchars = 0;
-    p->allocchars = 0;
     p->start_time.tv_sec = 0;
     p->start_time.tv_usec = 0;
     p->end_time.tv_sec = 0;
@@ -25,74 +17,6 @@ void pinfo_init(struct Procinfo *p)
     p->enqueue_time.tv_usec = 0;
 }
 
-void pinfo_free(struct Procinfo *p)
-{
-    if (p->ptr)
-    {
-        free(p->ptr);
-    }
-    p->nchars = 0;
-    p->allocchars = 0;
-}
-
-void pinfo_addinfo(struct Procinfo *p, int maxsize, const char *line, ...)
-{
-    va_list ap;
-
-    int newchars = p->nchars + maxsize;
-    void *newptr;
-    int res;
-
-    va_start(ap, line);
-
-    /* Ask for more memory for the array, if needed */
-    if (newchars > p->allocchars)
-    {
-        int newmem;
-        int newalloc;
-        newalloc = newchars;
-        newmem = newchars * sizeof(*p->ptr);
-        newptr = realloc(p->ptr, newmem);
-        if(newptr == 0)
-        {
-            warning("Cannot realloc more memory (%i) in pinfo_addline. "
-                    "Not adding the content.", newmem);
-            va_end(ap);
-            return;
-        }
-        p->ptr = (char *) newptr;
-        p->allocchars = newalloc;
-    }
-
-    res = vsnprintf(p->ptr + p->nchars, (p->allocchars - p->nchars), line, ap);
-    p->nchars += res; /* We don't store the final 0 */
-    va_end(ap);
-}
-
-void pinfo_dump(const struct Procinfo *p, int fd)
-{
-    if (p->ptr)
-    {
-        int res;
-        int rest = p->nchars;
-        while (rest > 0)
-        {
-            res = write(fd, p->ptr, rest);
-            if (res == -1)
-            {
-                warning("Cannot write more chars in pinfo_dump");
-                return;
-            }
-            rest -= res;
-        }
-    }
-}
-
-int pinfo_size(const struct Procinfo *p)
-{
-    return p->nchars;
-}
-
 void pinfo_set_enqueue_time(struct Procinfo *p)
 {
     gettimeofday(&p->enqueue_time, 0);
@@ -127,6 +51,19 @@ float pinfo_time_until_now(const struct Procinfo *p)
     return t;
 }
 
+/* Seconds from queued to run. -1 if it did not run. */
+float pinfo_time_queued(const struct Procinfo *p)
+{
+    float t;
+
+    if (p->start_time.tv_sec == 0)
+        return -1;
+    t = p->start_time.tv_sec - p->enqueue_time.tv_sec;
+    t += (float) (p->start_time.tv_usec - p->enqueue_time.tv_usec) / 1000000.;
+
+    return t;
+}
+
 float pinfo_time_run(const struct Procinfo *p)
 {
     float t;
@@ -12,6 +12,9 @@
 #include <sys/time.h>
 #include <time.h>
 #include <sys/socket.h>
+#include <sys/select.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include "main.h"
 #include "cjson/cJSON.h"
@@ -20,15 +23,58 @@
 int busy_slots = 0;
 int max_slots = 1;
 
+/* ts -w: a connection waiting for one or many jobs to end */
 struct Notify {
     int socket;
-    int jobid;
+    int pending;    /* Jobs still to end */
+    int errorlevel; /* The last one not zero */
+    int *jobs;      /* -1 for those already ended */
+    int num_jobs;
     struct Notify *next;
 };
 
+/* In the job, one for each Notify waiting for it */
+struct Waiter {
+    struct Notify *notify;
+    int index; /* In notify->jobs */
+    struct Waiter *next;
+};
+
+/* ts --watch: a connection getting the events of the jobs matching its
+ * label and job list (any, if not given) */
+struct Watcher {
+    int socket;
+    char *label;
+    int *jobs;
+    int num_jobs;
+    char *buf;   /* Events the socket did not take yet */
+    int used;
+    int dropped; /* Too slow, the server closes it */
+    struct Watcher *next;
+};
+
+/* The events kept for a slow watcher, before dropping it */
+enum { WATCH_BUFFER = 64 * 1024 };
+
+/* TS_POLICY */
+enum Policy {
+    POLICY_FIFO,
+    POLICY_SJF,
+    POLICY_EDF
+};
+
+/* A queued job, for the ETAs */
+struct Queued {
+    struct Job *job;
+    int pos; /* In the queue, for the ties */
+};
+
 /* Globals */
 static struct Job *firstjob = 0;
 static struct Job *first_finished_job = 0;
+static struct Job *last_finished_job = 0;
+static int num_finished_jobs = 0;
+static struct Slab job_slab = {sizeof(struct Job), 0, 0, 0};
 static int jobids = 0;
 /* This is used for dependencies from jobs
  * already out of the queue */
@@ -39,11 +85,25 @@ static int last_finished_jobid;
 
 static struct Notify *first_notify = 0;
 
+static struct Watcher *first_watcher = 0;
+
+/* Something changed since the last snapshot, or since the last ETAs */
+static int snapshot_dirty = 1;
+static int etas_dirty = 1;
+
 /* server will access them */
 int max_jobs;
 
 static struct Job *get_job(int jobid);
 
+static void watch_event(const struct Job *p, const char *event);
+
+static void wake_waiters(struct Job *p);
+
+static void update_etas();
+
+static enum Policy get_policy();
+
 void notify_errorlevel(struct Job *p);
 
 static void shuffle(int *array, size_t n) {
@@ -59,18 +119,31 @@ static void shuffle(int *array, size_t n) {
     }
 }
 
+/* The jobs, their states or the slots changed */
+static void changed() {
+    snapshot_dirty = 1;
+    etas_dirty = 1;
+}
+
 static void destroy_job(struct Job* p) {
+    changed();
     free(p->notify_errorlevel_to);
-    free(p->command);
+    blob_release(p->command);
     free(p->output_filename);
-    pinfo_free(&p->info);
     free(p->depend_on);
-    free(p->label);
+    blob_release(p->label);
     free(p->gpu_ids);
-    free(p);
+    blob_release(p->pool);
+    s_env_release(p->env);
+    estimate_release(p);
+    if (p->peek != 0) {
+        peek_free(p->peek);
+        free(p->peek);
+    }
+    slab_free(&job_slab, p);
 }
 
-static void send_list_line(int s, const char *str) {
+void send_list_line(int s, const char *str) {
     struct Msg m = default_msg();
 
     /* Message */
@@ -89,6 +162,8 @@ static void send_urgent_ok(int s) {
     /* Message */
     m.type = URGENT_OK;
 
+    /* The client may read the queue next, from the snapshot */
+    s_publish_snapshot();
     send_msg(s, &m);
 }
 
@@ -98,6 +173,7 @@ static void send_swap_jobs_ok(int s) {
     /* Message */
     m.type = SWAP_JOBS_OK;
 
+    s_publish_snapshot();
     send_msg(s, &m);
 }
 
@@ -316,6 +392,8 @@ void s_mark_job_running(int jobid) {
     if (!p)
         error("Cannot mark the jobid %i RUNNING.", jobid);
     p->state = RUNNING;
+    changed();
+    watch_event(p, "started");
 }
 
 /* -1 means nothing awaken, otherwise returns the jobid awaken */
@@ -324,6 +402,7 @@ int wake_hold_client() {
     p = findjob_holding_client();
     if (p) {
         p->state = (p->num_gpus) ? ALLOCATING : QUEUED;
+        changed();
         return p->jobid;
     }
     return -1;
@@ -455,6 +534,8 @@ void s_list(int s, enum ListFormat listFormat) {
     struct Job *p;
     char *buffer = 0;
 
+    update_etas();
+
     if (listFormat == DEFAULT) {
         /* Times:   0.00/0.00/0.00 - 4+4+4+2 = 14*/
         buffer = joblist_headers();
@@ -585,13 +666,23 @@ static void init_job(struct Job *p) {
     p->notify_errorlevel_to = 0;
     p->dependency_errorlevel = 0;
     pinfo_init(&p->info);
+    p->peek = 0;
+    p->stdin_from = -1;
+    p->streams = 0;
+    p->waiters = 0;
+    p->pool = 0;
+    p->env = 0;
+    p->est_command = 0;
+    p->est_label = 0;
+    p->deadline = 0;
+    p->eta = 0;
 }
 
 static struct Job *newjobptr() {
     struct Job *p;
 
     if (firstjob == 0) {
-        firstjob = (struct Job *) malloc(sizeof(*firstjob));
+        firstjob = (struct Job *) slab_alloc(&job_slab);
         init_job(firstjob);
         return firstjob;
     }
@@ -600,7 +691,7 @@ static struct Job *newjobptr() {
     while (p->next != 0)
         p = p->next;
 
-    p->next = (struct Job *) malloc(sizeof(*p));
+    p->next = (struct Job *) slab_alloc(&job_slab);
     init_job(p->next);
     return p->next;
 }
@@ -662,6 +753,7 @@ int s_newjob(int s, struct Msg *m) {
 
     p->num_slots = m->u.newjob.num_slots;
     p->store_output = m->u.newjob.store_output;
+    p->stdin_from = m->u.newjob.stdin_from;
     p->should_keep_finished = m->u.newjob.should_keep_finished;
 
     /* this error level here is used internally to decide whether a job should be run or not
@@ -754,6 +846,7 @@ int s_newjob(int s, struct Msg *m) {
         p->depend_on = 0;
 
     pinfo_set_enqueue_time(&p->info);
+    p->deadline = m->u.newjob.deadline;
 
     /* load the command */
     p->command = malloc(m->u.newjob.command_size);
@@ -763,6 +856,8 @@ int s_newjob(int s, struct Msg *m) {
     res = recv_bytes(s, p->command, m->u.newjob.command_size);
     if (res == -1)
         error("wrong bytes received");
+    p->command[m->u.newjob.command_size - 1] = '\0';
+    p->command = blob_take(p->command);
 
     /* load the label */
     if (m->u.newjob.label_size > 0) {
@@ -774,10 +869,12 @@ int s_newjob(int s, struct Msg *m) {
         res = recv_bytes(s, ptr, m->u.newjob.label_size);
         if (res == -1)
             error("wrong bytes received");
-        p->label = ptr;
+        ptr[m->u.newjob.label_size - 1] = '\0';
+        p->label = blob_take(ptr);
     }
 
-    /* load the info */
+    /* load the info, shared with the jobs with the same */
+    m->u.newjob.env_key[ENV_KEY_SIZE - 1] = '\0';
     if (m->u.newjob.env_size > 0) {
         char *ptr;
         ptr = (char *) malloc(m->u.newjob.env_size);
@@ -787,10 +884,26 @@ int s_newjob(int s, struct Msg *m) {
         res = recv_bytes(s, ptr, m->u.newjob.env_size);
         if (res == -1)
             error("wrong bytes received");
-        pinfo_addinfo(&p->info, m->u.newjob.env_size + 100,
-                      "Environment:\n%s", ptr);
-        free(ptr);
+        ptr[m->u.newjob.env_size - 1] = '\0';
+        p->env = s_env_store(m->u.newjob.env_key, m->u.newjob.env_ttl, ptr);
+    } else
+        p->env = s_env_cached(m->u.newjob.env_key);
+
+    /* load the pool */
+    if (m->u.newjob.pool_size > 0) {
+        p->pool = (char *) malloc(m->u.newjob.pool_size);
+        if (p->pool == 0)
+            error("Cannot allocate memory in s_newjob pool_size(%i)",
+                  m->u.newjob.pool_size);
+        res = recv_bytes(s, p->pool, m->u.newjob.pool_size);
+        if (res == -1)
+            error("wrong bytes received");
+        p->pool[m->u.newjob.pool_size - 1] = '\0';
+        p->pool = blob_take(p->pool);
     }
+    estimate_attach(p);
+    changed();
+    watch_event(p, "queued");
     return p->jobid;
 }
 
@@ -799,6 +912,8 @@ void s_removejob(int jobid) {
     struct Job *p;
     struct Job *newnext;
 
+    watch_event(findjob(jobid), "removed");
+
     if (firstjob->jobid == jobid) {
         struct Job *newfirst;
 
@@ -825,9 +940,162 @@ void s_removejob(int jobid) {
     p->next = newnext;
 }
 
+/* TS_POLICY: the order in which the queued jobs run */
+static enum Policy get_policy() {
+    const char *str = getenv("TS_POLICY");
+
+    if (str == NULL)
+        return POLICY_FIFO;
+    if (strcmp(str, "sjf") == 0)
+        return POLICY_SJF;
+    if (strcmp(str, "edf") == 0)
+        return POLICY_EDF;
+    return POLICY_FIFO;
+}
+
+/* Whether a runs before b by the policy. If not, nor b before a, they run
+ * in the order of the queue. */
+static int runs_before(const struct Job *a, const struct Job *b,
+                       enum Policy policy) {
+    switch (policy) {
+        case POLICY_SJF:
+            /* The shortest expected run first */
+            return estimate_of(a) < estimate_of(b);
+        case POLICY_EDF:
+            /* The earliest deadline first, and those without one last */
+            return a->deadline != 0
+                   && (b->deadline == 0 || a->deadline < b->deadline);
+        default:
+            return 0;
+    }
+}
+
+static enum Policy eta_policy; /* For compare_queued() */
+
+static int compare_queued(const void *a, const void *b) {
+    const struct Queued *qa = (const struct Queued *) a;
+    const struct Queued *qb = (const struct Queued *) b;
+
+    if (runs_before(qa->job, qb->job, eta_policy))
+        return -1;
+    if (runs_before(qb->job, qa->job, eta_policy))
+        return 1;
+    /* qsort() is not stable */
+    return qa->pos - qb->pos;
+}
+
+/* The job takes the num slots free first (the times they get free), from
+ * 'after' on, for 'run' seconds. Returns when it ends. */
+static time_t take_slots(time_t *slots, int num_slots, int num, time_t after,
+                         time_t run) {
+    int *taken;
+    time_t start = after;
+    int i;
+    int j;
+
+    if (num > num_slots)
+        num = num_slots;
+    taken = (int *) malloc((num > 0 ? num : 1) * sizeof(int));
+    if (taken == 0)
+        error("Cannot allocate the slots taken");
+    for (j = 0; j < num; ++j) {
+        int first = -1;
+        for (i = 0; i < num_slots; ++i) {
+            int k;
+            for (k = 0; k < j && taken[k] != i; ++k)
+                ;
+            if (k == j && (first == -1 || slots[i] < slots[first]))
+                first = i;
+        }
+        taken[j] = first;
+        if (slots[first] > start)
+            start = slots[first];
+    }
+    for (j = 0; j < num; ++j)
+        slots[taken[j]] = start + run;
+    free(taken);
+    return start + run;
+}
+
+/* The expected end of the jobs not finished, for ts -l. The running ones
+ * end as estimated, and the queued ones take the slots in the order of
+ * the policy, after the jobs they depend on. The GPUs are not counted.
+ * Only computed again when the queue or the policy change. */
+static void update_etas() {
+    struct Queued *queued;
+    struct Job *p;
+    time_t *slots;
+    time_t now = time(NULL);
+    int num_slots = max_slots > busy_slots ? max_slots : busy_slots;
+    int num_queued = 0;
+    int i;
+
+    if (!etas_dirty && get_policy() == eta_policy)
+        return;
+    etas_dirty = 0;
+    eta_policy = get_policy();
+    /* They go in the snapshot */
+    snapshot_dirty = 1;
+
+    if (num_slots < 1)
+        num_slots = 1;
+    slots = (time_t *) malloc(num_slots * sizeof(time_t));
+    queued = (struct Queued *) malloc(
+        (count_not_finished_jobs() + 1) * sizeof(struct Queued));
+    if (slots == 0 || queued == 0)
+        error("Cannot allocate the slots for the ETAs");
+    for (i = 0; i < num_slots; ++i)
+        slots[i] = now;
+
+    for (p = firstjob; p != 0; p = p->next) {
+        float est = estimate_of(p);
+
+        p->eta = 0;
+        if (p->state == QUEUED || p->state == ALLOCATING) {
+            queued[num_queued].job = p;
+            queued[num_queued].pos = num_queued;
+            ++num_queued;
+        }
+        if (p->state != RUNNING || est < 0)
+            continue;
+        p->eta = p->info.start_time.tv_sec + (time_t) (est + 0.5f);
+        if (p->eta < now)
+            p->eta = now;
+        /* The slots it runs in are busy till then */
+        take_slots(slots, num_slots, p->num_slots, p->eta, 0);
+    }
+
+    if (eta_policy != POLICY_FIFO)
+        qsort(queued, num_queued, sizeof(struct Queued), compare_queued);
+
+    for (i = 0; i < num_queued; ++i) {
+        float est;
+        time_t start;
+        int j;
+
+        p = queued[i].job;
+        est = estimate_of(p);
+        if (est < 0)
+            continue;
+        start = now;
+        for (j = 0; j < p->depend_on_size; ++j) {
+            struct Job *d = findjob(p->depend_on[j]);
+            if (d != 0 && d->eta > start)
+                start = d->eta;
+        }
+        p->eta = take_slots(slots, num_slots, p->num_slots, start,
+                            (time_t) (est + 0.5f));
+    }
+
+    free(slots);
+    free(queued);
+}
+
 /* -1 if no one should be run. */
 int next_run_job() {
     struct Job *p;
+    struct Job *best = 0;
+    enum Policy policy = get_policy();
 
     const int free_slots = max_slots - busy_slots;
 
@@ -906,23 +1174,46 @@ int next_run_job() {
                     continue;
             }
 
-            if (free_slots >= p->num_slots) {
-                busy_slots = busy_slots + p->num_slots;
-#ifndef CPU
-                if (p->num_gpus)
-                    broadcastUsedGpus(p->num_gpus, p->gpu_ids);
+            /* With --stdin-from, start along with the job giving the input,
+             * not before */
+            if (p->stdin_from != -1) {
+                struct Job *producer = get_job(p->stdin_from);
+                if (producer != NULL && (producer->state == QUEUED
+                    || producer->state == ALLOCATING
+                    || producer->state == HOLDING_CLIENT)) {
+                    p = p->next;
+                    continue;
+                }
+            }
 
-                free(freeGpuList);
-#endif
-                return p->jobid;
+            /* With --pool, when one of its workers is idle */
+            if (p->pool != 0 && !s_pool_can_run(p->pool)) {
+                p = p->next;
+                continue;
+            }
+
+            if (free_slots >= p->num_slots) {
+                if (best == 0 || runs_before(p, best, policy))
+                    best = p;
+                if (policy == POLICY_FIFO)
+                    break;
             }
         }
         p = p->next;
     }
+
+    if (best != 0) {
+        busy_slots = busy_slots + best->num_slots;
+        changed();
+#ifndef CPU
+        if (best->num_gpus)
+            broadcastUsedGpus(best->num_gpus, best->gpu_ids);
+#endif
+    }
 #ifndef CPU
     free(freeGpuList);
 #endif
-    return -1;
+    return best != 0 ? best->jobid : -1;
 }
 
 /* Returns 1000 if no limit, The limit otherwise. */
@@ -935,37 +1226,57 @@ static int get_max_finished_jobs() {
     return abs(atoi(limit));
 }
 
-/* Add the job to the finished queue. */
-static void new_finished_job(struct Job *j) {
-    struct Job *p;
-    int count, max;
+/* Destroys a finished job the server does not keep any more */
+static void forget_finished_job(struct Job *j) {
+    s_history_add(j);
+    if (j->output_filename != NULL && reaper_enabled())
+        reaper_add(j->output_filename);
+    destroy_job(j);
+}
 
-    max = get_max_finished_jobs();
-    count = 0;
+/* Takes the job out of the finished queue. 'before' is the one pointing
+ * to it, or 0 for the first. */
+static void unlink_finished_job(struct Job *before, struct Job *j) {
+    if (before == 0)
+        first_finished_job = j->next;
+    else
+        before->next = j->next;
+    if (last_finished_job == j)
+        last_finished_job = before;
+    --num_finished_jobs;
+}
 
-    if (first_finished_job == 0 && count < max) {
-        first_finished_job = j;
-        first_finished_job->next = 0;
-        return;
-    }
+/* What a finished job does not need any more: the jobs to notify got
+ * notified, and its TS_ENV output is only for -i. */
+static void compact_finished_job(struct Job *j) {
+    free(j->notify_errorlevel_to);
+    j->notify_errorlevel_to = 0;
+    j->notify_errorlevel_to_size = 0;
+    s_env_spill(j->env);
+}
 
-    ++count;
+/* Add the job to the finished queue. */
+static void new_finished_job(struct Job *j) {
+    int max;
 
-    p = first_finished_job;
-    while (p->next != 0) {
-        p = p->next;
-        ++count;
-    }
+    compact_finished_job(j);
+    max = get_max_finished_jobs();
 
     /* If too many jobs, wipe out the first */
-    if (count >= max) {
+    if (num_finished_jobs > 0 && num_finished_jobs >= max) {
         struct Job *tmp;
         tmp = first_finished_job;
-        first_finished_job = first_finished_job->next;
-        destroy_job(tmp);
+        unlink_finished_job(0, tmp);
+        forget_finished_job(tmp);
     }
-    p->next = j;
-    p->next->next = 0;
+
+    j->next = 0;
+    if (last_finished_job == 0)
+        first_finished_job = j;
+    else
+        last_finished_job->next = j;
+    last_finished_job = j;
+    ++num_finished_jobs;
 }
 
 static int job_is_in_state(int jobid, enum Jobstate state) {
@@ -987,19 +1298,6 @@ int job_is_holding_client(int jobid) {
     return job_is_in_state(jobid, HOLDING_CLIENT);
 }
 
-static int in_notify_list(int jobid) {
-    struct Notify *n, *tmp;
-
-    n = first_notify;
-    while (n != 0) {
-        tmp = n;
-        n = n->next;
-        if (tmp->jobid == jobid)
-            return 1;
-    }
-    return 0;
-}
-
 void job_finished(const struct Result *result, int jobid) {
     struct Job *p;
 
@@ -1021,20 +1319,27 @@ void job_finished(const struct Result *result, int jobid) {
     if (p->state == RUNNING)
         busy_slots = busy_slots - p->num_slots;
 
+    /* The worker keeps on for the next job, unless the job got cut */
+    if (p->pool != 0)
+        s_pool_release(jobid, !result->died_by_signal);
+
     /* Mark state */
     if (result->skipped)
         p->state = SKIPPED;
     else
         p->state = FINISHED;
     p->result = *result;
+    changed();
+    if (p->peek != 0) { /* Only kept while running */
+        peek_free(p->peek);
+        free(p->peek);
+        p->peek = 0;
+    }
     last_finished_jobid = p->jobid;
     notify_errorlevel(p);
     pinfo_set_end_time(&p->info);
-
-    if (p->result.died_by_signal)
-        pinfo_addinfo(&p->info, 100, "Exit status: killed by signal %i\n", p->result.signal);
-    else
-        pinfo_addinfo(&p->info, 100, "Exit status: died with exit code %i\n", p->result.errorlevel);
+    estimate_learn(p);
+    watch_event(p, p->state == SKIPPED ? "skipped" : "finished");
 
     /* Find the pointing node, to
      * update it removing the finished job. */
@@ -1056,7 +1361,7 @@ void job_finished(const struct Result *result, int jobid) {
         }
 
         /* Add it to the finished queue (maybe temporarily) */
-        if (p->should_keep_finished || in_notify_list(p->jobid))
+        if (p->should_keep_finished || p->waiters != 0)
             new_finished_job(p);
 
         /* Remove it from the run queue */
@@ -1076,16 +1381,33 @@ void s_clear_finished() {
 
     p = first_finished_job;
     first_finished_job = 0;
+    last_finished_job = 0;
+    num_finished_jobs = 0;
 
     while (p != 0) {
         struct Job *tmp;
         tmp = p->next;
-        destroy_job(p);
+        forget_finished_job(p);
         p = tmp;
     }
 }
 
-void s_process_runjob_ok(int jobid, char *oname, int pid) {
+void s_each_finished(void (*fn)(const struct Job *p, void *data), void *data) {
+    struct Job *p;
+
+    for (p = first_finished_job; p != 0; p = p->next)
+        fn(p, data);
+}
+
+/* At the server end, the finished jobs go to the history too */
+void s_history_finished() {
+    struct Job *p;
+
+    for (p = first_finished_job; p != 0; p = p->next)
+        s_history_add(p);
+}
+
+void s_process_runjob_ok(int jobid, char *oname, int pid, int peek_size) {
     struct Job *p;
     p = findjob(jobid);
     if (p == 0)
@@ -1097,11 +1419,21 @@ void s_process_runjob_ok(int jobid, char *oname, int pid) {
     p->pid = pid;
     p->output_filename = oname;
     pinfo_set_start_time(&p->info);
+    /* Empty till the first PEEK_DATA, but not off */
+    if (peek_size > 0 && p->peek == 0) {
+        p->peek = (struct Peek *) malloc(sizeof(struct Peek));
+        if (p->peek == 0)
+            error("Cannot allocate the peek of the job %i", jobid);
+        peek_init(p->peek);
+    }
+    changed();
 }
 
 void s_send_runjob(int s, int jobid) {
     struct Msg m = default_msg();
     struct Job *p;
+    int worker_in;
+    int worker_out;
 
     p = findjob(jobid);
     if (p == 0)
@@ -1114,16 +1446,79 @@ void s_send_runjob(int s, int jobid) {
      * Then, on finish, these could set the errorlevel to send to its dependency childs.
      * We cannot consider that the jobs will leave traces in the finished job list (-nf?) . */
 
-    m.u.last_errorlevel = p->dependency_errorlevel;
+    m.u.runjob.last_errorlevel = p->dependency_errorlevel;
+    p->streams = s_has_consumers(jobid);
+    m.u.runjob.stream = p->streams;
+    /* Without a worker, the job runs apart */
+    if (p->pool != 0)
+        m.u.runjob.worker_pid = s_pool_take(p->pool, jobid, &worker_in,
+                                            &worker_out);
     send_msg(s, &m);
 
     /* send GPU IDs */
     send_ints(s, p->gpu_ids, p->num_gpus);
+
+    if (m.u.runjob.worker_pid != 0) {
+        send_fd(s, worker_in);
+        send_fd(s, worker_out);
+    }
 }
 
-void s_job_info(int s, int jobid) {
+/* The information of -i, written as it is into fd */
+static void job_info_dump(int fd, struct Job *p) {
+    s_env_dump(fd, p->env);
+    if (p->state == FINISHED || p->state == SKIPPED) {
+        if (p->result.died_by_signal)
+            fd_nprintf(fd, 100, "Exit status: killed by signal %i\n",
+                       p->result.signal);
+        else
+            fd_nprintf(fd, 100, "Exit status: died with exit code %i\n",
+                       p->result.errorlevel);
+    }
+    fd_nprintf(fd, 100, "Command: ");
+    if (p->depend_on) {
+        fd_nprintf(fd, 100, "[%i,", p->depend_on[0]);
+        for (int i = 1; i < p->depend_on_size; i++)
+            fd_nprintf(fd, 100, ",%i", p->depend_on[i]);
+        fd_nprintf(fd, 100, "]&& ");
+    }
+    write(fd, p->command, strlen(p->command));
+    fd_nprintf(fd, 100, "\n");
+    fd_nprintf(fd, 100, "Slots required: %i\n", p->num_slots);
+    if (p->pool != 0)
+        fd_nprintf(fd, 100, "Pool: %s\n", p->pool);
+#ifndef CPU
+    fd_nprintf(fd, 100, "GPUs required: %d\n", p->num_gpus);
+    fd_nprintf(fd, 100, "GPU IDs: %s\n", ints_to_chars(
+            p->gpu_ids, p->num_gpus ? p->num_gpus : 1, ","));
+#endif
+    fd_nprintf(fd, 100, "Enqueue time: %s",
+               ctime(&p->info.enqueue_time.tv_sec));
+    if (p->deadline != 0)
+        fd_nprintf(fd, 100, "Deadline: %s", ctime(&p->deadline));
+    if (p->state == RUNNING) {
+        fd_nprintf(fd, 100, "Start time: %s",
+                   ctime(&p->info.start_time.tv_sec));
+        float t = pinfo_time_until_now(&p->info);
+        char *unit = time_rep(&t);
+        fd_nprintf(fd, 100, "Time running: %f%s\n", t, unit);
+    } else if (p->state == FINISHED) {
+        fd_nprintf(fd, 100, "Start time: %s",
+                   ctime(&p->info.start_time.tv_sec));
+        fd_nprintf(fd, 100, "End time: %s",
+                   ctime(&p->info.end_time.tv_sec));
+        float t = pinfo_time_run(&p->info);
+        char *unit = time_rep(&t);
+        fd_nprintf(fd, 100, "Time run: %f%s\n", t, unit);
+    }
+}
+
+void s_job_info(int s, int jobid, int sized) {
     struct Job *p = 0;
     struct Msg m = default_msg();
+    FILE *tmp;
+    char *data;
+    int size;
 
     if (jobid == -1) {
         /* This means that we want the job info of the running task, or that
@@ -1163,40 +1558,29 @@ void s_job_info(int s, int jobid) {
     }
 
     m.type = INFO_DATA;
-    send_msg(s, &m);
-    pinfo_dump(&p->info, s);
-    fd_nprintf(s, 100, "Command: ");
-    if (p->depend_on) {
-        fd_nprintf(s, 100, "[%i,", p->depend_on[0]);
-        for (int i = 1; i < p->depend_on_size; i++)
-            fd_nprintf(s, 100, ",%i", p->depend_on[i]);
-        fd_nprintf(s, 100, "]&& ");
+    if (!sized) {
+        /* The end of the data is the end of the connection */
+        send_msg(s, &m);
+        job_info_dump(s, p);
+        return;
     }
-    write(s, p->command, strlen(p->command));
-    fd_nprintf(s, 100, "\n");
-    fd_nprintf(s, 100, "Slots required: %i\n", p->num_slots);
-#ifndef CPU
-    fd_nprintf(s, 100, "GPUs required: %d\n", p->num_gpus);
-    fd_nprintf(s, 100, "GPU IDs: %s\n", ints_to_chars(
-            p->gpu_ids, p->num_gpus ? p->num_gpus : 1, ","));
-#endif
-    fd_nprintf(s, 100, "Enqueue time: %s",
-               ctime(&p->info.enqueue_time.tv_sec));
-    if (p->state == RUNNING) {
-        fd_nprintf(s, 100, "Start time: %s",
-                   ctime(&p->info.start_time.tv_sec));
-        float t = pinfo_time_until_now(&p->info);
-        char *unit = time_rep(&t);
-        fd_nprintf(s, 100, "Time running: %f%s\n", t, unit);
-    } else if (p->state == FINISHED) {
-        fd_nprintf(s, 100, "Start time: %s",
-                   ctime(&p->info.start_time.tv_sec));
-        fd_nprintf(s, 100, "End time: %s",
-                   ctime(&p->info.end_time.tv_sec));
-        float t = pinfo_time_run(&p->info);
-        char *unit = time_rep(&t);
-        fd_nprintf(s, 100, "Time run: %f%s\n", t, unit);
+
+    /* In a session the connection goes on, so the size goes first */
+    tmp = tmpfile();
+    if (tmp == NULL) {
+        send_list_line(s, "Cannot get the job information.\n");
+        return;
     }
+    job_info_dump(fileno(tmp), p);
+    size = lseek(fileno(tmp), 0, SEEK_END);
+    data = (char *) malloc(size);
+    if (pread(fileno(tmp), data, size, 0) != size)
+        size = 0;
+    fclose(tmp);
+    m.u.size = size;
+    send_msg(s, &m);
+    send_bytes(s, data, size);
+    free(data);
 }
 
 void s_send_last_id(int s) {
@@ -1289,6 +1673,7 @@ int s_remove_job(int s, int *jobid) {
     struct Job *p = 0;
     struct Msg m = default_msg();
     struct Job *before_p = 0;
+    int was_finished;
 
     if (*jobid == -1) {
         /* Find the last job added */
@@ -1343,6 +1728,8 @@ int s_remove_job(int s, int *jobid) {
 
     /* Return the jobid found */
     *jobid = p->jobid;
+    watch_event(p, "removed");
+    was_finished = p->state == FINISHED || p->state == SKIPPED;
 
     /* Tricks for the check_notify_list */
     p->state = FINISHED;
@@ -1350,43 +1737,22 @@ int s_remove_job(int s, int *jobid) {
     notify_errorlevel(p);
 
     /* Notify the clients in wait_job */
-    check_notify_list(m.u.jobid);
+    wake_waiters(p);
 
     /* Update the list pointers */
-    if (p == first_finished_job)
-        first_finished_job = p->next;
+    if (was_finished)
+        unlink_finished_job(p == first_finished_job ? 0 : before_p, p);
     else
         before_p->next = p->next;
 
     destroy_job(p);
 
+    s_publish_snapshot();
     m.type = REMOVEJOB_OK;
     send_msg(s, &m);
     return 1;
 }
 
-static void add_to_notify_list(int s, int jobid) {
-    struct Notify *n;
-    struct Notify *new;
-
-    new = (struct Notify *) malloc(sizeof(*new));
-
-    new->socket = s;
-    new->jobid = jobid;
-    new->next = 0;
-
-    n = first_notify;
-    if (n == 0) {
-        first_notify = new;
-        return;
-    }
-
-    while (n->next != 0)
-        n = n->next;
-
-    n->next = new;
-}
-
 static void send_waitjob_ok(int s, int errorlevel) {
     struct Msg m = default_msg();
 
@@ -1411,40 +1777,122 @@ get_job(int jobid) {
     return 0;
 }
 
+static void remove_notify(struct Notify *n) {
+    struct Notify **pn;
+    int i;
+
+    for (pn = &first_notify; *pn != n; pn = &(*pn)->next)
+        ;
+    *pn = n->next;
+
+    /* Unlink it from the jobs it still waits for */
+    for (i = 0; i < n->num_jobs; ++i) {
+        struct Job *p;
+        struct Waiter **pw;
+
+        if (n->jobs[i] == -1)
+            continue;
+        p = get_job(n->jobs[i]);
+        if (p == 0)
+            continue;
+        for (pw = &p->waiters; *pw != 0; pw = &(*pw)->next)
+            if ((*pw)->notify == n && (*pw)->index == i) {
+                struct Waiter *w = *pw;
+                *pw = w->next;
+                free(w);
+                break;
+            }
+    }
+    free(n->jobs);
+    free(n);
+}
+
 /* Don't complain, if the socket doesn't exist */
 void s_remove_notification(int s) {
     struct Notify *n;
-    struct Notify *previous;
+
     n = first_notify;
     while (n != 0 && n->socket != s)
         n = n->next;
-    if (n == 0 || n->socket != s)
+    if (n == 0)
         return;
 
-    /* Remove the notification */
-    previous = first_notify;
-    if (n == previous) {
-        first_notify = n->next;
-        free(n);
+    remove_notify(n);
+}
+
+static struct Notify *new_notify(int s, int max_jobs) {
+    struct Notify *n;
+
+    n = (struct Notify *) malloc(sizeof(*n));
+    if (n == 0)
+        error("Cannot allocate a notification");
+    n->socket = s;
+    n->pending = 0;
+    n->errorlevel = 0;
+    n->jobs = (int *) malloc((max_jobs > 0 ? max_jobs : 1) * sizeof(int));
+    n->num_jobs = 0;
+    n->next = first_notify;
+    first_notify = n;
+    return n;
+}
+
+/* The job counts for n: at once if it ended, or else when it ends */
+static void notify_on(struct Notify *n, struct Job *p) {
+    struct Waiter *w;
+
+    if (p->state == FINISHED || p->state == SKIPPED) {
+        if (p->result.errorlevel != 0)
+            n->errorlevel = p->result.errorlevel;
         return;
     }
 
-    /* if not the first... */
-    while (previous->next != n)
-        previous = previous->next;
+    w = (struct Waiter *) malloc(sizeof(*w));
+    if (w == 0)
+        error("Cannot allocate a waiter");
+    w->notify = n;
+    w->index = n->num_jobs;
+    n->jobs[n->num_jobs++] = p->jobid;
+    ++n->pending;
+    w->next = p->waiters;
+    p->waiters = w;
+}
 
-    previous->next = n->next;
-    free(n);
+/* Answers n if it has nothing left to wait for */
+static void notify_if_done(struct Notify *n) {
+    if (n->pending > 0)
+        return;
+    send_waitjob_ok(n->socket, n->errorlevel);
+    remove_notify(n);
+}
+
+/* The job ended: only the connections waiting for it are looked at */
+static void wake_waiters(struct Job *p) {
+    struct Waiter *w;
+
+    w = p->waiters;
+    p->waiters = 0;
+    while (w != 0) {
+        struct Waiter *next = w->next;
+        struct Notify *n = w->notify;
+
+        n->jobs[w->index] = -1;
+        --n->pending;
+        if (p->result.errorlevel != 0)
+            n->errorlevel = p->result.errorlevel;
+        free(w);
+        notify_if_done(n);
+        w = next;
+    }
 }
 
 static void destroy_finished_job(struct Job *j) {
     if (j == first_finished_job)
-        first_finished_job = j->next;
+        unlink_finished_job(0, j);
     else {
         struct Job *i;
-        for (i = first_finished_job; i != 0; ++i) {
+        for (i = first_finished_job; i != 0; i = i->next) {
             if (i->next == j) {
-                i->next = j->next;
+                unlink_finished_job(i, j);
                 break;
             }
         }
@@ -1458,36 +1906,24 @@ static void destroy_finished_job(struct Job *j) {
 
 /* This is called when a job finishes */
 void check_notify_list(int jobid) {
-    struct Notify *n, *tmp;
     struct Job *j;
 
-    n = first_notify;
-    while (n != 0) {
-        tmp = n;
-        n = n->next;
-        if (tmp->jobid == jobid) {
-            j = get_job(jobid);
-            /* If the job finishes, notify the waiter */
-            if (j->state == FINISHED || j->state == SKIPPED) {
-                send_waitjob_ok(tmp->socket, j->result.errorlevel);
-                /* We want to get the next Nofity* before we remove
-                 * the actual 'n'. As s_remove_notification() simply
-                 * removes the element from the linked list, we can
-                 * safely follow on the list from n->next. */
-                s_remove_notification(tmp->socket);
-
-                /* Remove the jobs that were temporarily in the finished list,
-                 * just for their notifiers. */
-                if (!in_notify_list(jobid) && !j->should_keep_finished) {
-                    destroy_finished_job(j);
-                }
-            }
-        }
-    }
+    /* Only the jobs waited for are kept, besides those to keep */
+    j = find_finished_job(jobid);
+    if (j == 0 || j->waiters == 0)
+        return;
+
+    wake_waiters(j);
+
+    /* Remove the jobs that were temporarily in the finished list,
+     * just for their notifiers. */
+    if (!j->should_keep_finished)
+        destroy_finished_job(j);
 }
 
 void s_wait_job(int s, int jobid) {
     struct Job *p = 0;
+    struct Notify *n;
 
     if (jobid == -1) {
         /* Find the last job added */
@@ -1527,14 +1963,14 @@ void s_wait_job(int s, int jobid) {
         return;
     }
 
-    if (p->state == FINISHED || p->state == SKIPPED) {
-        send_waitjob_ok(s, p->result.errorlevel);
-    } else
-        add_to_notify_list(s, p->jobid);
+    n = new_notify(s, 1);
+    notify_on(n, p);
+    notify_if_done(n);
 }
 
 void s_wait_running_job(int s, int jobid) {
     struct Job *p = 0;
+    struct Notify *n;
 
     /* The job finding algorithm should be similar to that of
      * s_send_output, because this will be used by "-t" and "-c" */
@@ -1578,16 +2014,76 @@ void s_wait_running_job(int s, int jobid) {
         return;
     }
 
-    if (p->state == FINISHED || p->state == SKIPPED) {
-        send_waitjob_ok(s, p->result.errorlevel);
-    } else
-        add_to_notify_list(s, p->jobid);
+    n = new_notify(s, 1);
+    notify_on(n, p);
+    notify_if_done(n);
+}
+
+/* ts -w for many jobs: the listed ones, or those in the queue with the
+ * label, or all in the queue. One answer when all of them ended, with
+ * the last errorlevel not zero. */
+void s_wait_jobs(int s, char *label, int *jobs, int num_jobs) {
+    struct Notify *n;
+    struct Job *p;
+    int i;
+
+    if (num_jobs > 0) {
+        for (i = 0; i < num_jobs; ++i)
+            if (get_job(jobs[i]) == 0) {
+                char tmp[50];
+                sprintf(tmp, "The job %i cannot be waited.\n", jobs[i]);
+                send_list_line(s, tmp);
+                free(label);
+                free(jobs);
+                return;
+            }
+        n = new_notify(s, num_jobs);
+        for (i = 0; i < num_jobs; ++i)
+            notify_on(n, get_job(jobs[i]));
+    } else {
+        int count = 0;
+
+        for (p = firstjob; p != 0; p = p->next)
+            ++count;
+        n = new_notify(s, count);
+        for (p = firstjob; p != 0; p = p->next)
+            if (label == 0 || (p->label != 0 && strcmp(p->label, label) == 0))
+                notify_on(n, p);
+    }
+    free(label);
+    free(jobs);
+    notify_if_done(n);
+}
+
+/* The state of the queue, for the clients that read it without asking.
+ * Nothing to do, if it did not change since the last time. */
+void s_publish_snapshot() {
+    struct Job *p;
+    struct Job *last = 0;
+
+    update_etas();
+    if (!snapshot_dirty)
+        return;
+    snapshot_dirty = 0;
+    snapshot_begin();
+    for (p = firstjob; p != 0; p = p->next) {
+        snapshot_add_job(p);
+        last = p;
+    }
+    for (p = first_finished_job; p != 0; p = p->next) {
+        snapshot_add_job(p);
+        /* The last added, as in s_send_state() */
+        if (firstjob == 0)
+            last = p;
+    }
+    snapshot_commit(jobids - 1, last ? last->jobid : -1);
 }
 
 void s_set_max_slots(int new_max_slots) {
-    if (new_max_slots > 0)
+    if (new_max_slots > 0) {
         max_slots = new_max_slots;
-    else
+        changed();
+    } else
         warning("Received new_max_slots=%i", new_max_slots);
 }
 
@@ -1633,6 +2129,7 @@ void s_move_urgent(int s, int jobid) {
     tmp1->next = p->next;
     p->next = firstjob->next;
     firstjob->next = p;
+    changed();
     send_urgent_ok(s);
 }
 
@@ -1659,6 +2156,7 @@ void s_swap_jobs(int s, int jobid1, int jobid2) {
     tmp = p1->next;
     p1->next = p2->next;
     p2->next = tmp;
+    changed();
 
     send_swap_jobs_ok(s);
 }
@@ -1743,8 +2241,15 @@ void dump_jobs_struct(FILE *out) {
 }
 
 static void dump_notify_struct(FILE *out, const struct Notify *n) {
+    int i;
+
     fprintf(out, "  notify\n");
-    fprintf(out, "    jobid %i\n", n->jobid);
+    fprintf(out, "    jobs");
+    for (i = 0; i < n->num_jobs; ++i)
+        if (n->jobs[i] != -1)
+            fprintf(out, " %i", n->jobs[i]);
+    fprintf(out, "\n");
+    fprintf(out, "    pending %i\n", n->pending);
     fprintf(out, "    socket \"%i\"\n", n->socket);
 }
 
@@ -1861,3 +2366,428 @@ void s_set_logdir(const char* path) {
     logdir = realloc(logdir, strlen(path) + 1);
     strcpy(logdir, path);
 }
+
+static int output_matches(const struct Job *p, int state, const char *label,
+                          const int *jobs, int num_jobs) {
+    int i;
+
+    if (p->output_filename == NULL)
+        return 0;
+    if (state != -1 && p->state != (enum Jobstate) state)
+        return 0;
+    if (label != NULL && (p->label == NULL || strcmp(p->label, label) != 0))
+        return 0;
+    if (num_jobs == 0)
+        return 1;
+    for (i = 0; i < num_jobs; ++i)
+        if (jobs[i] == p->jobid)
+            return 1;
+    return 0;
+}
+
+/* Whether some queued job takes the output of jobid as input */
+int s_has_consumers(int jobid) {
+    struct Job *p;
+
+    for (p = firstjob; p != 0; p = p->next)
+        if (p->stdin_from == jobid && p->jobid != jobid)
+            return 1;
+    return 0;
+}
+
+/* How a job can get the output of jobid as input */
+enum StreamMode s_stream_mode(int jobid) {
+    struct Job *p;
+
+    p = get_job(jobid);
+    if (p == 0)
+        return STREAM_NONE;
+    if (p->state == RUNNING && p->streams)
+        return STREAM_LIVE;
+    if (p->state != SKIPPED && p->store_output)
+        return STREAM_FILE;
+    return STREAM_NONE;
+}
+
+/* The job runner does not take more consumers */
+void s_stream_end(int jobid) {
+    struct Job *p;
+
+    p = findjob(jobid);
+    if (p != 0)
+        p->streams = 0;
+}
+
+/* The job runner sends the last output of the job */
+void s_peek_data(int s, int jobid, int size, int ring_size) {
+    struct Job *p;
+    char *buf;
+
+    if (size <= 0 || size > PEEK_MAX) {
+        warning("Wrong peek data size %i from job %i", size, jobid);
+        return;
+    }
+    buf = (char *) malloc(size);
+    if (recv_bytes(s, buf, size) != size) {
+        free(buf);
+        return;
+    }
+    p = findjob(jobid);
+    if (p != 0 && p->state == RUNNING) {
+        if (p->peek == 0) {
+            p->peek = (struct Peek *) malloc(sizeof(struct Peek));
+            peek_init(p->peek);
+        }
+        peek_add(p->peek, ring_size, buf, size);
+    }
+    free(buf);
+}
+
+/* As send_list_line(), for data that may not be a string.
+ * It goes without the ending NUL. */
+static void send_list_bytes(int s, const char *data, int len) {
+    struct Msg m = default_msg();
+
+    if (len <= 0)
+        return;
+    m.type = LIST_LINE;
+    m.u.size = len;
+    send_msg(s, &m);
+    send_bytes(s, data, len);
+}
+
+static void send_peek(int s, const struct Peek *peek) {
+    int chunk;
+
+    if (peek == 0 || peek->len == 0)
+        return;
+    chunk = peek->size - peek->start < peek->len ? peek->size - peek->start
+                                                 : peek->len;
+    send_list_bytes(s, peek->buf + peek->start, chunk);
+    send_list_bytes(s, peek->buf, peek->len - chunk);
+}
+
+/* Why there is nothing to peek, instead of an empty answer */
+static void send_peek_nok(int s, const char *str) {
+    struct Msg m = default_msg();
+
+    m.type = PEEK_NOK;
+    m.u.size = strlen(str) + 1;
+    send_msg(s, &m);
+    send_bytes(s, str, m.u.size);
+}
+
+/* The last output of the running job, or of all of them for -1 */
+void s_peek(int s, int jobid) {
+    struct Job *p;
+    char tmp[100];
+    int first = 1;
+    int running = 0;
+    int peeking = 0;
+
+    if (jobid != -1) {
+        p = findjob(jobid);
+        if (p == 0 && find_finished_job(jobid) != 0)
+            sprintf(tmp, "The job %i is not running.\n", jobid);
+        else if (p == 0)
+            sprintf(tmp, "The job %i does not exist.\n", jobid);
+        else if (p->state != RUNNING)
+            sprintf(tmp, "The job %i is not running.\n", jobid);
+        else if (p->peek == 0)
+            sprintf(tmp, "The job %i keeps no output (TS_PEEKSIZE=0).\n",
+                    jobid);
+        else {
+            send_peek(s, p->peek);
+            return;
+        }
+        send_peek_nok(s, tmp);
+        return;
+    }
+
+    for (p = firstjob; p != 0; p = p->next) {
+        if (p->state != RUNNING)
+            continue;
+        ++running;
+        if (p->peek == 0)
+            continue;
+        ++peeking;
+        if (p->peek->len == 0)
+            continue;
+        sprintf(tmp, "%s==> job %i <==\n", first ? "" : "\n", p->jobid);
+        send_list_bytes(s, tmp, strlen(tmp));
+        send_peek(s, p->peek);
+        first = 0;
+    }
+    if (running == 0)
+        send_peek_nok(s, "No job is running.\n");
+    else if (peeking == 0)
+        send_peek_nok(s, "No running job keeps its output (TS_PEEKSIZE=0).\n");
+}
+
+static void add_job_bytes(const struct Job *p, long *arrays, long *names,
+                          long *peeks) {
+    *arrays += (long) (p->depend_on_size + p->notify_errorlevel_to_size
+                       + p->num_gpus) * sizeof(int);
+    if (p->output_filename != 0)
+        *names += strlen(p->output_filename) + 1;
+    if (p->peek != 0)
+        *peeks += sizeof(struct Peek) + p->peek->size;
+}
+
+/* Where the memory of the server goes, for ts --mem-stats */
+void s_mem_stats(int s) {
+    const struct Job *p;
+    char line[200];
+    int queued = 0;
+    int finished = 0;
+    long arrays = 0;
+    long names = 0;
+    long peeks = 0;
+    int blobs;
+    long blob_bytes;
+    long blob_uses;
+
+    for (p = firstjob; p != 0; p = p->next) {
+        ++queued;
+        add_job_bytes(p, &arrays, &names, &peeks);
+    }
+    for (p = first_finished_job; p != 0; p = p->next) {
+        ++finished;
+        add_job_bytes(p, &arrays, &names, &peeks);
+    }
+
+    snprintf(line, sizeof(line), "Jobs: %i queued or running, %i finished\n",
+             queued, finished);
+    send_list_line(s, line);
+    snprintf(line, sizeof(line),
+             "Job records: %i of %i used, %li bytes (%i each)\n",
+             job_slab.used, slab_capacity(&job_slab), slab_bytes(&job_slab),
+             job_slab.record_size);
+    send_list_line(s, line);
+    blob_stats(&blobs, &blob_bytes, &blob_uses);
+    snprintf(line, sizeof(line),
+             "Strings: %i kept, %li bytes, for %li uses\n",
+             blobs, blob_bytes, blob_uses);
+    send_list_line(s, line);
+    snprintf(line, sizeof(line),
+             "Dependencies and GPUs: %li bytes\n", arrays);
+    send_list_line(s, line);
+    snprintf(line, sizeof(line), "Output file names: %li bytes\n", names);
+    send_list_line(s, line);
+    snprintf(line, sizeof(line), "Last outputs (--peek): %li bytes\n", peeks);
+    send_list_line(s, line);
+}
+
+/* Sends a line "jobid filename" for each job with a stored output and
+ * matching the filter */
+void s_list_outputs(int s, int state, const char *label, const int *jobs,
+                    int num_jobs) {
+    const struct Job *lists[2];
+    const struct Job *p;
+    char *line;
+    int i;
+
+    lists[0] = firstjob;
+    lists[1] = first_finished_job;
+    for (i = 0; i < 2; ++i)
+        for (p = lists[i]; p != 0; p = p->next) {
+            if (!output_matches(p, state, label, jobs, num_jobs))
+                continue;
+            line = (char *) malloc(strlen(p->output_filename) + 20);
+            sprintf(line, "%i %s\n", p->jobid, p->output_filename);
+            send_list_line(s, line);
+            free(line);
+        }
+}
+
+static int watcher_matches(const struct Watcher *w, const struct Job *p) {
+    int i;
+
+    if (w->label != NULL && (p->label == NULL || strcmp(p->label, w->label) != 0))
+        return 0;
+    if (w->num_jobs == 0)
+        return 1;
+    for (i = 0; i < w->num_jobs; ++i)
+        if (w->jobs[i] == p->jobid)
+            return 1;
+    return 0;
+}
+
+/* The event as a JSON line, with the fields of ts -M json */
+static char *event_line(const struct Job *p, const char *event) {
+    struct timeval now;
+    cJSON *o;
+    char *json;
+    char *line;
+
+    o = cJSON_CreateObject();
+    if (o == NULL)
+        return NULL;
+    gettimeofday(&now, NULL);
+    cJSON_AddStringToObject(o, "Event", event);
+    cJSON_AddNumberToObject(o, "Time", now.tv_sec + now.tv_usec / 1e6);
+    cJSON_AddNumberToObject(o, "ID", p->jobid);
+    cJSON_AddStringToObject(o, "State", jstate2string(p->state));
+    if (p->label)
+        cJSON_AddStringToObject(o, "Label", p->label);
+    if (p->output_filename)
+        cJSON_AddStringToObject(o, "Output", p->output_filename);
+    if (p->state == FINISHED || p->state == SKIPPED) {
+        cJSON_AddNumberToObject(o, "E-Level", p->result.errorlevel);
+        if (p->result.died_by_signal)
+            cJSON_AddNumberToObject(o, "Signal", p->result.signal);
+        cJSON_AddNumberToObject(o, "Time_ms", p->result.real_ms);
+        cJSON_AddNumberToObject(o, "User_ms", p->result.user_ms);
+        cJSON_AddNumberToObject(o, "System_ms", p->result.system_ms);
+    }
+    cJSON_AddStringToObject(o, "Command", p->command);
+
+    json = cJSON_PrintUnformatted(o);
+    cJSON_Delete(o);
+    if (json == NULL)
+        return NULL;
+    line = (char *) malloc(strlen(json) + 2);
+    sprintf(line, "%s\n", json);
+    free(json);
+    return line;
+}
+
+/* Sends what the socket takes without blocking */
+static void watcher_flush(struct Watcher *w) {
+    int res;
+
+    while (w->used > 0 && !w->dropped) {
+        res = send(w->socket, w->buf, w->used, MSG_NOSIGNAL);
+        if (res == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                w->dropped = 1;
+            return;
+        }
+        memmove(w->buf, w->buf + res, w->used - res);
+        w->used -= res;
+    }
+}
+
+/* The line as a LIST_LINE message, after the events still pending. The
+ * server never waits on a watcher: if it falls WATCH_BUFFER behind, it
+ * gets dropped. */
+static void watcher_send(struct Watcher *w, const char *line) {
+    struct Msg m = default_msg();
+    int size;
+
+    if (w->dropped)
+        return;
+    m.type = LIST_LINE;
+    m.u.size = strlen(line) + 1;
+    size = sizeof(m) + m.u.size;
+    if (w->used + size > WATCH_BUFFER) {
+        warning("Dropping the watcher %i, too far behind", w->socket);
+        w->dropped = 1;
+        return;
+    }
+    memcpy(w->buf + w->used, &m, sizeof(m));
+    memcpy(w->buf + w->used + sizeof(m), line, m.u.size);
+    w->used += size;
+    watcher_flush(w);
+}
+
+/* Sends the event to the watchers of the job */
+static void watch_event(const struct Job *p, const char *event) {
+    struct Watcher *w;
+    char *line = NULL;
+
+    if (p == 0)
+        return;
+    for (w = first_watcher; w != 0; w = w->next) {
+        if (!watcher_matches(w, p))
+            continue;
+        if (line == NULL)
+            line = event_line(p, event);
+        if (line != NULL)
+            watcher_send(w, line);
+    }
+    free(line);
+}
+
+/* A new watcher. The jobs of its list already ended are told at once. */
+void s_watch(int s, char *label, int *jobs, int num_jobs) {
+    struct Watcher *w;
+    int i;
+
+    w = (struct Watcher *) malloc(sizeof(*w));
+    if (w == 0)
+        error("Cannot allocate a watcher");
+    w->buf = (char *) malloc(WATCH_BUFFER);
+    if (w->buf == 0)
+        error("Cannot allocate a watcher");
+    w->socket = s;
+    w->label = label;
+    w->jobs = jobs;
+    w->num_jobs = num_jobs;
+    w->used = 0;
+    w->dropped = 0;
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+    w->next = first_watcher;
+    first_watcher = w;
+
+    for (i = 0; i < num_jobs; ++i) {
+        struct Job *p = find_finished_job(jobs[i]);
+        char *line;
+
+        if (p == 0 || !watcher_matches(w, p))
+            continue;
+        line = event_line(p, p->state == SKIPPED ? "skipped" : "finished");
+        if (line != NULL)
+            watcher_send(w, line);
+        free(line);
+    }
+}
+
+/* Adds to the set the watchers with events pending. Returns the max fd. */
+int s_watchers_pending(fd_set *writeset, int maxfd) {
+    struct Watcher *w;
+
+    for (w = first_watcher; w != 0; w = w->next)
+        if (w->used > 0 && !w->dropped) {
+            FD_SET(w->socket, writeset);
+            if (w->socket > maxfd)
+                maxfd = w->socket;
+        }
+    return maxfd;
+}
+
+void s_watchers_flush(fd_set *writeset) {
+    struct Watcher *w;
+
+    for (w = first_watcher; w != 0; w = w->next)
+        if (FD_ISSET(w->socket, writeset))
+            watcher_flush(w);
+}
+
+/* Whether the server has to close the socket, as a watcher too slow */
+int s_watcher_dropped(int s) {
+    struct Watcher *w;
+
+    for (w = first_watcher; w != 0; w = w->next)
+        if (w->socket == s)
+            return w->dropped;
+    return 0;
+}
+
+/* Don't complain, if the socket is not watching */
+void s_remove_watcher(int s) {
+    struct Watcher **pw;
+
+    for (pw = &first_watcher; *pw != 0; pw = &(*pw)->next)
+        if ((*pw)->socket == s) {
+            struct Watcher *w = *pw;
+            *pw = w->next;
+            free(w->label);
+            free(w->jobs);
+            free(w->buf);
+            free(w);
+            return;
+        }
+}
@@ -0,0 +1,890 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2009  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "main.h"
+#include "libts.h"
+
+extern char **environ;
+
+/* The client library. It speaks the protocol of main.h by itself, as it
+ * cannot use the parts of ts that end the program on errors; ts uses its
+ * helpers (the libts_ functions of main.h) for the same messages.
+ *
+ * The jobs need a process each, that runs them and stays with them until
+ * they end. ts_submit() queues the job on a connection of its own, and
+ * passes that connection to the "ts --libts-runner" of the ts_conn, which
+ * forks the process (see c_libts_runner()). That ts is started once, on
+ * the first job. */
+
+struct ts_conn {
+    int socket;
+    char *path;
+    int runner; /* Socket to the ts --libts-runner, or -1 */
+};
+
+struct ts_list {
+    char *json;
+    char *next;
+    char *fields[6]; /* Of the job, in json */
+    struct ts_job job;
+};
+
+int libts_write_all(int fd, const void *data, size_t len) {
+    const char *p = (const char *) data;
+
+    while (len > 0) {
+        ssize_t res = write(fd, p, len);
+        if (res == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += res;
+        len -= res;
+    }
+    return 0;
+}
+
+int libts_read_all(int fd, void *data, size_t len) {
+    char *p = (char *) data;
+
+    while (len > 0) {
+        ssize_t res = read(fd, p, len);
+        if (res == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (res == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        p += res;
+        len -= res;
+    }
+    return 0;
+}
+
+static void new_msg(struct Msg *m, enum MsgTypes type) {
+    memset(m, 0, sizeof(*m));
+    m->type = type;
+}
+
+static int send_request(int s, const struct Msg *m) {
+    return libts_write_all(s, m, sizeof(*m));
+}
+
+static int recv_answer(int s, struct Msg *m) {
+    return libts_read_all(s, m, sizeof(*m));
+}
+
+/* Receives the string of a LIST_LINE. An answer of one line is the
+ * server telling that the job is not there. */
+static char *recv_line(int s, const struct Msg *m) {
+    char *line;
+
+    line = (char *) malloc(m->u.size + 1);
+    if (line == NULL)
+        return NULL;
+    if (libts_read_all(s, line, m->u.size) == -1) {
+        free(line);
+        return NULL;
+    }
+    line[m->u.size] = '\0';
+    return line;
+}
+
+static int wrong_job(int s, const struct Msg *m) {
+    free(recv_line(s, m));
+    errno = ENOENT;
+    return -1;
+}
+
+char *ts_socket_path(int *check_owner) {
+    const char *tmpdir;
+    char *path;
+    int size;
+
+    /* As a priority, TS_SOCKET mandates over the path creation. We don't
+     * check its owner, as it may be a shared queue. */
+    if (getenv("TS_SOCKET") != NULL) {
+        if (check_owner)
+            *check_owner = 0;
+        return strdup(getenv("TS_SOCKET"));
+    }
+
+    tmpdir = getenv("TMPDIR");
+    if (tmpdir == NULL)
+        tmpdir = "/tmp";
+    size = strlen(tmpdir) + strlen("/socket-ts.") + 20 + 1;
+    path = (char *) malloc(size);
+    if (path != NULL)
+        snprintf(path, size, "%s/socket-ts.%u", tmpdir,
+                 (unsigned int) getuid());
+    if (check_owner)
+        *check_owner = 1;
+    return path;
+}
+
+static int connect_to(const char *path) {
+    struct sockaddr_un addr;
+    int s;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == -1)
+        return -1;
+    /* Not for the ts we start, nor the jobs */
+    fcntl(s, F_SETFD, FD_CLOEXEC);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(s, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        int err = errno;
+        close(s);
+        errno = err;
+        return -1;
+    }
+    return s;
+}
+
+/* The message goes twice, so an old server answers at least once. On a
+ * wrong version, errno is EPROTO and *version the one of the server. */
+int libts_check_version(int s, int *version) {
+    struct Msg m;
+
+    new_msg(&m, GET_VERSION);
+    if (send_request(s, &m) == -1 || send_request(s, &m) == -1)
+        return -1;
+    if (recv_answer(s, &m) == -1)
+        return -1;
+    if (version != NULL)
+        *version = m.u.version;
+    if (m.type != VERSION || m.u.version != PROTOCOL_VERSION) {
+        errno = EPROTO;
+        return -1;
+    }
+    return recv_answer(s, &m);
+}
+
+static int write_ints(int s, const int *data, int num) {
+    if (libts_write_all(s, &num, sizeof(num)) == -1)
+        return -1;
+    return libts_write_all(s, data, num * sizeof(int));
+}
+
+/* NEWJOB, with what goes after it. m has the sizes of the strings. */
+int libts_send_newjob(int s, const struct Msg *m, const int *gpus,
+                      const int *depend_on, const char *command,
+                      const char *label, const char *env, const char *pool) {
+    if (send_request(s, m) == -1)
+        return -1;
+    if (!m->u.newjob.wait_free_gpus
+        && write_ints(s, gpus, m->u.newjob.gpus) == -1)
+        return -1;
+    if (m->u.newjob.depend_on_size
+        && write_ints(s, depend_on, m->u.newjob.depend_on_size) == -1)
+        return -1;
+    if (libts_write_all(s, command, m->u.newjob.command_size) == -1
+        || libts_write_all(s, label, m->u.newjob.label_size) == -1
+        || libts_write_all(s, env, m->u.newjob.env_size) == -1
+        || libts_write_all(s, pool, m->u.newjob.pool_size) == -1)
+        return -1;
+    return 0;
+}
+
+/* Our environment, with socket_env ("TS_SOCKET=...") instead of ours */
+static char **ts_environment(char *socket_env) {
+    char **env;
+    int n;
+    int i;
+    int j = 0;
+
+    for (n = 0; environ[n] != NULL; ++n)
+        ;
+    env = (char **) malloc((n + 2) * sizeof(char *));
+    if (env == NULL)
+        return NULL;
+    for (i = 0; i < n; ++i)
+        if (strncmp(environ[i], "TS_SOCKET=", 10) != 0)
+            env[j++] = environ[i];
+    env[j++] = socket_env;
+    env[j] = NULL;
+    return env;
+}
+
+/* Runs ts with args, with fd as its stdin if not -1. Returns its pid.
+ * The program using the library may have threads, so nothing is left
+ * to do in between fork() and exec(): all is prepared for posix_spawn(). */
+static int run_ts(const char *path, char *const *args, int fd) {
+    posix_spawn_file_actions_t actions;
+    char *socket_env;
+    char **env;
+    int pid;
+    int res;
+
+    socket_env = (char *) malloc(strlen("TS_SOCKET=") + strlen(path) + 1);
+    if (socket_env == NULL)
+        return -1;
+    sprintf(socket_env, "TS_SOCKET=%s", path);
+    env = ts_environment(socket_env);
+    if (env == NULL) {
+        free(socket_env);
+        return -1;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    if (fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, fd, 0);
+        posix_spawn_file_actions_addclose(&actions, fd);
+    } else
+        posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDWR, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_RDWR, 0);
+
+    res = posix_spawnp(&pid, "ts", &actions, NULL, args, env);
+    posix_spawn_file_actions_destroy(&actions);
+    free(env);
+    free(socket_env);
+    if (res != 0) {
+        errno = res;
+        return -1;
+    }
+    return pid;
+}
+
+static int wait_ts(int pid) {
+    int status;
+
+    while (waitpid(pid, &status, 0) == -1)
+        if (errno != EINTR)
+            return -1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        errno = ECHILD;
+        return -1;
+    }
+    return 0;
+}
+
+static int start_server(const char *path) {
+    char *args[] = {"ts", "-S", NULL};
+    int pid;
+
+    pid = run_ts(path, args, -1);
+    if (pid == -1)
+        return -1;
+    return wait_ts(pid);
+}
+
+/* The ts --libts-runner goes to the background, so it is not our child
+ * once it is up */
+static int start_runner(ts_conn *c) {
+    char *args[] = {"ts", "--libts-runner", NULL};
+    int sv[2];
+    int pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+        return -1;
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+    pid = run_ts(c->path, args, sv[1]);
+    close(sv[1]);
+    if (pid == -1 || wait_ts(pid) == -1) {
+        int err = errno;
+        close(sv[0]);
+        errno = err;
+        return -1;
+    }
+    c->runner = sv[0];
+    return 0;
+}
+
+ts_conn *ts_connect(const char *socket_path, int start) {
+    struct Msg m;
+    ts_conn *c;
+
+    c = (ts_conn *) malloc(sizeof(*c));
+    if (c == NULL)
+        return NULL;
+    c->runner = -1;
+    c->path = socket_path ? strdup(socket_path) : ts_socket_path(NULL);
+    if (c->path == NULL) {
+        free(c);
+        return NULL;
+    }
+
+    c->socket = connect_to(c->path);
+    if (c->socket == -1 && start && (errno == ENOENT || errno == ECONNREFUSED)
+        && start_server(c->path) == 0)
+        c->socket = connect_to(c->path);
+
+    /* As a session, the answers of many lines end with LIST_END */
+    new_msg(&m, SESSION);
+    if (c->socket == -1 || libts_check_version(c->socket, NULL) == -1
+        || send_request(c->socket, &m) == -1) {
+        int err = errno;
+        ts_close(c);
+        errno = err;
+        return NULL;
+    }
+    return c;
+}
+
+void ts_close(ts_conn *c) {
+    if (c == NULL)
+        return;
+    if (c->socket != -1)
+        close(c->socket);
+    /* The runner ends when it sees this; the jobs it started go on */
+    if (c->runner != -1)
+        close(c->runner);
+    free(c->path);
+    free(c);
+}
+
+/* The command line of the job, as ts builds it, and its arguments one
+ * after the other, each ended by '\0' */
+static int job_strings(const struct ts_submit *job, char **command,
+                       char **args, int *args_size) {
+    int size = 0;
+    int i;
+
+    for (i = 0; job->argv[i] != NULL; ++i)
+        size += strlen(job->argv[i]) + 1;
+    if (i == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    *command = (char *) malloc(size);
+    *args = (char *) malloc(size);
+    if (*command == NULL || *args == NULL) {
+        free(*command);
+        free(*args);
+        return -1;
+    }
+
+    (*command)[0] = '\0';
+    *args_size = 0;
+    for (i = 0; job->argv[i] != NULL; ++i) {
+        int len = strlen(job->argv[i]) + 1;
+
+        if (i > 0)
+            strcat(*command, " ");
+        strcat(*command, job->argv[i]);
+        memcpy(*args + *args_size, job->argv[i], len);
+        *args_size += len;
+    }
+    return i;
+}
+
+/* As ts -D: the ids "3" or "3,5" */
+static int *parse_depend_on(const char *str, int *num) {
+    int *ids;
+    char *end;
+
+    *num = 0;
+    ids = (int *) malloc((strlen(str) / 2 + 1) * sizeof(int));
+    if (ids == NULL)
+        return NULL;
+    while (*str != '\0') {
+        ids[(*num)++] = (int) strtol(str, &end, 10);
+        if (end == str || (*end != ',' && *end != '\0')) {
+            free(ids);
+            errno = EINVAL;
+            return NULL;
+        }
+        str = *end == ',' ? end + 1 : end;
+    }
+    return ids;
+}
+
+static int queue_job(int s, const struct ts_submit *job, const char *command,
+                     int *depend_on, int depend_on_size) {
+    struct Msg m;
+
+    new_msg(&m, NEWJOB);
+    m.u.newjob.command_size = strlen(command) + 1;
+    m.u.newjob.label_size = job->label ? strlen(job->label) + 1 : 0;
+    m.u.newjob.store_output = 1;
+    m.u.newjob.should_keep_finished = 1;
+    m.u.newjob.depend_on_size = depend_on_size;
+    m.u.newjob.wait_enqueuing = 1;
+    m.u.newjob.num_slots = job->slots > 0 ? job->slots : 1;
+    m.u.newjob.wait_free_gpus = 1;
+    m.u.newjob.stdin_from = -1;
+    if (libts_send_newjob(s, &m, NULL, depend_on, command, job->label,
+                          NULL, NULL) == -1)
+        return -1;
+
+    if (recv_answer(s, &m) == -1)
+        return -1;
+    if (m.type == NEWJOB_NOK) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (m.type != NEWJOB_OK) {
+        errno = EPROTO;
+        return -1;
+    }
+    return m.u.jobid;
+}
+
+/* The connection of the job goes to the runner, with the header of the
+ * job as the data of the same message */
+static int pass_job(int runner, int s, const struct RunnerJob *rj,
+                    const char *args, const char *label) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = (void *) rj;
+    iov.iov_len = sizeof(*rj);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &s, sizeof(int));
+
+    while (sendmsg(runner, &msg, 0) == -1)
+        if (errno != EINTR)
+            return -1;
+    if (libts_write_all(runner, args, rj->args_size) == -1
+        || libts_write_all(runner, label, rj->label_size) == -1)
+        return -1;
+    return 0;
+}
+
+/* For the runner: the connection of the next job, or -1 at the end. The
+ * strings are to be freed. */
+int libts_recv_runner_job(int runner, struct RunnerJob *rj, char **args,
+                          char **label) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    ssize_t res;
+    int s = -1;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = rj;
+    iov.iov_len = sizeof(*rj);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    while ((res = recvmsg(runner, &msg, 0)) == -1 && errno == EINTR)
+        ;
+    if (res <= 0)
+        return -1;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET
+        && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&s, CMSG_DATA(cmsg), sizeof(int));
+    if ((size_t) res < sizeof(*rj)
+        && libts_read_all(runner, (char *) rj + res, sizeof(*rj) - res) == -1)
+        s = -1;
+
+    *args = (char *) malloc(rj->args_size);
+    *label = rj->label_size > 0 ? (char *) malloc(rj->label_size) : NULL;
+    if (s == -1 || *args == NULL || (rj->label_size > 0 && *label == NULL)
+        || libts_read_all(runner, *args, rj->args_size) == -1
+        || libts_read_all(runner, *label, rj->label_size) == -1) {
+        if (s != -1)
+            close(s);
+        free(*args);
+        free(*label);
+        return -1;
+    }
+    return s;
+}
+
+int ts_submit(ts_conn *c, const struct ts_submit *job) {
+    struct RunnerJob rj;
+    char *command = NULL;
+    char *args = NULL;
+    int *depend_on = NULL;
+    int depend_on_size = 0;
+    int jobid = -1;
+    int err;
+    int s = -1;
+
+    if (c->runner == -1 && start_runner(c) == -1)
+        return -1;
+
+    rj.argc = job_strings(job, &command, &args, &rj.args_size);
+    if (rj.argc == -1)
+        return -1;
+    if (job->depend_on != NULL) {
+        depend_on = parse_depend_on(job->depend_on, &depend_on_size);
+        if (depend_on == NULL)
+            goto end;
+    }
+
+    s = connect_to(c->path);
+    if (s == -1 || libts_check_version(s, NULL) == -1)
+        goto end;
+    jobid = queue_job(s, job, command, depend_on, depend_on_size);
+    if (jobid == -1)
+        goto end;
+
+    rj.jobid = jobid;
+    rj.label_size = job->label ? strlen(job->label) + 1 : 0;
+    if (pass_job(c->runner, s, &rj, args, job->label) == -1)
+        jobid = -1; /* Closing s, the server takes it as killed */
+
+end:
+    err = errno;
+    if (s != -1)
+        close(s);
+    free(command);
+    free(args);
+    free(depend_on);
+    errno = err;
+    return jobid;
+}
+
+int ts_submit_batch(ts_conn *c, const struct ts_submit *jobs, int n,
+                    int *jobids) {
+    int queued = 0;
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        jobids[i] = ts_submit(c, &jobs[i]);
+        if (jobids[i] != -1)
+            ++queued;
+    }
+    return queued;
+}
+
+int ts_state(ts_conn *c, int jobid, enum ts_state *state) {
+    struct Msg m;
+
+    new_msg(&m, GET_STATE);
+    m.u.jobid = jobid;
+    if (send_request(c->socket, &m) == -1 || recv_answer(c->socket, &m) == -1)
+        return -1;
+    if (m.type == LIST_LINE)
+        return wrong_job(c->socket, &m);
+    if (m.type != ANSWER_STATE) {
+        errno = EPROTO;
+        return -1;
+    }
+    *state = (enum ts_state) m.u.state;
+    return 0;
+}
+
+static int recv_waitjob(int s, int *errorlevel) {
+    struct Msg m;
+
+    if (recv_answer(s, &m) == -1)
+        return -1;
+    if (m.type == LIST_LINE)
+        return wrong_job(s, &m);
+    if (m.type != WAITJOB_OK) {
+        errno = EPROTO;
+        return -1;
+    }
+    *errorlevel = m.u.result.errorlevel;
+    return 0;
+}
+
+int ts_wait(ts_conn *c, int jobid, int *errorlevel) {
+    struct Msg m;
+
+    new_msg(&m, WAITJOB);
+    m.u.jobid = jobid;
+    if (send_request(c->socket, &m) == -1)
+        return -1;
+    return recv_waitjob(c->socket, errorlevel);
+}
+
+/* Another connection, only for the end of that job */
+int ts_subscribe(ts_conn *c, int jobid) {
+    struct Msg m;
+    int s;
+
+    s = connect_to(c->path);
+    if (s == -1)
+        return -1;
+    new_msg(&m, WAITJOB);
+    m.u.jobid = jobid;
+    if (libts_check_version(s, NULL) == -1 || send_request(s, &m) == -1) {
+        int err = errno;
+        close(s);
+        errno = err;
+        return -1;
+    }
+    return s;
+}
+
+int ts_subscription_result(int fd, int *errorlevel) {
+    int res;
+
+    res = recv_waitjob(fd, errorlevel);
+    close(fd);
+    return res;
+}
+
+static enum ts_state string2state(const char *s) {
+    if (strcmp(s, "queued") == 0)
+        return TS_STATE_QUEUED;
+    if (strcmp(s, "allocating") == 0)
+        return TS_STATE_ALLOCATING;
+    if (strcmp(s, "running") == 0)
+        return TS_STATE_RUNNING;
+    if (strcmp(s, "finished") == 0)
+        return TS_STATE_FINISHED;
+    return TS_STATE_SKIPPED;
+}
+
+/* The list comes as the JSON of ts -M json: an array of flat objects, of
+ * strings, numbers and nulls. It is read in place, without a JSON
+ * library: the strings get unescaped where they are. */
+
+static char *skip_space(char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+        ++p;
+    return p;
+}
+
+static void put_utf8(char **out, unsigned int c) {
+    char *o = *out;
+
+    if (c < 0x80)
+        *o++ = (char) c;
+    else if (c < 0x800) {
+        *o++ = (char) (0xc0 | (c >> 6));
+        *o++ = (char) (0x80 | (c & 0x3f));
+    } else {
+        *o++ = (char) (0xe0 | (c >> 12));
+        *o++ = (char) (0x80 | ((c >> 6) & 0x3f));
+        *o++ = (char) (0x80 | (c & 0x3f));
+    }
+    *out = o;
+}
+
+/* p is after the opening quote. Returns the end of the string in the
+ * JSON, or NULL if it is wrong. The unescaped one is left at p. */
+static char *read_string(char *p) {
+    char *out = p;
+
+    while (*p != '"') {
+        if (*p == '\0')
+            return NULL;
+        if (*p != '\\') {
+            *out++ = *p++;
+            continue;
+        }
+        ++p;
+        switch (*p++) {
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u': {
+                unsigned int c = 0;
+                int i;
+
+                for (i = 0; i < 4; ++i, ++p) {
+                    c <<= 4;
+                    if (*p >= '0' && *p <= '9')
+                        c |= *p - '0';
+                    else if (*p >= 'a' && *p <= 'f')
+                        c |= *p - 'a' + 10;
+                    else if (*p >= 'A' && *p <= 'F')
+                        c |= *p - 'A' + 10;
+                    else
+                        return NULL;
+                }
+                put_utf8(&out, c);
+                break;
+            }
+            case '\0':
+                return NULL;
+            default: /* " \ / */
+                *out++ = p[-1];
+        }
+    }
+    *out = '\0';
+    return p + 1;
+}
+
+static const char *list_keys[6] = {"ID", "State", "Output", "E-Level",
+                                   "Time_ms", "Command"};
+
+/* Reads the object at p into l->fields (the values as strings, NULL for
+ * null). Returns the JSON after it, or NULL if it is wrong. */
+static char *read_object(ts_list *l, char *p) {
+    int i;
+
+    for (i = 0; i < 6; ++i)
+        l->fields[i] = NULL;
+    p = skip_space(p);
+    if (*p++ != '{')
+        return NULL;
+    p = skip_space(p);
+    if (*p == '}')
+        return p + 1;
+
+    while (1) {
+        char *key;
+        char *value;
+
+        if (*p++ != '"')
+            return NULL;
+        key = p;
+        p = read_string(p);
+        if (p == NULL)
+            return NULL;
+        p = skip_space(p);
+        if (*p++ != ':')
+            return NULL;
+        p = skip_space(p);
+
+        if (*p == '"') {
+            value = p + 1;
+            p = read_string(value);
+            if (p == NULL)
+                return NULL;
+        } else {
+            value = p;
+            p += strcspn(p, ",} \t\r\n");
+            if (p == value)
+                return NULL;
+            if (strncmp(value, "null", 4) == 0)
+                value = NULL;
+        }
+        /* The character after a value is not needed any more */
+        p = skip_space(p);
+        if (*p != ',' && *p != '}')
+            return NULL;
+        {
+            char end = *p;
+
+            *p = '\0';
+            for (i = 0; i < 6; ++i)
+                if (strcmp(key, list_keys[i]) == 0)
+                    l->fields[i] = value;
+            if (end == '}')
+                return p + 1;
+        }
+        p = skip_space(p + 1);
+    }
+}
+
+ts_list *ts_list_open(ts_conn *c) {
+    struct Msg m;
+    ts_list *l;
+    char *json = NULL;
+    int len = 0;
+
+    new_msg(&m, LIST);
+    m.u.list_format = JSON;
+    if (send_request(c->socket, &m) == -1)
+        return NULL;
+    while (1) {
+        char *line;
+        int size;
+
+        if (recv_answer(c->socket, &m) == -1) {
+            free(json);
+            return NULL;
+        }
+        if (m.type == LIST_END)
+            break;
+        if (m.type != LIST_LINE) {
+            free(json);
+            errno = EPROTO;
+            return NULL;
+        }
+        line = recv_line(c->socket, &m);
+        if (line == NULL) {
+            free(json);
+            return NULL;
+        }
+        size = strlen(line);
+        json = (char *) realloc(json, len + size + 1);
+        memcpy(json + len, line, size + 1);
+        len += size;
+        free(line);
+    }
+
+    l = (ts_list *) malloc(sizeof(*l));
+    if (l == NULL) {
+        free(json);
+        return NULL;
+    }
+    l->json = json;
+    l->next = json ? skip_space(json) : NULL;
+    if (l->next == NULL || *l->next++ != '[') {
+        ts_list_close(l);
+        errno = EPROTO;
+        return NULL;
+    }
+    l->next = skip_space(l->next);
+    if (*l->next == ']')
+        l->next = NULL;
+    return l;
+}
+
+const struct ts_job *ts_list_next(ts_list *l) {
+    char *p;
+
+    if (l->next == NULL)
+        return NULL;
+    p = read_object(l, l->next);
+    if (p == NULL) {
+        l->next = NULL;
+        errno = EPROTO;
+        return NULL;
+    }
+    p = skip_space(p);
+    l->next = *p == ',' ? skip_space(p + 1) : NULL; /* At ']', the end */
+
+    l->job.jobid = l->fields[0] ? atoi(l->fields[0]) : -1;
+    l->job.state = l->fields[1] ? string2state(l->fields[1])
+                                : TS_STATE_QUEUED;
+    l->job.output = l->fields[2] ? l->fields[2] : "";
+    l->job.errorlevel = l->fields[3] ? atoi(l->fields[3]) : -1;
+    l->job.real_time = l->fields[4] ? strtod(l->fields[4], NULL) : 0;
+    l->job.command = l->fields[5] ? l->fields[5] : "";
+    return &l->job;
+}
+
+void ts_list_close(ts_list *l) {
+    if (l == NULL)
+        return;
+    free(l->json);
+    free(l);
+}
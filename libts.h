@@ -0,0 +1,101 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2009  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#ifndef LIBTS_H
+#define LIBTS_H
+
+/* libts: the client side of ts as a library, for the programs that talk
+ * to the server many times, without running a ts for each request.
+ *
+ * The server is the same as for ts, found by TS_SOCKET or in TMPDIR as ts
+ * does, and it has to be of the same version. A connection is for one
+ * thread at a time. The functions return -1 or NULL on errors, with errno
+ * set; they never exit the program.
+ *
+ * Everything goes through the connection, or through connections of
+ * their own (ts_submit(), ts_subscribe()). Each job queued needs a process
+ * that runs it and stays with it until it ends: for that, the first
+ * ts_submit() of a connection starts a "ts --libts-runner", from the PATH,
+ * that forks them until ts_close(). The jobs get its environment, the one
+ * of the program then; TS_ENV is not run for them. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ts_conn ts_conn;
+typedef struct ts_list ts_list;
+
+enum ts_state {
+    TS_STATE_QUEUED,
+    TS_STATE_ALLOCATING,
+    TS_STATE_RUNNING,
+    TS_STATE_FINISHED,
+    TS_STATE_SKIPPED,
+    TS_STATE_HOLDING_CLIENT
+};
+
+/* A job to queue. Only argv is needed; zero the rest for the defaults. */
+struct ts_submit {
+    char *const *argv;     /* The command, ended by NULL */
+    const char *label;     /* As ts -L, or NULL */
+    int slots;             /* As ts -N, or 0 for one */
+    const char *depend_on; /* As ts -D, as "3" or "3,5", or NULL */
+};
+
+/* A line of the job list. The strings last until ts_list_close(). */
+struct ts_job {
+    int jobid;
+    enum ts_state state;
+    const char *output;  /* The output file, or "" if not kept */
+    int errorlevel;      /* -1 until it finishes */
+    double real_time;    /* Seconds it ran, 0 until it finishes */
+    const char *command;
+};
+
+/* Connects to the server at socket_path, or the one of ts if NULL.
+ * With start, the server is started if it is not up. */
+ts_conn *ts_connect(const char *socket_path, int start);
+
+void ts_close(ts_conn *c);
+
+/* The path of the socket of the server of ts, to be freed */
+char *ts_socket_path(int *check_owner);
+
+/* Queues a job. Returns its id. */
+int ts_submit(ts_conn *c, const struct ts_submit *job);
+
+/* Queues n jobs, and leaves their ids in jobids (-1 for those that
+ * failed). Returns how many got queued. */
+int ts_submit_batch(ts_conn *c, const struct ts_submit *jobs, int n,
+                    int *jobids);
+
+/* The state of a job, or of the last one with jobid -1 */
+int ts_state(ts_conn *c, int jobid, enum ts_state *state);
+
+/* Waits for a job to end, and leaves its errorlevel in *errorlevel */
+int ts_wait(ts_conn *c, int jobid, int *errorlevel);
+
+/* The job list, one job at a time. ts_list_next() returns NULL at the
+ * end. */
+ts_list *ts_list_open(ts_conn *c);
+
+const struct ts_job *ts_list_next(ts_list *l);
+
+void ts_list_close(ts_list *l);
+
+/* Asks to be told when a job ends. The descriptor returned becomes
+ * readable then, for poll() or select(), and ts_subscription_result()
+ * gives the errorlevel and closes it. */
+int ts_subscribe(ts_conn *c, int jobid);
+
+int ts_subscription_result(int fd, int *errorlevel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include "main.h"
 
 /* From jobs.c */
@@ -106,8 +107,20 @@ static char *print_noresult(const struct Job *p) {
     char *line;
     /* 20 chars should suffice for a string like "[int,int,..]&& " */
     char dependstr[20] = "";
+    char eta[20] = "";
     int cmd_len;
 
+    /* The time left to the expected end */
+    if (p->eta != 0) {
+        float t = p->eta - time(NULL);
+        char *unit;
+
+        if (t < 0)
+            t = 0;
+        unit = time_rep(&t);
+        snprintf(eta, sizeof(eta), "~%.1f%s", t, unit);
+    }
+
     jobstate = jstate2string(p->state);
     output_filename = ofilename_shown(p);
 
@@ -147,7 +160,7 @@ static char *print_noresult(const struct Job *p) {
                  jobstate,
                  output_filename,
                  "",
-                 "",
+                 eta,
                  p->num_gpus,
                  dependstr,
                  label,
@@ -158,7 +171,7 @@ static char *print_noresult(const struct Job *p) {
                  jobstate,
                  output_filename,
                  "",
-                 "",
+                 eta,
                  dependstr,
                  label,
                  cmd);
@@ -174,7 +187,7 @@ static char *print_noresult(const struct Job *p) {
                  jobstate,
                  output_filename,
                  "",
-                 "",
+                 eta,
                  p->num_gpus,
                  dependstr,
                  cmd);
@@ -184,7 +197,7 @@ static char *print_noresult(const struct Job *p) {
                  jobstate,
                  output_filename,
                  "",
-                 "",
+                 eta,
                  dependstr,
                  cmd);
 #endif
@@ -13,22 +13,26 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/time.h> /* Needed for any main.h inclusion */
 
 #include "main.h"
 
 /* Returns the write pipe */
-static int run_sendmail(const char *dest) {
-    int pid;
+static int run_sendmail(const char *dest, int *pid) {
     int p[2];
 
     pipe(p);
 
-    pid = fork();
+    *pid = fork();
 
-    switch (pid) {
+    switch (*pid) {
         case 0: /* Child */
             restore_sigmask();
+            /* Its own group, for wait_hook() to kill all of it */
+            setpgid(0, 0);
             close(0);
             close(1);
             close(2);
@@ -39,6 +43,7 @@ static int run_sendmail(const char *dest) {
         case -1:
             error("fork sendmail");
         default: /* Parent */
+            setpgid(*pid, *pid);
             close(p[0]);
     }
     return p[1];
@@ -54,26 +59,100 @@ static void write_header(int fd, const char *dest, const char *command,
     fd_nprintf(fd, 500, "Output:\n");
 }
 
-static void copy_output(int write_fd, const char *ofname) {
+/* TS_HOOKTIMEOUT, in seconds. 0 for none. */
+static int hook_timeout() {
+    const char *str;
+
+    str = getenv("TS_HOOKTIMEOUT");
+    if (str == NULL)
+        return 0;
+    return abs(atoi(str));
+}
+
+/* When the hook starting now has to end. 0 for never. */
+static time_t hook_deadline() {
+    int timeout = hook_timeout();
+
+    return timeout == 0 ? 0 : time(NULL) + timeout;
+}
+
+/* The hook leads its process group, and all of the group gets killed */
+static void kill_hook(int pid, const char *what) {
+    int status;
+
+    warning("The %s of the job %i ran for %i s. Killing it", what,
+            command_line.jobid, hook_timeout());
+    kill(-pid, SIGKILL);
+    waitpid(pid, &status, 0);
+}
+
+/* Writes all to the non blocking fd, unless the deadline comes first:
+ * returns -1 then */
+static int write_before(int fd, const char *data, int len, time_t end) {
+    struct pollfd pfd;
+    int res;
+
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    while (len > 0) {
+        res = write(fd, data, len);
+        if (res > 0) {
+            data += res;
+            len -= res;
+            continue;
+        }
+        if (res == -1 && errno != EAGAIN && errno != EINTR) {
+            warning("Cannot write to the mail pipe %i", fd);
+            return 0;
+        }
+        if (end != 0 && time(NULL) >= end)
+            return -1;
+        poll(&pfd, 1, end == 0 ? -1 : 100);
+    }
+    return 0;
+}
+
+/* Returns -1 if the deadline came first */
+static int copy_output(int write_fd, const char *ofname, time_t end) {
     int file_fd;
     char buffer[1000];
     int read_bytes;
-    int res;
 
     file_fd = open(ofname, O_RDONLY);
     if (file_fd == -1)
         error("mail: Cannot open the output file %s", ofname);
 
+    fcntl(write_fd, F_SETFL, fcntl(write_fd, F_GETFL) | O_NONBLOCK);
     do {
         read_bytes = read(file_fd, buffer, 1000);
-        if (read_bytes > 0) {
-            res = write(write_fd, buffer, read_bytes);
-            if (res == -1)
-                warning("Cannot write to the mail pipe %i", write_fd);
+        if (read_bytes > 0
+            && write_before(write_fd, buffer, read_bytes, end) == -1) {
+            close(file_fd);
+            return -1;
         }
     } while (read_bytes > 0);
     if (read_bytes == -1)
         warning("Cannot read the output file %s from %i", ofname, file_fd);
+    close(file_fd);
+    return 0;
+}
+
+/* Waits for the hook, killing it at the deadline, if any */
+static void wait_hook(int pid, const char *what, time_t end) {
+    int status;
+
+    if (end == 0) {
+        waitpid(pid, &status, 0);
+        return;
+    }
+
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        if (time(NULL) >= end) {
+            kill_hook(pid, what);
+            return;
+        }
+        poll(NULL, 0, 100);
+    }
 }
 
 void hook_on_finish(int jobid, int errorlevel, const char *ofname, const char *command) {
@@ -81,7 +160,6 @@ void hook_on_finish(int jobid, int errorlevel, const char *ofname, const char *c
     int pid;
     char sjobid[20];
     char serrorlevel[20];
-    int status;
 
     onfinish = getenv("TS_ONFINISH");
     if (onfinish == NULL)
@@ -92,6 +170,7 @@ void hook_on_finish(int jobid, int errorlevel, const char *ofname, const char *c
     switch (pid) {
         case 0: /* Child */
             restore_sigmask();
+            setpgid(0, 0);
             sprintf(sjobid, "%i", jobid);
             sprintf(serrorlevel, "%i", errorlevel);
             execlp(onfinish, onfinish, sjobid, serrorlevel, ofname, command,
@@ -99,7 +178,9 @@ void hook_on_finish(int jobid, int errorlevel, const char *ofname, const char *c
         case -1:
             error("fork on finish");
         default: /* Parent */
-            wait(&status);
+            /* Also here, in case it is killed before the child sets it */
+            setpgid(pid, pid);
+            wait_hook(pid, "TS_ONFINISH", hook_deadline());
     }
 }
 
@@ -109,7 +190,8 @@ void send_mail(int jobid, int errorlevel, const char *ofname,
     char *user;
     char *env_to;
     int write_fd;
-    int status;
+    int pid;
+    time_t end;
 
     env_to = getenv("TS_MAILTO");
 
@@ -123,9 +205,15 @@ void send_mail(int jobid, int errorlevel, const char *ofname,
     } else
         strcpy(to, env_to);
 
-    write_fd = run_sendmail(to);
+    end = hook_deadline();
+    write_fd = run_sendmail(to, &pid);
     write_header(write_fd, to, command, jobid, errorlevel);
-    copy_output(write_fd, ofname);
+    /* A sendmail not reading counts in its time too */
+    if (copy_output(write_fd, ofname, end) == -1) {
+        close(write_fd);
+        kill_hook(pid, "mail");
+        return;
+    }
     close(write_fd);
-    wait(&status);
+    wait_hook(pid, "mail", end);
 }
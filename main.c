@@ -39,6 +39,158 @@ static void init_version() {
                      "Copyright (C) 2007-%d  Duc Nguyen - Lluis Batlle i Rossell", ts_version, timeinfo.tm_year + 1900);
 }
 
+/* Sizes as 100, 10k, 5M or 1G */
+static long long parse_size(const char *str) {
+    char *end;
+    long long size;
+
+    size = strtoll(str, &end, 10);
+    switch (*end) {
+        case 'G':
+        case 'g':
+            size *= 1024;
+            /* Fall through */
+        case 'M':
+        case 'm':
+            size *= 1024;
+            /* Fall through */
+        case 'K':
+        case 'k':
+            size *= 1024;
+            ++end;
+            break;
+        default:
+            break;
+    }
+    if (size < 0 || *end != '\0' || end == str) {
+        fprintf(stderr, "Wrong size: %s\n", str);
+        exit(-1);
+    }
+    return size;
+}
+
+/* rotate, rotate:N (old files kept), ring or kill */
+static void parse_output_policy(const char *str) {
+    if (strcmp(str, "ring") == 0)
+        command_line.output_policy = OUTPUT_RING;
+    else if (strcmp(str, "kill") == 0)
+        command_line.output_policy = OUTPUT_KILL;
+    else if (strcmp(str, "rotate") == 0)
+        command_line.output_policy = OUTPUT_ROTATE;
+    else if (strncmp(str, "rotate:", 7) == 0 && atoi(str + 7) >= 0) {
+        command_line.output_policy = OUTPUT_ROTATE;
+        command_line.output_segments = atoi(str + 7);
+    } else {
+        fprintf(stderr, "Wrong output policy: %s. Choices: {rotate[:num], ring, kill}\n", str);
+        exit(-1);
+    }
+}
+
+/* Times as 10m (ago, with s, m, h or d; or from now, if 'ahead'),
+ * @1700000000 (epoch), 13:45[:30] (today) or 2024-05-01 13:45[:30] */
+static time_t parse_time(const char *str, int ahead) {
+    time_t now = time(NULL);
+    struct tm tm;
+    char *end;
+    long long num;
+    char c;
+    int n;
+
+    if (str[0] == '@') {
+        num = strtoll(str + 1, &end, 10);
+        if (end != str + 1 && *end == '\0')
+            return (time_t) num;
+    } else if (strchr(str, ':') != NULL) {
+        tm = *localtime(&now);
+        tm.tm_sec = 0;
+        n = sscanf(str, "%d-%d-%d %d:%d:%d%c", &tm.tm_year, &tm.tm_mon,
+                   &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &c);
+        if (n == 5 || n == 6) {
+            tm.tm_year -= 1900;
+            tm.tm_mon -= 1;
+        } else {
+            tm.tm_sec = 0;
+            n = sscanf(str, "%d:%d:%d%c", &tm.tm_hour, &tm.tm_min,
+                       &tm.tm_sec, &c);
+            if (n != 2 && n != 3)
+                n = -1;
+        }
+        if (n != -1) {
+            tm.tm_isdst = -1;
+            return mktime(&tm);
+        }
+    } else {
+        num = strtoll(str, &end, 10);
+        if (end != str && num >= 0) {
+            switch (*end) {
+                case 'd':
+                    num *= 24;
+                    /* Fall through */
+                case 'h':
+                    num *= 60;
+                    /* Fall through */
+                case 'm':
+                    num *= 60;
+                    /* Fall through */
+                case 's':
+                    ++end;
+                    break;
+                default:
+                    break;
+            }
+            if (*end == '\0')
+                return ahead ? now + (time_t) num : now - (time_t) num;
+        }
+    }
+    fprintf(stderr, "Wrong time: %s. Use 10m, 2h, 13:45, \"2024-05-01 13:45\" or @epoch\n", str);
+    exit(-1);
+}
+
+static int parse_state(const char *str) {
+    if (strcmp(str, "queued") == 0)
+        return QUEUED;
+    if (strcmp(str, "allocating") == 0)
+        return ALLOCATING;
+    if (strcmp(str, "running") == 0)
+        return RUNNING;
+    if (strcmp(str, "finished") == 0)
+        return FINISHED;
+    if (strcmp(str, "skipped") == 0)
+        return SKIPPED;
+    fprintf(stderr, "Wrong state: %s. Choices: {queued, allocating, running, finished, skipped}\n", str);
+    exit(-1);
+}
+
+/* Job ids as 3, 5-9 or 1,2,7-8 */
+static void parse_job_range(char *str) {
+    char *ptr;
+
+    for (ptr = strtok(str, ","); ptr != NULL; ptr = strtok(NULL, ",")) {
+        int first, last, n;
+        char c;
+
+        n = sscanf(ptr, "%d-%d%c", &first, &last, &c);
+        if (n == 1)
+            last = first;
+        else if (n != 2 || first < 0 || last < first) {
+            fprintf(stderr, "Wrong job id or range: %s\n", ptr);
+            exit(-1);
+        }
+        command_line.job_list = (int *) realloc(command_line.job_list,
+                (command_line.job_list_size + last - first + 1) * sizeof(int));
+        for (; first <= last; ++first)
+            command_line.job_list[command_line.job_list_size++] = first;
+    }
+}
+
+/* The same, in any number of arguments */
+static void parse_job_ranges(int argc, char **argv) {
+    int i;
+
+    for (i = optind; i < argc; ++i)
+        parse_job_range(argv[i]);
+}
+
 static void default_command_line() {
     command_line.request = c_LIST;
     command_line.need_server = 0;
@@ -46,6 +198,22 @@ static void default_command_line() {
     command_line.should_go_background = 1;
     command_line.should_keep_finished = 1;
     command_line.gzip = 0;
+    command_line.compress_level = -1;
+    command_line.max_output = 0;
+    command_line.output_policy = OUTPUT_ROTATE;
+    command_line.output_segments = 1;
+    command_line.time_index = 0;
+    if (getenv("TS_MAXOUTPUT") != NULL)
+        command_line.max_output = parse_size(getenv("TS_MAXOUTPUT"));
+    if (getenv("TS_OUTPUTPOLICY") != NULL)
+        parse_output_policy(getenv("TS_OUTPUTPOLICY"));
+    command_line.peek_size = PEEK_DEFAULT;
+    command_line.stdin_from = -1;
+    command_line.stream_output = 0;
+    if (getenv("TS_PEEKSIZE") != NULL) {
+        long long size = parse_size(getenv("TS_PEEKSIZE"));
+        command_line.peek_size = size > PEEK_MAX ? PEEK_MAX : size;
+    }
     command_line.send_output_by_mail = 0;
     command_line.label = 0;
     command_line.depend_on = NULL; /* -1 means depend on previous */
@@ -59,6 +227,21 @@ static void default_command_line() {
     command_line.wait_free_gpus = 1;
     command_line.logfile = NULL;
     command_line.list_format = DEFAULT;
+    command_line.job_list = NULL;
+    command_line.job_list_size = 0;
+    command_line.tail_lines = -1;
+    command_line.head_lines = -1;
+    command_line.time_since = -1;
+    command_line.time_until = -1;
+    command_line.grep_pattern = NULL;
+    command_line.job_state = -1;
+    command_line.wait_all = 0;
+    command_line.history_failed = 0;
+    command_line.stats_by = STATS_ALL;
+    command_line.deadline = 0;
+    command_line.pool = 0;
+    command_line.pool_size = 0;
+    command_line.worker.pid = 0;
 }
 
 struct Msg default_msg() {
@@ -122,6 +305,34 @@ static struct option longOptions[] = {
         {"unsetenv",           required_argument, NULL, 0},
         {"get_logdir",         no_argument,       NULL, 0},
         {"set_logdir",         required_argument, NULL, 0},
+        {"follow-many",        required_argument, NULL, 0},
+        {"lines",              required_argument, NULL, 0},
+        {"head",               required_argument, NULL, 0},
+        {"zlevel",             required_argument, NULL, 0},
+        {"max-output",         required_argument, NULL, 0},
+        {"output-policy",      required_argument, NULL, 0},
+        {"time-index",         no_argument,       NULL, 0},
+        {"since",              required_argument, NULL, 0},
+        {"between",            required_argument, NULL, 0},
+        {"grep",               required_argument, NULL, 0},
+        {"peek",               required_argument, NULL, 0},
+        {"stdin-from",         required_argument, NULL, 0},
+        {"session",            no_argument,       NULL, 0},
+        {"watch",              no_argument,       NULL, 0},
+        {"all",                no_argument,       NULL, 0},
+        {"label",              required_argument, NULL, 'L'},
+        {"state",              required_argument, NULL, 0},
+        {"pool",               required_argument, NULL, 0},
+        {"pool-start",         required_argument, NULL, 0},
+        {"pool-stop",          required_argument, NULL, 0},
+        {"pools",              no_argument,       NULL, 0},
+        {"mem-stats",          no_argument,       NULL, 0},
+        {"libts-runner",       no_argument,       NULL, 0},
+        {"history",            no_argument,       NULL, 0},
+        {"failed",             no_argument,       NULL, 0},
+        {"stats",              no_argument,       NULL, 0},
+        {"by",                 required_argument, NULL, 0},
+        {"deadline",           required_argument, NULL, 0},
 #ifndef CPU
         {"gpus",              required_argument, NULL, 'G'},
         {"gpu_indices",       required_argument, NULL, 'g'},
@@ -166,6 +377,91 @@ void parse_opts(int argc, char **argv) {
                 } else if (strcmp(longOptions[optionIdx].name, "set_logdir") == 0) {
                     command_line.request = c_SET_LOGDIR;
                     command_line.label = optarg; /* reuse this variable */
+                } else if (strcmp(longOptions[optionIdx].name, "follow-many") == 0) {
+                    command_line.request = c_FOLLOW_MANY;
+                    command_line.job_list = (int*) malloc(strlen(optarg) * sizeof(int));
+                    command_line.job_list_size = strtok_int(optarg, ",", command_line.job_list);
+                } else if (strcmp(longOptions[optionIdx].name, "lines") == 0) {
+                    command_line.tail_lines = atoi(optarg);
+                    if (command_line.tail_lines < 0)
+                        error("The number of lines must be positive.");
+                } else if (strcmp(longOptions[optionIdx].name, "zlevel") == 0) {
+                    command_line.compress_level = atoi(optarg);
+                    if (command_line.compress_level < 1
+                        || command_line.compress_level > 19)
+                        error("The compression level must be between 1 and 19.");
+                    command_line.gzip = 1;
+                } else if (strcmp(longOptions[optionIdx].name, "max-output") == 0) {
+                    command_line.max_output = parse_size(optarg);
+                } else if (strcmp(longOptions[optionIdx].name, "output-policy") == 0) {
+                    parse_output_policy(optarg);
+                } else if (strcmp(longOptions[optionIdx].name, "grep") == 0) {
+                    command_line.request = c_GREP;
+                    command_line.grep_pattern = optarg;
+                } else if (strcmp(longOptions[optionIdx].name, "peek") == 0) {
+                    command_line.request = c_PEEK;
+                    command_line.jobid = strcmp(optarg, "all") == 0 ? -1 : atoi(optarg);
+                } else if (strcmp(longOptions[optionIdx].name, "session") == 0) {
+                    command_line.request = c_SESSION;
+                } else if (strcmp(longOptions[optionIdx].name, "watch") == 0) {
+                    command_line.request = c_WATCH;
+                } else if (strcmp(longOptions[optionIdx].name, "all") == 0) {
+                    command_line.wait_all = 1;
+                } else if (strcmp(longOptions[optionIdx].name, "stdin-from") == 0) {
+                    command_line.stdin_from = atoi(optarg);
+                    if (command_line.stdin_from < 0)
+                        error("Wrong job id %s for --stdin-from.", optarg);
+                } else if (strcmp(longOptions[optionIdx].name, "state") == 0) {
+                    command_line.job_state = parse_state(optarg);
+                } else if (strcmp(longOptions[optionIdx].name, "pool") == 0) {
+                    command_line.pool = optarg;
+                } else if (strcmp(longOptions[optionIdx].name, "pool-start") == 0) {
+                    command_line.request = c_POOL_START;
+                    command_line.pool = optarg;
+                } else if (strcmp(longOptions[optionIdx].name, "pool-stop") == 0) {
+                    command_line.request = c_POOL_STOP;
+                    command_line.pool = optarg;
+                } else if (strcmp(longOptions[optionIdx].name, "pools") == 0) {
+                    command_line.request = c_LIST_POOLS;
+                } else if (strcmp(longOptions[optionIdx].name, "mem-stats") == 0) {
+                    command_line.request = c_MEM_STATS;
+                } else if (strcmp(longOptions[optionIdx].name, "libts-runner") == 0) {
+                    /* Not for users: started by libts (see libts.c) */
+                    command_line.request = c_LIBTS_RUNNER;
+                } else if (strcmp(longOptions[optionIdx].name, "history") == 0) {
+                    command_line.request = c_HISTORY;
+                } else if (strcmp(longOptions[optionIdx].name, "failed") == 0) {
+                    command_line.history_failed = 1;
+                } else if (strcmp(longOptions[optionIdx].name, "stats") == 0) {
+                    command_line.request = c_STATS;
+                } else if (strcmp(longOptions[optionIdx].name, "deadline") == 0) {
+                    command_line.deadline = parse_time(optarg, 1);
+                } else if (strcmp(longOptions[optionIdx].name, "by") == 0) {
+                    if (strcmp(optarg, "label") == 0)
+                        command_line.stats_by = STATS_LABEL;
+                    else if (strcmp(optarg, "state") == 0)
+                        command_line.stats_by = STATS_STATE;
+                    else if (strcmp(optarg, "exit") == 0)
+                        command_line.stats_by = STATS_EXIT;
+                    else {
+                        fprintf(stderr, "--by goes with label, state or exit, "
+                                        "not %s\n", optarg);
+                        exit(-1);
+                    }
+                } else if (strcmp(longOptions[optionIdx].name, "time-index") == 0) {
+                    command_line.time_index = 1;
+                } else if (strcmp(longOptions[optionIdx].name, "since") == 0) {
+                    command_line.time_since = parse_time(optarg, 0);
+                } else if (strcmp(longOptions[optionIdx].name, "between") == 0) {
+                    /* Two arguments: the second is the next word */
+                    if (optind >= argc)
+                        error("--between needs two times.");
+                    command_line.time_since = parse_time(optarg, 0);
+                    command_line.time_until = parse_time(argv[optind++], 0);
+                } else if (strcmp(longOptions[optionIdx].name, "head") == 0) {
+                    command_line.head_lines = atoi(optarg);
+                    if (command_line.head_lines < 0)
+                        error("The number of lines must be positive.");
 #ifndef CPU
                 } else if (strcmp(longOptions[optionIdx].name, "set_gpu_free_perc") == 0) {
                     command_line.request = c_SET_FREE_PERC;
@@ -277,7 +573,14 @@ void parse_opts(int argc, char **argv) {
                 break;
             case 'w':
                 command_line.request = c_WAITJOB;
-                command_line.jobid = atoi(optarg);
+                if (optarg[0] == '-' && optarg == argv[optind - 1]) {
+                    /* As in "ts -w --label L": another option, not an id */
+                    --optind;
+                    command_line.jobid = -1;
+                } else if (strpbrk(optarg, ",-") != NULL)
+                    parse_job_range(optarg);
+                else
+                    command_line.jobid = atoi(optarg);
                 break;
             case 'u':
                 command_line.request = c_URGENT;
@@ -329,7 +632,9 @@ void parse_opts(int argc, char **argv) {
                 command_line.request = c_COUNT_RUNNING;
                 break;
             case 'M':
-                command_line.request = c_LIST;
+                /* Also the format of --stats */
+                if (command_line.request != c_STATS)
+                    command_line.request = c_LIST;
 
                 if (strcmp(optarg, "default") == 0)
                     command_line.list_format = DEFAULT;
@@ -422,6 +727,24 @@ void parse_opts(int argc, char **argv) {
 
     command_line.command.num = 0;
 
+    if (command_line.request == c_GREP || command_line.request == c_WATCH)
+        parse_job_ranges(argc, argv);
+
+    /* --pool-start NAME N command... */
+    if (command_line.request == c_POOL_START) {
+        if (optind + 1 >= argc) {
+            fprintf(stderr, "--pool-start needs the number of workers and "
+                            "the command starting them\n");
+            exit(-1);
+        }
+        command_line.pool_size = atoi(argv[optind]);
+        if (command_line.pool_size <= 0) {
+            fprintf(stderr, "Wrong number of workers %s.\n", argv[optind]);
+            exit(-1);
+        }
+        get_command(optind + 1, argc, argv);
+    }
+
     /* if the request is still the default option... 
      * (the default values should be centralized) */
     if (optind < argc && command_line.request == c_LIST) {
@@ -430,7 +753,9 @@ void parse_opts(int argc, char **argv) {
     }
 
     if (command_line.request != c_SHOW_HELP &&
-        command_line.request != c_SHOW_VERSION)
+        command_line.request != c_SHOW_VERSION &&
+        command_line.request != c_HISTORY &&
+        command_line.request != c_LIBTS_RUNNER)
         command_line.need_server = 1;
 
     if (!command_line.store_output && !command_line.should_go_background)
@@ -442,6 +767,62 @@ void parse_opts(int argc, char **argv) {
                 "For e-mail, you should store the output (not through gzip)\n");
         exit(-1);
     }
+
+    if (command_line.max_output > 0 && command_line.output_policy == OUTPUT_RING
+        && command_line.gzip) {
+        fprintf(stderr,
+                "The ring output policy cannot cut a compressed output (-z)\n");
+        exit(-1);
+    }
+
+    if (command_line.time_index && (command_line.gzip
+        || (command_line.max_output > 0
+            && command_line.output_policy != OUTPUT_KILL))) {
+        fprintf(stderr,
+                "The time index needs a plain output file, not compressed (-z) "
+                "nor rotated or cut (--output-policy)\n");
+        exit(-1);
+    }
+
+    if (command_line.stdin_from != -1 && command_line.request != c_QUEUE) {
+        fprintf(stderr, "--stdin-from goes with a job to queue\n");
+        exit(-1);
+    }
+
+    if (command_line.pool != 0 && command_line.request != c_QUEUE
+        && command_line.request != c_POOL_START
+        && command_line.request != c_POOL_STOP) {
+        fprintf(stderr, "--pool goes with a job to queue\n");
+        exit(-1);
+    }
+
+    if (command_line.deadline != 0 && command_line.request != c_QUEUE) {
+        fprintf(stderr, "--deadline goes with a job to queue\n");
+        exit(-1);
+    }
+
+    if (command_line.pool != 0 && command_line.request == c_QUEUE
+        && command_line.stdin_from != -1) {
+        fprintf(stderr, "The pool workers read the jobs from their stdin, "
+                        "not --stdin-from\n");
+        exit(-1);
+    }
+
+    if (command_line.time_since != -1 && command_line.request != c_TAIL
+        && command_line.request != c_CAT && command_line.request != c_HISTORY) {
+        fprintf(stderr, "--since and --between go with -t, -c or --history\n");
+        exit(-1);
+    }
+
+    if (command_line.stats_by != STATS_ALL && command_line.request != c_STATS) {
+        fprintf(stderr, "--by goes with --stats\n");
+        exit(-1);
+    }
+
+    if (command_line.history_failed && command_line.request != c_HISTORY) {
+        fprintf(stderr, "--failed goes with --history\n");
+        exit(-1);
+    }
 }
 
 static void fill_first_3_handles() {
@@ -491,9 +872,21 @@ static void print_help(const char *cmd) {
     printf("  TS_MAXFINISHED      maximum finished jobs in the queue.\n");
     printf("  TS_MAXCONN          maximum number of ts connections at once.\n");
     printf("  TS_ONFINISH         binary called on job end (passes jobid, error, outfile, command).\n");
+    printf("  TS_HOOKSLOTS        how many TS_ONFINISH and -m mails run at once, for all the jobs (4 by default).\n");
+    printf("  TS_HOOKTIMEOUT      seconds after which TS_ONFINISH or the mail of a job get killed.\n");
     printf("  TS_ENV              command called on enqueue. Its output determines the job information.\n");
+    printf("  TS_ENVTTL           seconds the output of TS_ENV is reused for the jobs queued alike (same dir and env).\n");
+    printf("  TS_HISTORY          file (absolute path) where the finished jobs go when the server forgets them.\n");
     printf("  TS_SAVELIST         filename which will store the list, if the server dies.\n");
+    printf("  TS_MAXOUTPUT        default limit of the size of the output files (--max-output).\n");
+    printf("  TS_OUTPUTPOLICY     default policy at that limit (--output-policy).\n");
+    printf("  TS_PEEKSIZE         last bytes of output the server keeps of each running job (--peek), 64k by default.\n");
+    printf("  TS_POLICY           order in which the queued jobs run. Choices: {fifo, sjf, edf}.\n");
+    printf("  TS_LOGLAYOUT        where the output files go in the log dir. Choices: {flat, sharded, label}.\n");
+    printf("  TS_REAPOUTPUT       if 1, the server removes the output files of the finished jobs it forgets.\n");
     printf("  TS_SLOTS            amount of jobs which can run at once, read on server start.\n");
+    printf("  TS_SNAPSHOT         if 0, -l, -s, -q, -R and -S ask the server instead of reading its snapshot.\n");
+    printf("  TS_SPAWN            if 0, the jobs start by fork() instead of posix_spawn().\n");
     printf("  TMPDIR              directory where to place the output files and the default socket.\n");
     printf("Long option actions:\n");
     printf("  --getenv [var]                         get the value of the specified variable in server environment.\n");
@@ -505,11 +898,40 @@ static void print_help(const char *cmd) {
     printf("  --last_queue_id       || -q            show the job ID of the last added.\n");
     printf("  --get_logdir                           get the path containing log files.\n");
     printf("  --set_logdir [path]                    set the path containing log files.\n");
+    printf("  --follow-many [id,...]                 like -t, for the outputs of all the given jobs at once.\n");
+    printf("  --lines [num]                          with -t, -c or --follow-many, start at the last num lines of the output.\n");
+    printf("  --head [num]                           with -t, -c or --follow-many, show only the first num lines of the output.\n");
+    printf("  --since [time]                         with -t or -c, show the output written from that time on. Needs --time-index.\n");
+    printf("  --between [time] [time]                with -t or -c, show the output written between the two times. Needs --time-index.\n");
+    printf("  --grep [pattern] [id...]               show the output lines of the jobs matching the pattern, with the job id.\n");
+    printf("                                         The jobs can be chosen with --label, --state or ids as 3 or 5-9.\n");
+    printf("  --state [state]                        with --grep, look only at the jobs in that state.\n");
+    printf("  --peek [id|all]                        show the last output of the running job(s), kept by the server (TS_PEEKSIZE).\n");
+    printf("  --session                              answer the requests read from stdin (-l, -s 3, ...) on one connection.\n");
+    printf("  --watch [id...]                        show the events of the jobs (queued, started, finished...) as JSON lines.\n");
+    printf("                                         With ids as 3 or 5-9, until they end. The jobs can be chosen with --label.\n");
+    printf("  --pool-start [name] [num] [cmd...]     start a pool of num workers running cmd, for the jobs queued with --pool.\n");
+    printf("  --pool-stop [name]                     stop the workers of the pool, once they end their jobs.\n");
+    printf("  --pools                                show the pools, with their workers and command.\n");
+    printf("  --mem-stats                            show the memory the server uses for its jobs.\n");
+    printf("  --history                              show the finished jobs kept in TS_HISTORY. With --label, --since or --failed,\n");
+    printf("                                         only those with the label, ended since the time, or that failed.\n");
+    printf("  --stats [--by label|state|exit]        show counts, failures, run and queue times of the finished jobs, with those\n");
+    printf("                                         of TS_HISTORY, in groups. With -M json, as JSON.\n");
     printf("  --serialize [format]  || -M [format]   serialize the job list to the specified format. Choices: {default, json, tab}.\n");
 #ifndef CPU
     printf("  --set_gpu_free_perc   [num]                   set the value of GPU memory threshold above which GPUs are considered available (90 by default).\n");
     printf("  --get_gpu_free_perc                           get the value of GPU memory threshold above which GPUs are considered available.\n");
+#endif
     printf("Long option adding jobs:\n");
+    printf("  --zlevel [num]                         like -z, compressing with the given level.\n");
+    printf("  --max-output [size]                    limit the size of the output file, as 100k, 10M or 1G.\n");
+    printf("  --output-policy [policy]               what to do at the output limit. Choices: {rotate[:num], ring, kill}.\n");
+    printf("  --time-index                           index the output by the time it was written, for --since and --between.\n");
+    printf("  --stdin-from [id]                      take the output of that job as input, while both run.\n");
+    printf("  --pool [name]                          run the job in an idle worker of the pool, instead of a new process.\n");
+    printf("  --deadline [time]                      when the job should end, for TS_POLICY=edf. Shown by -i.\n");
+#ifndef CPU
     printf("  --gpus                       || -G [num]      number of GPUs required by the job (1 default).\n");
     printf("  --gpu_indices                || -g [id,...]   the job will be on these GPU indices without checking whether they are free.\n");
 #endif
@@ -528,7 +950,8 @@ static void print_help(const char *cmd) {
     printf("  -i [id]      show job information. Of last job run, if not specified.\n");
     printf("  -s [id]      show the job state. Of the last added, if not specified.\n");
     printf("  -r [id]      remove a job. The last added, if not specified.\n");
-    printf("  -w [id]      wait for a job. The last added, if not specified.\n");
+    printf("  -w [id]      wait for a job. The last added, if not specified. Also for many, as 1,4,6-9,\n");
+    printf("               with --label for those in the queue with it, or with --all for all in the queue.\n");
     printf("  -k [id]      send SIGTERM to the job process group. The last run, if not specified.\n");
     printf("  -T           send SIGTERM to all running job groups.\n");
     printf("  -u [id]      put that job first. The last added, if not specified.\n");
@@ -539,7 +962,7 @@ static void print_help(const char *cmd) {
     printf("  -B           in case of full clients on the server, quit instead of waiting.\n");
     printf("  -n           don't store the output of the command.\n");
     printf("  -E           Keep stderr apart, in a name like the output file, but adding '.e'.\n");
-    printf("  -z           gzip the stored output (if not -n).\n");
+    printf("  -z           compress the stored output (if not -n).\n");
     printf("  -f           don't fork into background.\n");
     printf("  -m           send the output by e-mail (uses sendmail).\n");
     printf("  -d           the job will be run after the last job ends.\n");
@@ -589,6 +1012,10 @@ int main(int argc, char **argv) {
     /* This will be inherited by the server, if it's run */
     ignore_sigpipe();
 
+    /* Questions about the queue may not need the server at all */
+    if (command_line.need_server && c_snapshot_query())
+        return 0;
+
     if (command_line.need_server) {
         ensure_server_up();
         c_check_version();
@@ -601,6 +1028,16 @@ int main(int argc, char **argv) {
         case c_SHOW_HELP:
             print_help(argv[0]);
             break;
+        case c_HISTORY:
+            c_history();
+            break;
+        case c_LIBTS_RUNNER: {
+            /* The socket from libts comes as stdin */
+            int from = dup(0);
+            go_background();
+            c_libts_runner(from);
+        }
+            break;
         case c_QUEUE:
             if (command_line.command.num <= 0)
                 error("Tried to queue a void command. parameters: %i",
@@ -702,7 +1139,11 @@ int main(int argc, char **argv) {
         case c_WAITJOB:
             if (!command_line.need_server)
                 error("The command %i needs the server", command_line.request);
-            errorlevel = c_wait_job();
+            if (command_line.job_list_size > 0 || command_line.label != 0
+                || command_line.wait_all)
+                errorlevel = c_wait_jobs();
+            else
+                errorlevel = c_wait_job();
             break;
         case c_URGENT:
             if (!command_line.need_server)
@@ -762,6 +1203,56 @@ int main(int argc, char **argv) {
         case c_SET_LOGDIR:
             c_set_logdir();
             break;
+        case c_FOLLOW_MANY:
+            if (!command_line.need_server)
+                error("The command %i needs the server", command_line.request);
+            errorlevel = c_follow_many();
+            break;
+        case c_GREP:
+            if (!command_line.need_server)
+                error("The command %i needs the server", command_line.request);
+            errorlevel = c_grep();
+            break;
+        case c_PEEK:
+            if (!command_line.need_server)
+                error("The command %i needs the server", command_line.request);
+            c_peek();
+            break;
+        case c_SESSION:
+            if (!command_line.need_server)
+                error("The command %i needs the server", command_line.request);
+            c_session();
+            break;
+        case c_WATCH:
+            if (!command_line.need_server)
+                error("The command %i needs the server", command_line.request);
+            errorlevel = c_watch();
+            break;
+        case c_POOL_START:
+            if (!command_line.need_server)
+                error("The command %i needs the server", command_line.request);
+            errorlevel = c_pool_start();
+            break;
+        case c_POOL_STOP:
+            if (!command_line.need_server)
+                error("The command %i needs the server", command_line.request);
+            errorlevel = c_pool_stop();
+            break;
+        case c_LIST_POOLS:
+            if (!command_line.need_server)
+                error("The command %i needs the server", command_line.request);
+            c_list_pools();
+            break;
+        case c_MEM_STATS:
+            if (!command_line.need_server)
+                error("The command %i needs the server", command_line.request);
+            c_mem_stats();
+            break;
+        case c_STATS:
+            if (!command_line.need_server)
+                error("The command %i needs the server", command_line.request);
+            c_stats();
+            break;
     }
 
     if (command_line.need_server) {
@@ -769,6 +1260,7 @@ int main(int argc, char **argv) {
     }
     free(command_line.gpu_nums);
     free(command_line.logfile);
+    free(command_line.job_list);
 
     return errorlevel;
 }
@@ -6,10 +6,11 @@
 */
 #include <stdio.h>
 #include <sys/time.h>
+#include <sys/select.h>
 
 enum {
     CMD_LEN = 500,
-    PROTOCOL_VERSION = 730
+    PROTOCOL_VERSION = 745
 };
 
 enum MsgTypes {
@@ -55,7 +56,30 @@ enum MsgTypes {
     SET_FREE_PERC,
     GET_FREE_PERC,
     GET_LOGDIR,
-    SET_LOGDIR
+    SET_LOGDIR,
+    LIST_OUTPUTS,
+    PEEK_DATA,
+    PEEK,
+    STDIN_PIPE,
+    STDIN_PIPE_OK,
+    CONSUMER_PIPE,
+    STREAM_END,
+    STREAM_END_OK,
+    SESSION,
+    LIST_END,
+    WATCH,
+    WAITJOBS,
+    POOL_START,
+    POOL_STOP,
+    LIST_POOLS,
+    ASK_ENV_CACHE,
+    ANSWER_ENV_CACHE,
+    MEM_STATS,
+    STATS,
+    HOOK_WAIT,
+    HOOK_GO,
+    HOOK_LATER,
+    PEEK_NOK
 };
 
 enum Request {
@@ -90,7 +114,68 @@ enum Request {
     c_SET_FREE_PERC,
     c_GET_FREE_PERC,
     c_GET_LOGDIR,
-    c_SET_LOGDIR
+    c_SET_LOGDIR,
+    c_FOLLOW_MANY,
+    c_GREP,
+    c_PEEK,
+    c_SESSION,
+    c_WATCH,
+    c_POOL_START,
+    c_POOL_STOP,
+    c_LIST_POOLS,
+    c_MEM_STATS,
+    c_HISTORY,
+    c_STATS,
+    c_LIBTS_RUNNER
+};
+
+enum Compression {
+    COMPRESS_NONE,
+    COMPRESS_ZLIB,
+    COMPRESS_ZSTD
+};
+
+enum {
+    ZHEADER_SIZE = 8, /* At the start of a compressed output */
+    ZFRAME_HEADER_SIZE = 8,
+    ZFRAME_SIZE = 128 * 1024, /* Uncompressed bytes in a frame we write */
+    ZFRAME_MAX = 16 * 1024 * 1024 /* Bigger frames we read are bad */
+};
+
+enum {
+    PEEK_MAX = 1024 * 1024, /* Max bytes kept by job for ts --peek */
+    PEEK_DEFAULT = 64 * 1024, /* Without TS_PEEKSIZE */
+    PEEK_MS = 250 /* How often the job runner sends them to the server */
+};
+
+/* How a job gets the output of another as its input (--stdin-from) */
+enum StreamMode {
+    STREAM_LIVE, /* From the job runner of the other, through a pipe */
+    STREAM_FILE, /* Following its output file */
+    STREAM_NONE  /* Nothing to read */
+};
+
+enum {
+    ENV_KEY_SIZE = 17 /* The hex hash keying the TS_ENV outputs, and '\0' */
+};
+
+enum {
+    TAIL_NO_HEADER = -2 /* tail_many() from the start, without the command */
+};
+
+/* The command line at the start of the output may not be written yet,
+ * so it is skipped as the data arrives. The not supervised outputs have a
+ * NUL after its newline. */
+enum {
+    SKIP_NONE,
+    SKIP_LINE,
+    SKIP_NUL
+};
+
+enum OutputPolicy {
+    OUTPUT_ROTATE,
+    OUTPUT_RING,
+    OUTPUT_KILL
 };
 
 enum ListFormat {
@@ -99,6 +184,14 @@ enum ListFormat {
     TAB
 };
 
+/* ts --stats --by */
+enum StatsBy {
+    STATS_ALL,
+    STATS_LABEL,
+    STATS_STATE,
+    STATS_EXIT
+};
+
 struct CommandLine {
     enum Request request;
     int need_server;
@@ -108,12 +201,39 @@ struct CommandLine {
     int should_keep_finished;
     int send_output_by_mail;
     int gzip;
+    int compress_level; /* -1 for the default of the compressor */
+    long long max_output; /* Bytes the output file can take. 0, no limit */
+    enum OutputPolicy output_policy; /* What to do at max_output */
+    int output_segments; /* Old files kept by OUTPUT_ROTATE */
+    int time_index; /* Write the time index of the output */
     int *depend_on; /* -1 means depend on previous */
     int depend_on_size;
     int max_slots; /* How many jobs to run at once */
     int jobid; /* When queuing a job, main.c will fill it automatically from
                   the server answer to NEWJOB */
     int jobid2;
+    int *job_list; /* Jobs for the requests taking many of them */
+    int job_list_size;
+    int tail_lines; /* -t/-c: last lines to show. -1 if not given */
+    int head_lines; /* -t/-c: first lines to show. -1 if not given */
+    time_t time_since; /* -t/-c: show from this time on. -1 if not given */
+    time_t time_until; /* -t/-c: and until this time. -1 if not given */
+    char *grep_pattern;
+    int job_state; /* --grep: state of the jobs to look at, -1 for any */
+    int wait_all; /* -w --all: for all the jobs in the queue */
+    int history_failed; /* --history --failed: only the jobs that failed */
+    enum StatsBy stats_by; /* --stats: the groups */
+    time_t deadline; /* --deadline. 0 for none */
+    int peek_size; /* Last output bytes the server keeps. 0 for none */
+    int stdin_from; /* Job whose output is our input. -1 for none */
+    int stream_output; /* The server may send us consumers of the output */
+    char *pool; /* --pool: of the workers to run the job. 0 for none */
+    int pool_size; /* --pool-start: workers to start */
+    struct {
+        int pid; /* 0, if the job runs apart */
+        int in;
+        int out;
+    } worker; /* The pool worker the server gives to run the job */
     int wait_enqueuing;
     struct {
         char **array;
@@ -142,6 +262,10 @@ extern int term_width;
 
 struct Msg;
 
+struct SharedEnv;
+
+struct Estimate;
+
 enum Jobstate {
     QUEUED,
     ALLOCATING,
@@ -166,11 +290,17 @@ struct Msg {
             int num_slots;
             int gpus;
             int wait_free_gpus;
+            int stdin_from;
+            int pool_size;
+            char env_key[ENV_KEY_SIZE]; /* Empty if TS_ENV is not reused */
+            int env_ttl;
+            time_t deadline; /* 0 for none */
         } newjob;
         struct {
             int ofilename_size;
             int store_output;
             int pid;
+            int peek_size; /* Of the ring it sends (TS_PEEKSIZE). 0, none */
         } output;
         int jobid;
         struct Result {
@@ -188,46 +318,110 @@ struct Msg {
             int jobid1;
             int jobid2;
         } swap;
-        int last_errorlevel;
+        struct {
+            int last_errorlevel;
+            int stream; /* Consumers of the output may come */
+            int worker_pid; /* Of the pool worker, whose stdin and stdout
+                               follow. 0 for none */
+        } runjob;
+        enum StreamMode stream;
         int max_slots;
         int version;
         int count_running;
         char *label;
         int term_width;
         enum ListFormat list_format;
+        struct {
+            int state; /* -1 for any */
+            int label_size; /* 0 for any */
+        } filter;
+        struct {
+            int size; /* Bytes following */
+            int ring_size;
+        } peek;
+        struct {
+            int size; /* Workers */
+            int name_size;
+            int command_size;
+        } pool;
+        struct {
+            char key[ENV_KEY_SIZE];
+            int ttl;
+            int cached; /* The answer */
+        } env;
+        struct {
+            enum StatsBy by;
+            enum ListFormat format;
+        } stats;
     } u;
 };
 
 struct Procinfo {
-    char *ptr;
-    int nchars;
-    int allocchars;
     struct timeval enqueue_time;
     struct timeval start_time;
     struct timeval end_time;
 };
 
+struct Peek {
+    char *buf;
+    int size;
+    int start;
+    int len;
+};
+
+/* In the server, the records come from a slab (slab.c), and the strings
+ * are blobs (blob.c). The fields go by size, not to waste in padding. */
 struct Job {
     struct Job *next;
-    int jobid;
     char *command;
-    enum Jobstate state;
-    struct Result result; /* Defined in msg.h */
+    char *label;
     char *output_filename;
-    int store_output;
-    int pid;
-    int should_keep_finished;
     int *depend_on;
-    int depend_on_size;
     int *notify_errorlevel_to;
+    int *gpu_ids;
+    struct Peek *peek; /* Last output, while running. 0 if none */
+    struct Waiter *waiters; /* The ts -w waiting for it to end */
+    char *pool; /* Whose workers run it (--pool), or 0 */
+    struct SharedEnv *env; /* The output of TS_ENV, or 0 */
+    struct Estimate *est_command; /* Of its run time (estimate.c), or 0 */
+    struct Estimate *est_label;
+    time_t deadline; /* --deadline, for TS_POLICY=edf. 0 for none */
+    time_t eta; /* Expected end, while not finished. 0 if unknown */
+    struct Procinfo info;
+    struct Result result; /* Defined in msg.h */
+    int jobid;
+    enum Jobstate state;
+    int pid;
+    int depend_on_size;
     int notify_errorlevel_to_size;
     int dependency_errorlevel;
-    char *label;
-    struct Procinfo info;
     int num_slots;
     int num_gpus;
-    int *gpu_ids;
-    int wait_free_gpus;
+    int stdin_from; /* Job whose output is our input. -1 for none */
+    char store_output;
+    char should_keep_finished;
+    char wait_free_gpus;
+    char streams; /* Its job runner takes consumers of the output */
+};
+
+/* The head of the records in a hash table (hash.c) */
+struct HashEntry {
+    struct HashEntry *next; /* In the bucket */
+    unsigned int hash;
+};
+
+struct HashTable {
+    struct HashEntry **buckets;
+    unsigned int num_buckets;
+    unsigned int count;
+};
+
+/* Records of one size (slab.c) */
+struct Slab {
+    int record_size;
+    void *free_list;
+    int chunks;
+    int used; /* Records given */
 };
 
 enum ExitCodes {
@@ -259,12 +453,38 @@ void c_clear_finished();
 
 int c_wait_server_commands();
 
+void c_libts_runner(int from);
+
 void c_send_runjob_ok(const char *ofname, int pid);
 
+void c_wait_hook_turn();
+
 int c_tail();
 
 int c_cat();
 
+int c_follow_many();
+
+int c_list_outputs(int **jobids, char ***fnames);
+
+void c_peek();
+
+int c_watch();
+
+int c_wait_jobs();
+
+int c_pool_start();
+
+int c_pool_stop();
+
+void c_list_pools();
+
+void c_mem_stats();
+
+void c_stats();
+
+int c_stdin_pipe();
+
 void c_show_output_file();
 
 void c_remove_job();
@@ -279,6 +499,8 @@ int c_wait_running_job();
 
 int c_wait_job_recv();
 
+int c_wait_job_recv_from(int s);
+
 void c_move_urgent();
 
 int c_wait_newjob_ok();
@@ -324,6 +546,8 @@ void c_set_logdir();
 char* get_logdir();
 
 /* jobs.c */
+void send_list_line(int s, const char *str);
+
 void s_list(int s, enum ListFormat listFormat);
 
 #ifndef CPU
@@ -342,7 +566,11 @@ void s_mark_job_running(int jobid);
 
 void s_clear_finished();
 
-void s_process_runjob_ok(int jobid, char *oname, int pid);
+void s_each_finished(void (*fn)(const struct Job *p, void *data), void *data);
+
+void s_history_finished();
+
+void s_process_runjob_ok(int jobid, char *oname, int pid, int peek_size);
 
 void s_send_output(int socket, int jobid);
 
@@ -350,12 +578,28 @@ int s_remove_job(int s, int *jobid);
 
 void s_remove_notification(int s);
 
+void s_watch(int s, char *label, int *jobs, int num_jobs);
+
+void s_remove_watcher(int s);
+
+int s_watchers_pending(fd_set *writeset, int maxfd);
+
+void s_watchers_flush(fd_set *writeset);
+
+int s_watcher_dropped(int s);
+
 void check_notify_list(int jobid);
 
 void s_wait_job(int s, int jobid);
 
 void s_wait_running_job(int s, int jobid);
 
+void s_wait_jobs(int s, char *label, int *jobs, int num_jobs);
+
+void s_publish_snapshot();
+
+void s_mem_stats(int s);
+
 void s_move_urgent(int s, int jobid);
 
 void s_send_state(int s, int jobid);
@@ -374,7 +618,7 @@ void joblist_dump(int fd);
 
 const char *jstate2string(enum Jobstate s);
 
-void s_job_info(int s, int jobid);
+void s_job_info(int s, int jobid, int sized);
 
 void s_send_last_id(int s);
 
@@ -408,6 +652,19 @@ void s_get_logdir(int s);
 
 void s_set_logdir(const char*);
 
+void s_list_outputs(int s, int state, const char *label, const int *jobs,
+                    int num_jobs);
+
+void s_peek_data(int s, int jobid, int size, int ring_size);
+
+void s_peek(int s, int jobid);
+
+int s_has_consumers(int jobid);
+
+enum StreamMode s_stream_mode(int jobid);
+
+void s_stream_end(int jobid);
+
 /* server.c */
 void server_main(int notify_fd, char *_path);
 
@@ -422,6 +679,10 @@ void wait_server_up(int fd);
 
 int ensure_server_up();
 
+int try_connect_server();
+
+int connect_server();
+
 void notify_parent(int fd);
 
 void create_socket_path(char **path);
@@ -429,6 +690,115 @@ void create_socket_path(char **path);
 /* execute.c */
 int run_job(struct Result *res);
 
+void run_job_hooks(const struct Result *res);
+
+/* output.c */
+int output_supervised();
+
+enum Compression output_compression();
+
+void output_supervise(int fd_in, const char *ofname, int pid, int *status);
+
+/* pool.c */
+void s_pool_start(int s, const char *name, int size, const char *command);
+
+void s_pool_stop(int s, const char *name);
+
+void s_list_pools(int s);
+
+int s_pool_can_run(const char *name);
+
+int s_pool_take(const char *name, int jobid, int *in, int *out);
+
+void s_pool_release(int jobid, int reuse);
+
+void s_pool_reap();
+
+void s_pool_end();
+
+/* reaper.c */
+int reaper_enabled();
+
+void reaper_add(const char *fname);
+
+void reaper_run();
+
+/* peek.c */
+void peek_init(struct Peek *p);
+
+void peek_free(struct Peek *p);
+
+void peek_add(struct Peek *p, int size, const char *data, int len);
+
+int peek_last(const struct Peek *p, int n, char *out);
+
+/* grep.c */
+int c_grep();
+
+/* session.c */
+void c_session();
+
+/* stats.c */
+void s_stats(int s, enum StatsBy by, enum ListFormat format);
+
+/* estimate.c */
+void estimate_attach(struct Job *p);
+
+void estimate_learn(const struct Job *p);
+
+void estimate_release(struct Job *p);
+
+float estimate_of(const struct Job *p);
+
+/* history.c */
+void s_history_add(const struct Job *p);
+
+void history_each(void (*fn)(const struct Job *p, void *data), void *data);
+
+void c_history();
+
+/* snapshot.c */
+void snapshot_open(const char *socket_path);
+
+void snapshot_close();
+
+void snapshot_begin();
+
+void snapshot_add_job(const struct Job *p);
+
+void snapshot_commit(int last_id, int last_jobid);
+
+int c_snapshot_query();
+
+/* timeindex.c */
+struct TimeIndex;
+
+struct TimeIndex *tindex_create(const char *ofname);
+
+void tindex_add(struct TimeIndex *t, const char *data, int len,
+                long long offset);
+
+void tindex_close(struct TimeIndex *t);
+
+int tindex_lookup(const char *ofname, time_t since, time_t until,
+                  off_t *start, off_t *end);
+
+/* compress.c */
+enum Compression compress_default();
+
+int zframes_write_header(int fd, enum Compression c);
+
+int zframes_write(int fd, enum Compression c, int level, const char *buf,
+                  int len);
+
+enum Compression zframes_check(int fd);
+
+int zframes_read_header(int fd, off_t off, unsigned int *raw_len,
+                        unsigned int *comp_len);
+
+char *zframes_decode(int fd, enum Compression c, off_t off,
+                     unsigned int raw_len, unsigned int comp_len);
+
 /* client_run.c */
 void c_run_tail(const char *filename);
 
@@ -457,6 +827,30 @@ void block_sigint();
 
 void unblock_sigint_and_install_handler();
 
+/* libts.c, the protocol for ts too */
+
+/* What libts passes to ts --libts-runner along the connection of a job.
+ * The arguments of the command and the label follow. */
+struct RunnerJob {
+    int jobid;
+    int argc;
+    int args_size; /* Each argument ended by '\0' */
+    int label_size;
+};
+
+int libts_write_all(int fd, const void *data, size_t len);
+
+int libts_read_all(int fd, void *data, size_t len);
+
+int libts_check_version(int s, int *version);
+
+int libts_send_newjob(int s, const struct Msg *m, const int *gpus,
+                      const int *depend_on, const char *command,
+                      const char *label, const char *env, const char *pool);
+
+int libts_recv_runner_job(int runner, struct RunnerJob *rj, char **args,
+                          char **label);
+
 /* msg.c */
 void send_bytes(int fd, const char *data, int bytes);
 
@@ -470,6 +864,10 @@ void send_ints(int fd, const int *data, int num);
 
 int *recv_ints(int fd, int *num);
 
+void send_fd(int fd, int passed);
+
+int recv_fd(int fd);
+
 /* msgdump.c */
 void msgdump(FILE *, const struct Msg *m);
 
@@ -504,14 +902,6 @@ char *ints_to_chars(int *array, int n, const char *delim);
 
 /* info.c */
 
-void pinfo_dump(const struct Procinfo *p, int fd);
-
-void pinfo_addinfo(struct Procinfo *p, int maxsize, const char *line, ...);
-
-void pinfo_free(struct Procinfo *p);
-
-int pinfo_size(const struct Procinfo *p);
-
 void pinfo_set_enqueue_time(struct Procinfo *p);
 
 void pinfo_set_start_time(struct Procinfo *p);
@@ -520,16 +910,72 @@ void pinfo_set_end_time(struct Procinfo *p);
 
 float pinfo_time_until_now(const struct Procinfo *p);
 
+float pinfo_time_queued(const struct Procinfo *p);
+
 float pinfo_time_run(const struct Procinfo *p);
 
 void pinfo_init(struct Procinfo *p);
 
+/* blob.c */
+char *blob_take(char *str);
+
+void blob_release(char *str);
+
+void blob_stats(int *count, long *bytes, long *uses);
+
+/* hash.c */
+unsigned int hash_string(const char *str);
+
+struct HashEntry *hash_bucket(const struct HashTable *t, unsigned int hash);
+
+void hash_insert(struct HashTable *t, struct HashEntry *e);
+
+void hash_remove(struct HashTable *t, struct HashEntry *e);
+
+/* slab.c */
+void *slab_alloc(struct Slab *s);
+
+void slab_free(struct Slab *s, void *record);
+
+long slab_bytes(const struct Slab *s);
+
+int slab_capacity(const struct Slab *s);
+
 /* env.c */
 char *get_environment();
 
+int env_cache_ttl();
+
+void env_cache_key(char *key);
+
+int c_env_cached(const char *key, int ttl);
+
+struct SharedEnv *s_env_store(const char *key, int ttl, char *text);
+
+struct SharedEnv *s_env_cached(const char *key);
+
+void s_env_release(struct SharedEnv *e);
+
+void s_ask_env_cache(int s, const char *key, int ttl);
+
+void s_env_init(const char *socket_path);
+
+void s_env_spill(struct SharedEnv *e);
+
+void s_env_dump(int fd, const struct SharedEnv *e);
+
+void s_env_end();
+
 /* tail.c */
+const char *last_newline(const char *buf, size_t len);
+
+int skip_length(int *skip, const char *data, int len);
+
 int tail_file(const char *fname, int last_lines);
 
+int tail_many(char **fnames, const int *jobids, const int *sockets, int num,
+              int last_lines, int head_lines);
+
 #ifndef CPU
 /* gpu.c */
 int *getGpuList(int *num);
@@ -89,10 +89,52 @@ int main() {
                      "for the new task will be output to stdout.\n"
                      ".TP\n"
                      ".B \"\\-z\"\n"
-                     "Pass the output through gzip (only if\n"
+                     "Compress the stored output (only if not\n"
                      ".B \\-n\n"
-                     "). Note that the output files will not\n"
-                     "have a .gz extension.\n"
+                     "). It is compressed by ts itself, with zstd or zlib, in independent frames,\n"
+                     "so \\fB\\-t\\fR and \\fB\\-c\\fR can show it while the job runs. If ts was built\n"
+                     "without them, the output is passed through gzip. Note that the output files\n"
+                     "will not have a .gz extension.\n"
+                     ".TP\n"
+                     ".B \"\\--zlevel [num]\"\n"
+                     "Like \\fB\\-z\\fR, using the given compression level.\n"
+                     ".TP\n"
+                     ".B \"\\--max-output [size]\"\n"
+                     "Limit the size of the output file of the job, given in bytes or with a\n"
+                     "k, M or G suffix. What happens at the limit depends on \\fB\\--output-policy\\fR.\n"
+                     "The default comes from \\fBTS_MAXOUTPUT\\fR.\n"
+                     ".TP\n"
+                     ".B \"\\--output-policy [policy]\"\n"
+                     "\\fBrotate[:num]\\fR moves the output to \\fIfile.1\\fR, keeping num old files\n"
+                     "(1 by default), and goes on in a new file. \\fBring\\fR keeps only the last part\n"
+                     "of the output, and cannot be used with \\fB\\-z\\fR. \\fBkill\\fR sends SIGTERM to the\n"
+                     "job. The default comes from \\fBTS_OUTPUTPOLICY\\fR, or is rotate.\n"
+                     ".TP\n"
+                     ".B \"\\--time-index\"\n"
+                     "Write along the output file an index of the time each line was written, in\n"
+                     "\\fIfile.idx\\fR, so \\fB\\--since\\fR and \\fB\\--between\\fR find the lines without\n"
+                     "reading the whole output. It needs a plain output: not with \\fB\\-z\\fR, nor with\n"
+                     "the rotate or ring output policies.\n"
+                     ".TP\n"
+                     ".B \"\\--stdin-from [id]\"\n"
+                     "Give the output of the named job as the standard input of the new one. The new job\n"
+                     "waits in the queue until that job runs, and then both run at the same time: if it\n"
+                     "was queued before that job started, it gets the output straight from its runner,\n"
+                     "from the start; otherwise it follows the output file, as \\fB\\-c\\fR. The command\n"
+                     "line at the start of the output is not passed.\n"
+                     ".TP\n"
+                     ".B \"\\--deadline [time]\"\n"
+                     "When the job should end, as the times of \\fB\\--since\\fR, the relative ones counting\n"
+                     "from now on (\\fB2h\\fR). It orders the queue for \\fBTS_POLICY=edf\\fR, and \\fB\\-i\\fR\n"
+                     "shows it. Nothing is done when it passes.\n"
+                     ".TP\n"
+                     ".B \"\\--pool [name]\"\n"
+                     "Run the job in an idle worker of the pool (see \\fB\\--pool-start\\fR) instead of\n"
+                     "a new process, so it does not pay for the start of the interpreter. The job waits\n"
+                     "in the queue for a worker, taking its slots as any job. Its output is stored as\n"
+                     "usual, with stderr along stdout. The job gets neither its environment nor its\n"
+                     "standard input, and its user and system times are not measured. If the pool does\n"
+                     "not exist, the job runs as any other.\n"
                      ".TP\n"
                      ".B \"\\-f\"\n"
                      "Do not put the task into the background. Wait for the command to run without\n"
@@ -203,6 +245,8 @@ int main() {
                      "This is the default behaviour if\n"
                      ".B ts\n"
                      "is called without options.\n"
+                     "For the queued and running jobs, the Time column shows, after a ~, the time left\n"
+                     "until they are expected to end, from the run times of the past jobs alike.\n"
                      ".TP\n"
                      ".B \"\\-M/--serialize [format]\"\n"
                      "Serialize the job list to the specified format. Choices: {default, json, tab}.\n"
@@ -240,6 +284,100 @@ int main() {
                      "sent to standard output, and will exit with the job errorlevel as in\n"
                      "\\fB\\-c\\fR.\n"
                      ".TP\n"
+                     ".B \"\\--follow-many [id,...]\"\n"
+                     "Like \\fB\\-t\\fR, but follows the outputs of all the given jobs at once,\n"
+                     "printing a header whenever the output switches from one job to another.\n"
+                     "It returns the last non-zero errorlevel of the jobs.\n"
+                     ".TP\n"
+                     ".B \"\\--grep [pattern] [id...]\"\n"
+                     "Show the lines of the job outputs matching the pattern, each with the job id in\n"
+                     "front, in job order. The outputs are scanned in parallel, compressed ones too.\n"
+                     "A pattern with any of the characters \\fB.[]()*+?{}|^$\\\\\\fR is an extended\n"
+                     "regular expression; otherwise it is looked for as it is. Without ids (as\n"
+                     "\\fB3\\fR, \\fB5-9\\fR or \\fB1,4\\fR), it looks at all the jobs, or those with the label\n"
+                     "of \\fB\\-L\\fR and the state of \\fB\\--state\\fR (queued, running, finished, ...).\n"
+                     "It returns 0 if some line matched, and 1 otherwise.\n"
+                     ".TP\n"
+                     ".B \"\\--peek [id|all]\"\n"
+                     "Show the last output of a running job, or of all of them, as the server keeps it\n"
+                     "in memory for the jobs queued without \\fBTS_PEEKSIZE\\fR=0. It does not touch the\n"
+                     "output files, and works for the jobs queued with \\fB\\-n\\fR too. It fails for a job\n"
+                     "not running, or not keeping its output.\n"
+                     ".TP\n"
+                     ".B \"\\--session\"\n"
+                     "Read requests from standard input, one per line as the options of ts (\\fB\\-l\\fR,\n"
+                     "\\fB\\-M json\\fR, \\fB\\-s [id]\\fR, \\fB\\-i [id]\\fR, \\fB\\-q\\fR, \\fB\\-R\\fR, \\fB\\-S [num]\\fR,\n"
+                     "\\fB\\-o [id]\\fR, \\fB\\-p [id]\\fR, \\fB\\-F [id]\\fR and \\fB\\-r [id]\\fR), and answer them all\n"
+                     "through a single connection to the server. The lines at hand are sent together,\n"
+                     "and each answer is written as a line with \\fBok\\fR or \\fBerror\\fR and the\n"
+                     "number of bytes that follow it.\n"
+                     ".TP\n"
+                     ".B \"\\--watch [id...]\"\n"
+                     "Show the events of the jobs as the server sees them, one JSON object per line:\n"
+                     "\\fBqueued\\fR, \\fBstarted\\fR, \\fBfinished\\fR, \\fBskipped\\fR and \\fBremoved\\fR, with\n"
+                     "the fields of \\fB\\-M json\\fR, and the exit code and times when the job ends.\n"
+                     "The jobs can be chosen with \\fB\\-L\\fR and with ids (as \\fB3\\fR, \\fB5-9\\fR or\n"
+                     "\\fB1,4\\fR). With ids, it ends once all of them have ended, those already\n"
+                     "finished included, and returns the last non-zero exit code among them, as a\n"
+                     "single \\fB\\-w\\fR for many jobs.\n"
+                     ".TP\n"
+                     ".B \"\\--pool-start [name] [num] [cmd...]\"\n"
+                     "Start a pool of num warm workers, for the jobs queued with \\fB\\--pool\\fR. Each\n"
+                     "worker runs cmd through \\fIsh -c\\fR, started by the server, in its directory and\n"
+                     "environment. A worker reads a job from its standard input as a line with the\n"
+                     "job id, the working directory of the job and the words of the command, separated\n"
+                     "by tabs; it writes the output of the job to its standard output or error, and\n"
+                     "ends it with a line \\fB#ts-done [exit code]\\fR. Then it waits for the next line.\n"
+                     "What it writes while idle may go to the output of its next job. A worker that\n"
+                     "ends is started again for the next job. \\fB\\-p\\fR shows the worker running\n"
+                     "the job, so \\fB\\-k\\fR stops it, and it gets replaced.\n"
+                     ".TP\n"
+                     ".B \"\\--pool-stop [name]\"\n"
+                     "Stop the workers of the pool. Those running a job stop when it ends. The jobs\n"
+                     "still queued for the pool run as any other.\n"
+                     ".TP\n"
+                     ".B \"\\--pools\"\n"
+                     "Show the pools, with their number of workers, how many run a job, and the\n"
+                     "command of the workers.\n"
+                     ".TP\n"
+                     ".B \"\\--mem-stats\"\n"
+                     "Show the memory the server uses for its jobs: the job records, the strings\n"
+                     "kept once for all the jobs that have them (commands, labels, TS_ENV outputs),\n"
+                     "the dependency lists, the output file names and the last outputs for --peek.\n"
+                     ".TP\n"
+                     ".B \"\\--history\"\n"
+                     "Show the finished jobs in the history file of \\fBTS_HISTORY\\fR, with the time they\n"
+                     "ended. It reads the file, without the server. With \\fB\\-L [label]\\fR, only the jobs\n"
+                     "with that label; with \\fB\\--since [time]\\fR, only those ended at that time or later;\n"
+                     "with \\fB\\--failed\\fR, only those that ended with an error or killed.\n"
+                     ".TP\n"
+                     ".B \"\\--stats [--by label|state|exit]\"\n"
+                     "Show, for the finished jobs in the server and in the history of \\fBTS_HISTORY\\fR,\n"
+                     "how many there are and failed, and the total, mean, median and 95th percentile\n"
+                     "of their run time and of the time they waited queued, in seconds. With \\fB\\--by\\fR,\n"
+                     "in groups by label, state or exit code. The percentiles are within 3%%.\n"
+                     "With \\fB\\-M json\\fR, the groups come as a JSON array.\n"
+                     ".TP\n"
+                     ".B \"\\--lines [num]\"\n"
+                     "With \\fB\\-t\\fR, \\fB\\-c\\fR or \\fB\\--follow-many\\fR, start showing the output\n"
+                     "at its last num lines, instead of the last ten or all of them.\n"
+                     ".TP\n"
+                     ".B \"\\--head [num]\"\n"
+                     "With \\fB\\-t\\fR, \\fB\\-c\\fR or \\fB\\--follow-many\\fR, show only the first num\n"
+                     "lines of the output. If the job has not written them yet, it waits for them\n"
+                     "or for the job to end.\n"
+                     ".TP\n"
+                     ".B \"\\--since [time]\"\n"
+                     "With \\fB\\-t\\fR or \\fB\\-c\\fR, show the output of a job queued with\n"
+                     "\\fB\\--time-index\\fR from the lines written at that time on, and keep following it.\n"
+                     "The time can be relative to now (\\fB30s\\fR, \\fB10m\\fR, \\fB2h\\fR, \\fB1d\\fR), a time\n"
+                     "of today (\\fB13:45\\fR), a date (\\fB\"2024-05-01 13:45\"\\fR) or seconds since the epoch\n"
+                     "(\\fB@1714567890\\fR).\n"
+                     ".TP\n"
+                     ".B \"\\--between [time] [time]\"\n"
+                     "Like \\fB\\--since\\fR, showing only the lines written between the two times, and\n"
+                     "without waiting for the job.\n"
+                     ".TP\n"
                      ".B \"\\-p [id]\"\n"
                      "Show the pid of the named job, or the last running/run if not specified.\n"
                      ".TP\n"
@@ -255,6 +393,10 @@ int main() {
                      ".TP\n"
                      ".B \"\\-w [id]\"\n"
                      "Wait for the named job, or for the last in the queue.\n"
+                     "Many jobs can be given, as \\fB1,4,6-9\\fR, or those in the queue with a label\n"
+                     "with \\fB\\-w \\-\\-label L\\fR, or all those in the queue with \\fB\\-w \\-\\-all\\fR.\n"
+                     "A single answer comes once all of them have ended, with the last non-zero\n"
+                     "exit code among them.\n"
                      ".TP\n"
                      ".B \"\\-k [id]\"\n"
                      "Kill the process group of the named job (SIGTERM),\n"
@@ -332,6 +474,17 @@ int main() {
                      ".B output_filename\n"
                      "and\n"
                      ".B command.\n"
+                     "It runs, as the mail of \\fB\\-m\\fR, once the server has the job ended, so the\n"
+                     "slot of the job is free for the next. \\fB\\-w\\fR does not wait for it.\n"
+                     ".TP\n"
+                     ".B \"TS_HOOKSLOTS\"\n"
+                     "How many \\fBTS_ONFINISH\\fR and mails of \\fB\\-m\\fR run at once, for all the jobs\n"
+                     "of the server; the others wait for their turn, in the order their jobs ended.\n"
+                     "It is read by the server, and is 4 by default.\n"
+                     ".TP\n"
+                     ".B \"TS_HOOKTIMEOUT\"\n"
+                     "Seconds after which \\fBTS_ONFINISH\\fR or the mail of a job get killed. By\n"
+                     "default they run until they end.\n"
                      ".TP\n"
                      ".B \"TMPDIR\"\n"
                      "As the program output and the unix socket are thought to be stored in a\n"
@@ -385,6 +538,61 @@ int main() {
                      "\\fB/bin/sh\\fR. The output of the command will be readable through the option\n"
                      "\\fB\\-i\\fR. You can use a command which shows relevant environment for the command run.\n"
                      "For example, you may use \\fBTS_ENV='pwd;set;mount'\\fR.\n"
+                     "The server keeps each different output once, for all the jobs with it.\n"
+                     "Once a job with it finished, a long output goes to a file next to the socket\n"
+                     "until the server forgets it, to keep long histories of finished jobs small.\n"
+                     ".TP\n"
+                     ".B \"TS_ENVTTL\"\n"
+                     "Seconds for which the server reuses the output of \\fBTS_ENV\\fR for the next jobs\n"
+                     "queued with the same \\fBTS_ENV\\fR, from the same directory and with the same\n"
+                     "environment, instead of running it again. By default it runs for every job.\n"
+                     ".TP\n"
+                     ".B \"TS_HISTORY\"\n"
+                     "An absolute path. The finished jobs the server forgets (because of\n"
+                     "\\fBTS_MAXFINISHED\\fR or \\fB\\-C\\fR, or as it ends) get appended there, with their\n"
+                     "strings in the file with \".strings\" added, for \\fB\\--history\\fR. Set it the same\n"
+                     "for the server and the clients. Nothing removes old jobs from it.\n"
+                     ".TP\n"
+                     ".B \"TS_MAXOUTPUT\"\n"
+                     "Default limit of the size of the output files, as in \\fB\\--max-output\\fR.\n"
+                     ".TP\n"
+                     ".B \"TS_OUTPUTPOLICY\"\n"
+                     "Default policy at the output limit, as in \\fB\\--output-policy\\fR.\n"
+                     ".TP\n"
+                     ".B \"TS_PEEKSIZE\"\n"
+                     "Bytes of the last output of each running job that the server keeps in memory,\n"
+                     "for \\fB\\--peek\\fR: 64k by default, and 0 for none. A k or M suffix can be used, up\n"
+                     "to 1M. It is read when queuing a job, and makes the job output pass through ts,\n"
+                     "also for \\fB\\-n\\fR.\n"
+                     ".TP\n"
+                     ".B \"TS_POLICY\"\n"
+                     "Order in which the server runs the queued jobs. \\fBfifo\\fR (the default) runs\n"
+                     "them as they were queued. \\fBsjf\\fR runs first those expected to be shorter, and\n"
+                     "\\fBedf\\fR those with the earliest \\fB\\--deadline\\fR, the jobs without one last.\n"
+                     "The run times expected are moving averages of the past runs of the same command,\n"
+                     "its numbers aside, or else of the same label, also learnt from \\fBTS_HISTORY\\fR.\n"
+                     "The jobs waiting for others still wait for them. It is read each time a job is chosen.\n"
+                     ".TP\n"
+                     ".B \"TS_LOGLAYOUT\"\n"
+                     "How the output files are placed in the log directory. \\fBflat\\fR (the default)\n"
+                     "puts them all there as \\fIts-out.XXXXXX\\fR. \\fBsharded\\fR names them after the job,\n"
+                     "in a directory per thousand jobs, as \\fIlogdir/12/12345.out\\fR. \\fBlabel\\fR is like\n"
+                     "sharded, in a directory per job label: \\fIlogdir/label/12/12345.out\\fR.\n"
+                     ".TP\n"
+                     ".B \"TS_REAPOUTPUT\"\n"
+                     "If it is 1 when starting the queue server, the server removes the output files of\n"
+                     "the finished jobs it forgets, because of \\fBTS_MAXFINISHED\\fR or \\fB\\-C\\fR.\n"
+                     ".TP\n"
+                     ".B \"TS_SNAPSHOT\"\n"
+                     "The server keeps the state of the queue in the file of its socket name with\n"
+                     "\\fI.snap\\fR appended, and \\fB\\-l\\fR, \\fB\\-s\\fR, \\fB\\-q\\fR, \\fB\\-R\\fR and \\fB\\-S\\fR read it\n"
+                     "there, without waiting for the server. If this is 0, they ask the server.\n"
+                     ".TP\n"
+                     ".B \"TS_SPAWN\"\n"
+                     "The job is started with \\fBposix_spawn\\fR(3), with its output prepared by ts,\n"
+                     "where the system has it with new sessions. If this is 0 when queuing the job,\n"
+                     "ts forks and prepares the output in the child, as before. \\fIbenchmark.sh\\fR in\n"
+                     "the sources compares both.\n"
                      ".SH FILES\n"
                      ".TP\n"
                      ".B /tmp/ts.error\n"
@@ -488,10 +696,52 @@ int main() {
                      "for the new task will be output to stdout.\n"
                      ".TP\n"
                      ".B \"\\-z\"\n"
-                     "Pass the output through gzip (only if\n"
+                     "Compress the stored output (only if not\n"
                      ".B \\-n\n"
-                     "). Note that the output files will not\n"
-                     "have a .gz extension.\n"
+                     "). It is compressed by ts itself, with zstd or zlib, in independent frames,\n"
+                     "so \\fB\\-t\\fR and \\fB\\-c\\fR can show it while the job runs. If ts was built\n"
+                     "without them, the output is passed through gzip. Note that the output files\n"
+                     "will not have a .gz extension.\n"
+                     ".TP\n"
+                     ".B \"\\--zlevel [num]\"\n"
+                     "Like \\fB\\-z\\fR, using the given compression level.\n"
+                     ".TP\n"
+                     ".B \"\\--max-output [size]\"\n"
+                     "Limit the size of the output file of the job, given in bytes or with a\n"
+                     "k, M or G suffix. What happens at the limit depends on \\fB\\--output-policy\\fR.\n"
+                     "The default comes from \\fBTS_MAXOUTPUT\\fR.\n"
+                     ".TP\n"
+                     ".B \"\\--output-policy [policy]\"\n"
+                     "\\fBrotate[:num]\\fR moves the output to \\fIfile.1\\fR, keeping num old files\n"
+                     "(1 by default), and goes on in a new file. \\fBring\\fR keeps only the last part\n"
+                     "of the output, and cannot be used with \\fB\\-z\\fR. \\fBkill\\fR sends SIGTERM to the\n"
+                     "job. The default comes from \\fBTS_OUTPUTPOLICY\\fR, or is rotate.\n"
+                     ".TP\n"
+                     ".B \"\\--time-index\"\n"
+                     "Write along the output file an index of the time each line was written, in\n"
+                     "\\fIfile.idx\\fR, so \\fB\\--since\\fR and \\fB\\--between\\fR find the lines without\n"
+                     "reading the whole output. It needs a plain output: not with \\fB\\-z\\fR, nor with\n"
+                     "the rotate or ring output policies.\n"
+                     ".TP\n"
+                     ".B \"\\--stdin-from [id]\"\n"
+                     "Give the output of the named job as the standard input of the new one. The new job\n"
+                     "waits in the queue until that job runs, and then both run at the same time: if it\n"
+                     "was queued before that job started, it gets the output straight from its runner,\n"
+                     "from the start; otherwise it follows the output file, as \\fB\\-c\\fR. The command\n"
+                     "line at the start of the output is not passed.\n"
+                     ".TP\n"
+                     ".B \"\\--deadline [time]\"\n"
+                     "When the job should end, as the times of \\fB\\--since\\fR, the relative ones counting\n"
+                     "from now on (\\fB2h\\fR). It orders the queue for \\fBTS_POLICY=edf\\fR, and \\fB\\-i\\fR\n"
+                     "shows it. Nothing is done when it passes.\n"
+                     ".TP\n"
+                     ".B \"\\--pool [name]\"\n"
+                     "Run the job in an idle worker of the pool (see \\fB\\--pool-start\\fR) instead of\n"
+                     "a new process, so it does not pay for the start of the interpreter. The job waits\n"
+                     "in the queue for a worker, taking its slots as any job. Its output is stored as\n"
+                     "usual, with stderr along stdout. The job gets neither its environment nor its\n"
+                     "standard input, and its user and system times are not measured. If the pool does\n"
+                     "not exist, the job runs as any other.\n"
                      ".TP\n"
                      ".B \"\\-f\"\n"
                      "Do not put the task into the background. Wait for the command to run without\n"
@@ -590,6 +840,8 @@ int main() {
                      "This is the default behaviour if\n"
                      ".B ts\n"
                      "is called without options.\n"
+                     "For the queued and running jobs, the Time column shows, after a ~, the time left\n"
+                     "until they are expected to end, from the run times of the past jobs alike.\n"
                      ".TP\n"
                      ".B \"\\-M/--serialize [format]\"\n"
                      "Serialize the job list to the specified format. Choices: {default, json, tab}.\n"
@@ -624,6 +876,100 @@ int main() {
                      "sent to standard output, and will exit with the job errorlevel as in\n"
                      "\\fB\\-c\\fR.\n"
                      ".TP\n"
+                     ".B \"\\--follow-many [id,...]\"\n"
+                     "Like \\fB\\-t\\fR, but follows the outputs of all the given jobs at once,\n"
+                     "printing a header whenever the output switches from one job to another.\n"
+                     "It returns the last non-zero errorlevel of the jobs.\n"
+                     ".TP\n"
+                     ".B \"\\--grep [pattern] [id...]\"\n"
+                     "Show the lines of the job outputs matching the pattern, each with the job id in\n"
+                     "front, in job order. The outputs are scanned in parallel, compressed ones too.\n"
+                     "A pattern with any of the characters \\fB.[]()*+?{}|^$\\\\\\fR is an extended\n"
+                     "regular expression; otherwise it is looked for as it is. Without ids (as\n"
+                     "\\fB3\\fR, \\fB5-9\\fR or \\fB1,4\\fR), it looks at all the jobs, or those with the label\n"
+                     "of \\fB\\-L\\fR and the state of \\fB\\--state\\fR (queued, running, finished, ...).\n"
+                     "It returns 0 if some line matched, and 1 otherwise.\n"
+                     ".TP\n"
+                     ".B \"\\--peek [id|all]\"\n"
+                     "Show the last output of a running job, or of all of them, as the server keeps it\n"
+                     "in memory for the jobs queued without \\fBTS_PEEKSIZE\\fR=0. It does not touch the\n"
+                     "output files, and works for the jobs queued with \\fB\\-n\\fR too. It fails for a job\n"
+                     "not running, or not keeping its output.\n"
+                     ".TP\n"
+                     ".B \"\\--session\"\n"
+                     "Read requests from standard input, one per line as the options of ts (\\fB\\-l\\fR,\n"
+                     "\\fB\\-M json\\fR, \\fB\\-s [id]\\fR, \\fB\\-i [id]\\fR, \\fB\\-q\\fR, \\fB\\-R\\fR, \\fB\\-S [num]\\fR,\n"
+                     "\\fB\\-o [id]\\fR, \\fB\\-p [id]\\fR, \\fB\\-F [id]\\fR and \\fB\\-r [id]\\fR), and answer them all\n"
+                     "through a single connection to the server. The lines at hand are sent together,\n"
+                     "and each answer is written as a line with \\fBok\\fR or \\fBerror\\fR and the\n"
+                     "number of bytes that follow it.\n"
+                     ".TP\n"
+                     ".B \"\\--watch [id...]\"\n"
+                     "Show the events of the jobs as the server sees them, one JSON object per line:\n"
+                     "\\fBqueued\\fR, \\fBstarted\\fR, \\fBfinished\\fR, \\fBskipped\\fR and \\fBremoved\\fR, with\n"
+                     "the fields of \\fB\\-M json\\fR, and the exit code and times when the job ends.\n"
+                     "The jobs can be chosen with \\fB\\-L\\fR and with ids (as \\fB3\\fR, \\fB5-9\\fR or\n"
+                     "\\fB1,4\\fR). With ids, it ends once all of them have ended, those already\n"
+                     "finished included, and returns the last non-zero exit code among them, as a\n"
+                     "single \\fB\\-w\\fR for many jobs.\n"
+                     ".TP\n"
+                     ".B \"\\--pool-start [name] [num] [cmd...]\"\n"
+                     "Start a pool of num warm workers, for the jobs queued with \\fB\\--pool\\fR. Each\n"
+                     "worker runs cmd through \\fIsh -c\\fR, started by the server, in its directory and\n"
+                     "environment. A worker reads a job from its standard input as a line with the\n"
+                     "job id, the working directory of the job and the words of the command, separated\n"
+                     "by tabs; it writes the output of the job to its standard output or error, and\n"
+                     "ends it with a line \\fB#ts-done [exit code]\\fR. Then it waits for the next line.\n"
+                     "What it writes while idle may go to the output of its next job. A worker that\n"
+                     "ends is started again for the next job. \\fB\\-p\\fR shows the worker running\n"
+                     "the job, so \\fB\\-k\\fR stops it, and it gets replaced.\n"
+                     ".TP\n"
+                     ".B \"\\--pool-stop [name]\"\n"
+                     "Stop the workers of the pool. Those running a job stop when it ends. The jobs\n"
+                     "still queued for the pool run as any other.\n"
+                     ".TP\n"
+                     ".B \"\\--pools\"\n"
+                     "Show the pools, with their number of workers, how many run a job, and the\n"
+                     "command of the workers.\n"
+                     ".TP\n"
+                     ".B \"\\--mem-stats\"\n"
+                     "Show the memory the server uses for its jobs: the job records, the strings\n"
+                     "kept once for all the jobs that have them (commands, labels, TS_ENV outputs),\n"
+                     "the dependency lists, the output file names and the last outputs for --peek.\n"
+                     ".TP\n"
+                     ".B \"\\--history\"\n"
+                     "Show the finished jobs in the history file of \\fBTS_HISTORY\\fR, with the time they\n"
+                     "ended. It reads the file, without the server. With \\fB\\-L [label]\\fR, only the jobs\n"
+                     "with that label; with \\fB\\--since [time]\\fR, only those ended at that time or later;\n"
+                     "with \\fB\\--failed\\fR, only those that ended with an error or killed.\n"
+                     ".TP\n"
+                     ".B \"\\--stats [--by label|state|exit]\"\n"
+                     "Show, for the finished jobs in the server and in the history of \\fBTS_HISTORY\\fR,\n"
+                     "how many there are and failed, and the total, mean, median and 95th percentile\n"
+                     "of their run time and of the time they waited queued, in seconds. With \\fB\\--by\\fR,\n"
+                     "in groups by label, state or exit code. The percentiles are within 3%%.\n"
+                     "With \\fB\\-M json\\fR, the groups come as a JSON array.\n"
+                     ".TP\n"
+                     ".B \"\\--lines [num]\"\n"
+                     "With \\fB\\-t\\fR, \\fB\\-c\\fR or \\fB\\--follow-many\\fR, start showing the output\n"
+                     "at its last num lines, instead of the last ten or all of them.\n"
+                     ".TP\n"
+                     ".B \"\\--head [num]\"\n"
+                     "With \\fB\\-t\\fR, \\fB\\-c\\fR or \\fB\\--follow-many\\fR, show only the first num\n"
+                     "lines of the output. If the job has not written them yet, it waits for them\n"
+                     "or for the job to end.\n"
+                     ".TP\n"
+                     ".B \"\\--since [time]\"\n"
+                     "With \\fB\\-t\\fR or \\fB\\-c\\fR, show the output of a job queued with\n"
+                     "\\fB\\--time-index\\fR from the lines written at that time on, and keep following it.\n"
+                     "The time can be relative to now (\\fB30s\\fR, \\fB10m\\fR, \\fB2h\\fR, \\fB1d\\fR), a time\n"
+                     "of today (\\fB13:45\\fR), a date (\\fB\"2024-05-01 13:45\"\\fR) or seconds since the epoch\n"
+                     "(\\fB@1714567890\\fR).\n"
+                     ".TP\n"
+                     ".B \"\\--between [time] [time]\"\n"
+                     "Like \\fB\\--since\\fR, showing only the lines written between the two times, and\n"
+                     "without waiting for the job.\n"
+                     ".TP\n"
                      ".B \"\\-p [id]\"\n"
                      "Show the pid of the named job, or the last running/run if not specified.\n"
                      ".TP\n"
@@ -639,6 +985,10 @@ int main() {
                      ".TP\n"
                      ".B \"\\-w [id]\"\n"
                      "Wait for the named job, or for the last in the queue.\n"
+                     "Many jobs can be given, as \\fB1,4,6-9\\fR, or those in the queue with a label\n"
+                     "with \\fB\\-w \\-\\-label L\\fR, or all those in the queue with \\fB\\-w \\-\\-all\\fR.\n"
+                     "A single answer comes once all of them have ended, with the last non-zero\n"
+                     "exit code among them.\n"
                      ".TP\n"
                      ".B \"\\-k [id]\"\n"
                      "Kill the process group of the named job (SIGTERM),\n"
@@ -712,6 +1062,17 @@ int main() {
                      ".B output_filename\n"
                      "and\n"
                      ".B command.\n"
+                     "It runs, as the mail of \\fB\\-m\\fR, once the server has the job ended, so the\n"
+                     "slot of the job is free for the next. \\fB\\-w\\fR does not wait for it.\n"
+                     ".TP\n"
+                     ".B \"TS_HOOKSLOTS\"\n"
+                     "How many \\fBTS_ONFINISH\\fR and mails of \\fB\\-m\\fR run at once, for all the jobs\n"
+                     "of the server; the others wait for their turn, in the order their jobs ended.\n"
+                     "It is read by the server, and is 4 by default.\n"
+                     ".TP\n"
+                     ".B \"TS_HOOKTIMEOUT\"\n"
+                     "Seconds after which \\fBTS_ONFINISH\\fR or the mail of a job get killed. By\n"
+                     "default they run until they end.\n"
                      ".TP\n"
                      ".B \"TMPDIR\"\n"
                      "As the program output and the unix socket are thought to be stored in a\n"
@@ -765,6 +1126,61 @@ int main() {
                      "\\fB/bin/sh\\fR. The output of the command will be readable through the option\n"
                      "\\fB\\-i\\fR. You can use a command which shows relevant environment for the command run.\n"
                      "For example, you may use \\fBTS_ENV='pwd;set;mount'\\fR.\n"
+                     "The server keeps each different output once, for all the jobs with it.\n"
+                     "Once a job with it finished, a long output goes to a file next to the socket\n"
+                     "until the server forgets it, to keep long histories of finished jobs small.\n"
+                     ".TP\n"
+                     ".B \"TS_ENVTTL\"\n"
+                     "Seconds for which the server reuses the output of \\fBTS_ENV\\fR for the next jobs\n"
+                     "queued with the same \\fBTS_ENV\\fR, from the same directory and with the same\n"
+                     "environment, instead of running it again. By default it runs for every job.\n"
+                     ".TP\n"
+                     ".B \"TS_HISTORY\"\n"
+                     "An absolute path. The finished jobs the server forgets (because of\n"
+                     "\\fBTS_MAXFINISHED\\fR or \\fB\\-C\\fR, or as it ends) get appended there, with their\n"
+                     "strings in the file with \".strings\" added, for \\fB\\--history\\fR. Set it the same\n"
+                     "for the server and the clients. Nothing removes old jobs from it.\n"
+                     ".TP\n"
+                     ".B \"TS_MAXOUTPUT\"\n"
+                     "Default limit of the size of the output files, as in \\fB\\--max-output\\fR.\n"
+                     ".TP\n"
+                     ".B \"TS_OUTPUTPOLICY\"\n"
+                     "Default policy at the output limit, as in \\fB\\--output-policy\\fR.\n"
+                     ".TP\n"
+                     ".B \"TS_PEEKSIZE\"\n"
+                     "Bytes of the last output of each running job that the server keeps in memory,\n"
+                     "for \\fB\\--peek\\fR: 64k by default, and 0 for none. A k or M suffix can be used, up\n"
+                     "to 1M. It is read when queuing a job, and makes the job output pass through ts,\n"
+                     "also for \\fB\\-n\\fR.\n"
+                     ".TP\n"
+                     ".B \"TS_POLICY\"\n"
+                     "Order in which the server runs the queued jobs. \\fBfifo\\fR (the default) runs\n"
+                     "them as they were queued. \\fBsjf\\fR runs first those expected to be shorter, and\n"
+                     "\\fBedf\\fR those with the earliest \\fB\\--deadline\\fR, the jobs without one last.\n"
+                     "The run times expected are moving averages of the past runs of the same command,\n"
+                     "its numbers aside, or else of the same label, also learnt from \\fBTS_HISTORY\\fR.\n"
+                     "The jobs waiting for others still wait for them. It is read each time a job is chosen.\n"
+                     ".TP\n"
+                     ".B \"TS_LOGLAYOUT\"\n"
+                     "How the output files are placed in the log directory. \\fBflat\\fR (the default)\n"
+                     "puts them all there as \\fIts-out.XXXXXX\\fR. \\fBsharded\\fR names them after the job,\n"
+                     "in a directory per thousand jobs, as \\fIlogdir/12/12345.out\\fR. \\fBlabel\\fR is like\n"
+                     "sharded, in a directory per job label: \\fIlogdir/label/12/12345.out\\fR.\n"
+                     ".TP\n"
+                     ".B \"TS_REAPOUTPUT\"\n"
+                     "If it is 1 when starting the queue server, the server removes the output files of\n"
+                     "the finished jobs it forgets, because of \\fBTS_MAXFINISHED\\fR or \\fB\\-C\\fR.\n"
+                     ".TP\n"
+                     ".B \"TS_SNAPSHOT\"\n"
+                     "The server keeps the state of the queue in the file of its socket name with\n"
+                     "\\fI.snap\\fR appended, and \\fB\\-l\\fR, \\fB\\-s\\fR, \\fB\\-q\\fR, \\fB\\-R\\fR and \\fB\\-S\\fR read it\n"
+                     "there, without waiting for the server. If this is 0, they ask the server.\n"
+                     ".TP\n"
+                     ".B \"TS_SPAWN\"\n"
+                     "The job is started with \\fBposix_spawn\\fR(3), with its output prepared by ts,\n"
+                     "where the system has it with new sessions. If this is 0 when queuing the job,\n"
+                     "ts forks and prepares the output in the child, as before. \\fIbenchmark.sh\\fR in\n"
+                     "the sources compares both.\n"
                      ".SH FILES\n"
                      ".TP\n"
                      ".B /tmp/ts.error\n"
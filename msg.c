@@ -10,49 +10,26 @@
 #include <sys/time.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 
 #include "main.h"
 
+/* The loops of libts.c, with warnings */
 void send_bytes(const int fd, const char *data, int bytes)
 {
-    int res;
-    int offset = 0;
-
-    while(1)
-    {
-        res = send(fd, data + offset, bytes, 0);
-        if(res == -1)
-        {
-            warning("Sending %i bytes to %i.", bytes, fd);
-            break;
-        }
-        if(res == bytes)
-            break;
-        offset += res;
-        bytes -= res;
-    }
+    if (libts_write_all(fd, data, bytes) == -1)
+        warning("Sending %i bytes to %i.", bytes, fd);
 }
 
+/* Returns bytes, or -1 */
 int recv_bytes(const int fd, char *data, int bytes)
 {
-    int res;
-    int offset = 0;
-
-    while(1)
+    if (libts_read_all(fd, data, bytes) == -1)
     {
-        res = recv(fd, data + offset, bytes, 0);
-        if(res == -1)
-        {
-            warning("Receiving %i bytes from %i.", bytes, fd);
-            break;
-        }
-        if(res == bytes)
-            break;
-        offset += res;
-        bytes -= res;
+        warning("Receiving %i bytes from %i.", bytes, fd);
+        return -1;
     }
-
-    return res;
+    return bytes;
 }
 
 void send_msg(const int fd, const struct Msg *m)
@@ -113,3 +90,63 @@ int *recv_ints(const int fd, int *num) {
     }
     return data;
 }
+
+/* Passes the descriptor 'passed' through the unix socket fd */
+void send_fd(const int fd, const int passed) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    char byte = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &passed, sizeof(int));
+
+    if (sendmsg(fd, &msg, 0) == -1)
+        warning("Sending a descriptor to %i.", fd);
+}
+
+/* Returns the descriptor passed with send_fd(), or -1 */
+int recv_fd(const int fd) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    char byte;
+    int passed = -1;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    if (recvmsg(fd, &msg, 0) != 1) {
+        warning("Receiving a descriptor from %i.", fd);
+        return -1;
+    }
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET
+        && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&passed, CMSG_DATA(cmsg), sizeof(int));
+    return passed;
+}
@@ -0,0 +1,587 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2009  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+#include "main.h"
+
+/* The job runner stays between the job and its output file, when the output
+ * has to be processed on its way (compression, size limit, time index, the
+ * last output for ts --peek, other jobs taking it as input). The job writes
+ * to a pipe, and this copies it into the file, or to our stdout for the
+ * outputs not stored. */
+
+enum
+{
+    FLUSH_MS = 1000, /* Max time the output waits to reach the file */
+    RING_CHUNK = 64 * 1024 /* Bytes moved at once on a ring cut */
+};
+
+struct Output
+{
+    const char *ofname;
+    int fd;
+    int pid;
+    enum Compression comp;
+    int level;
+    char *buf;
+    int len;
+    struct timeval flush_time; /* When the buffered data has to be written */
+    long long size; /* Bytes in the file */
+    long long max;  /* 0 if not limited */
+    enum OutputPolicy policy;
+    int killed; /* We killed the job, the rest of the output is dropped */
+    struct TimeIndex *tindex; /* NULL if not indexed */
+    struct Peek peek; /* Last output, for the server */
+    int peek_new; /* Bytes in peek not sent yet */
+    struct timeval peek_time; /* When they have to be sent */
+    int *consumers; /* Input pipes of the jobs with --stdin-from us */
+    int nconsumers;
+    int listening; /* The server may send us more consumers */
+    long long data_start; /* Bytes of the command line, before the output */
+};
+
+/* Whether the job output has to pass through output_supervise() */
+int output_supervised()
+{
+    if (command_line.peek_size > 0 || command_line.stream_output)
+        return 1;
+    if (!command_line.store_output)
+        return 0;
+    return command_line.max_output > 0 || command_line.time_index
+        || output_compression() != COMPRESS_NONE;
+}
+
+enum Compression output_compression()
+{
+    if (!command_line.gzip)
+        return COMPRESS_NONE;
+    return compress_default();
+}
+
+static long ms_until(const struct timeval *t)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (t->tv_sec - now.tv_sec) * 1000
+        + (t->tv_usec - now.tv_usec) / 1000;
+}
+
+static void peek_add_output(struct Output *o, const char *data, int len)
+{
+    if (command_line.peek_size <= 0)
+        return;
+    if (o->peek_new == 0)
+    {
+        gettimeofday(&o->peek_time, NULL);
+        o->peek_time.tv_usec += PEEK_MS * 1000;
+        if (o->peek_time.tv_usec >= 1000000)
+        {
+            o->peek_time.tv_sec += 1;
+            o->peek_time.tv_usec -= 1000000;
+        }
+    }
+    peek_add(&o->peek, command_line.peek_size, data, len);
+    o->peek_new += len;
+}
+
+/* Sends to the server the output got since the last time, as much as it
+ * keeps. At most every PEEK_MS, so a chatty job does not load the server. */
+static void peek_send(struct Output *o)
+{
+    struct Msg m = default_msg();
+    char *buf;
+
+    if (o->peek_new == 0)
+        return;
+    buf = (char *) malloc(o->peek.size);
+    if (buf == NULL)
+        return;
+    m.type = PEEK_DATA;
+    m.u.peek.size = peek_last(&o->peek, o->peek_new, buf);
+    m.u.peek.ring_size = o->peek.size;
+    send_msg(server_socket, &m);
+    send_bytes(server_socket, buf, m.u.peek.size);
+    free(buf);
+    o->peek_new = 0;
+}
+
+static int write_all(int fd, const char *buf, int len)
+{
+    while(len > 0)
+    {
+        int res;
+        res = write(fd, buf, len);
+        if (res == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += res;
+        len -= res;
+    }
+    return 0;
+}
+
+/* name.N, or name itself for N == 0 */
+static char *segment_name(const char *ofname, int n)
+{
+    char *name;
+
+    name = (char *) malloc(strlen(ofname) + 12);
+    if (n == 0)
+        strcpy(name, ofname);
+    else
+        sprintf(name, "%s.%i", ofname, n);
+    return name;
+}
+
+/* Moves the output into ofname.1, ofname.1 into ofname.2, and so on,
+ * dropping the oldest, and starts a new file */
+static void output_rotate(struct Output *o)
+{
+    char *newname;
+    int i;
+
+    /* The new file appears under the name with its header already there,
+     * so the followers never see it empty */
+    newname = (char *) malloc(strlen(o->ofname) + 5);
+    sprintf(newname, "%s.new", o->ofname);
+    close(o->fd);
+    o->fd = open(newname, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (o->fd == -1)
+        error("Cannot open the output file %s", newname);
+    o->size = 0;
+    if (o->comp != COMPRESS_NONE)
+    {
+        zframes_write_header(o->fd, o->comp);
+        o->size = ZHEADER_SIZE;
+    }
+
+    for(i = command_line.output_segments; i > 0; --i)
+    {
+        char *from = segment_name(o->ofname, i - 1);
+        char *to = segment_name(o->ofname, i);
+        rename(from, to);
+        free(from);
+        free(to);
+    }
+    rename(newname, o->ofname);
+    free(newname);
+}
+
+/* Keep about the last half of the allowed size, from a line start */
+static void output_ring_cut(struct Output *o)
+{
+    char buf[RING_CHUNK];
+    off_t start = o->size - o->max / 2;
+    off_t from = start;
+    off_t to = 0;
+    char *nl = NULL;
+    ssize_t res = 0;
+
+    /* After the first newline, if there is any */
+    while(nl == NULL && from < o->size)
+    {
+        res = pread(o->fd, buf, sizeof buf, from);
+        if (res <= 0)
+            return;
+        nl = (char *) memchr(buf, '\n', res);
+        from += nl == NULL ? res : nl + 1 - buf;
+    }
+    if (nl == NULL)
+        from = start;
+
+    /* Move the tail to the start, a chunk at a time. The chunk read is
+     * always ahead of the one written. */
+    while(from < o->size)
+    {
+        size_t len = sizeof buf;
+
+        if (o->size - from < (off_t) len)
+            len = o->size - from;
+        res = pread(o->fd, buf, len, from);
+        if (res <= 0 || pwrite(o->fd, buf, res, to) != res)
+            break;
+        from += res;
+        to += res;
+    }
+
+    /* If the move failed half way, the start got overwritten anyway */
+    if (ftruncate(o->fd, to) == 0)
+    {
+        o->size = to;
+        lseek(o->fd, to, SEEK_SET);
+    }
+}
+
+static void output_kill(struct Output *o)
+{
+    char note[100];
+    int len;
+
+    len = snprintf(note, sizeof note,
+            "\n[ts] The output reached its limit of %lli bytes."
+            " Killing the job.\n", o->max);
+    if (o->comp == COMPRESS_NONE)
+        write_all(o->fd, note, len);
+    else
+        zframes_write(o->fd, o->comp, o->level, note, len);
+    kill(-o->pid, SIGTERM);
+    o->killed = 1;
+}
+
+/* Writes the plain output into the file, within the limits */
+static void output_put(struct Output *o, const char *data, int len)
+{
+    while(len > 0 && !o->killed)
+    {
+        int chunk = len;
+
+        if (o->max > 0 && o->policy != OUTPUT_RING
+            && o->size + chunk > o->max)
+        {
+            chunk = o->max > o->size ? o->max - o->size : 0;
+            if (chunk == 0)
+            {
+                if (o->policy == OUTPUT_KILL)
+                    output_kill(o);
+                else
+                    output_rotate(o);
+                continue;
+            }
+        }
+
+        if (write_all(o->fd, data, chunk) == -1)
+            warning("Cannot write the output");
+        o->size += chunk;
+        data += chunk;
+        len -= chunk;
+
+        if (o->policy == OUTPUT_RING && o->max > 0 && o->size > o->max)
+            output_ring_cut(o);
+    }
+}
+
+static void output_flush(struct Output *o)
+{
+    int res;
+
+    if (o->len == 0)
+        return;
+    /* A frame cannot be split, so the file goes over the limit by a frame
+     * at most. Rotate only when there is something for the new file. */
+    if (o->max > 0 && o->size >= o->max && o->policy == OUTPUT_ROTATE)
+        output_rotate(o);
+    res = zframes_write(o->fd, o->comp, o->level, o->buf, o->len);
+    o->len = 0;
+    if (res == -1)
+    {
+        warning("Cannot write the compressed output");
+        return;
+    }
+    o->size += res;
+    if (o->max > 0 && o->size >= o->max && o->policy == OUTPUT_KILL)
+        output_kill(o);
+}
+
+static void output_add(struct Output *o, const char *data, int len)
+{
+    if (o->killed)
+        return;
+    if (o->comp == COMPRESS_NONE)
+    {
+        if (o->tindex != NULL)
+            tindex_add(o->tindex, data, len, o->size);
+        output_put(o, data, len);
+        return;
+    }
+
+    while(len > 0)
+    {
+        int room = ZFRAME_SIZE - o->len;
+        int chunk = len < room ? len : room;
+
+        if (o->len == 0)
+        {
+            gettimeofday(&o->flush_time, NULL);
+            o->flush_time.tv_sec += FLUSH_MS / 1000;
+        }
+        memcpy(o->buf + o->len, data, chunk);
+        o->len += chunk;
+        data += chunk;
+        len -= chunk;
+        if (o->len == ZFRAME_SIZE)
+            output_flush(o);
+    }
+}
+
+/* Writes to a new consumer what the job wrote before it came, from the
+ * output file. Returns -1 if the consumer is gone. */
+static int output_replay(struct Output *o, int fd)
+{
+    unsigned int raw_len, comp_len;
+    char *buf;
+    off_t off;
+    long long skip;
+    int rfd;
+    int res = 0;
+
+    if (o->ofname == NULL)
+        return 0; /* Not kept */
+    rfd = open(o->ofname, O_RDONLY);
+    if (rfd == -1)
+        return 0;
+
+    if (o->comp == COMPRESS_NONE)
+    {
+        ssize_t len;
+
+        buf = (char *) malloc(ZFRAME_SIZE);
+        off = o->data_start;
+        while(res == 0 && (len = pread(rfd, buf, ZFRAME_SIZE, off)) > 0)
+        {
+            res = write_all(fd, buf, len);
+            off += len;
+        }
+        free(buf);
+    }
+    else
+    {
+        /* The frames in the buffer have to be in the file */
+        output_flush(o);
+        off = ZHEADER_SIZE;
+        skip = o->data_start;
+        while(res == 0
+              && zframes_read_header(rfd, off, &raw_len, &comp_len) == 1)
+        {
+            buf = zframes_decode(rfd, o->comp, off, raw_len, comp_len);
+            if (buf == NULL)
+                break;
+            if (raw_len > skip)
+                res = write_all(fd, buf + skip, raw_len - skip);
+            skip = raw_len > skip ? 0 : skip - raw_len;
+            free(buf);
+            off += ZFRAME_HEADER_SIZE + comp_len;
+        }
+    }
+    close(rfd);
+    return res;
+}
+
+static void output_add_consumer(struct Output *o, int fd)
+{
+    if (output_replay(o, fd) == -1)
+    {
+        close(fd);
+        return;
+    }
+    o->consumers = (int *) realloc(o->consumers,
+            (o->nconsumers + 1) * sizeof(int));
+    o->consumers[o->nconsumers++] = fd;
+}
+
+/* A message from the server: a consumer for our output, or the answer
+ * to STREAM_END. Returns 0 on STREAM_END_OK or if the server is gone. */
+static int output_server_msg(struct Output *o)
+{
+    struct Msg m = default_msg();
+    int fd;
+
+    if (recv_msg(server_socket, &m) != sizeof(m))
+        return 0;
+    if (m.type == STREAM_END_OK)
+        return 0;
+    if (m.type == CONSUMER_PIPE)
+    {
+        fd = recv_fd(server_socket);
+        if (fd != -1)
+            output_add_consumer(o, fd);
+    }
+    else
+        warning("Unexpected message %i while running the job", m.type);
+    return 1;
+}
+
+static void output_feed_consumers(struct Output *o, const char *data, int len)
+{
+    int i = 0;
+
+    while(i < o->nconsumers)
+    {
+        /* Its job ended, or closed its input */
+        if (write_all(o->consumers[i], data, len) == -1)
+        {
+            close(o->consumers[i]);
+            o->consumers[i] = o->consumers[--o->nconsumers];
+            continue;
+        }
+        ++i;
+    }
+}
+
+/* No more consumers. Takes those the server sent before knowing it. */
+static void output_stream_end(struct Output *o)
+{
+    struct Msg m = default_msg();
+    int i;
+
+    if (o->listening)
+    {
+        m.type = STREAM_END;
+        send_msg(server_socket, &m);
+        while(output_server_msg(o))
+            ;
+    }
+    /* They get the end of file */
+    for(i = 0; i < o->nconsumers; ++i)
+        close(o->consumers[i]);
+    free(o->consumers);
+}
+
+/* Copies what the job 'pid' writes into fd_in to the output file, until the
+ * job ends. Without ofname (the output is not stored), it goes to stdout.
+ * The status of the job is left in *status, as in waitpid(). */
+void output_supervise(int fd_in, const char *ofname, int pid, int *status)
+{
+    struct Output o;
+    char *buf;
+    char *command;
+    int exited = 0;
+
+    if (ofname != NULL)
+    {
+        /* run_child() left there the header of a compressed file.
+         * Not O_APPEND: the ring policy writes at the start. */
+        o.fd = open(ofname, O_RDWR);
+        if (o.fd == -1)
+            error("Cannot open the output file %s", ofname);
+        lseek(o.fd, 0, SEEK_END);
+    }
+    else
+        o.fd = dup(1);
+    o.ofname = ofname;
+    o.pid = pid;
+    o.comp = ofname ? output_compression() : COMPRESS_NONE;
+    o.level = command_line.compress_level;
+    o.len = 0;
+    o.size = o.comp == COMPRESS_NONE ? 0 : ZHEADER_SIZE;
+    o.max = ofname ? command_line.max_output : 0;
+    o.policy = command_line.output_policy;
+    o.killed = 0;
+    o.tindex = ofname && command_line.time_index ? tindex_create(ofname) : NULL;
+    peek_init(&o.peek);
+    o.peek_new = 0;
+    o.consumers = NULL;
+    o.nconsumers = 0;
+    o.listening = command_line.stream_output;
+    o.data_start = 0;
+    o.buf = (char *) malloc(ZFRAME_SIZE);
+    buf = (char *) malloc(ZFRAME_SIZE);
+    if (o.buf == NULL || buf == NULL)
+        error("Not enough memory for the output buffers");
+
+    /* The command line goes first, as in the not supervised outputs */
+    if (ofname != NULL)
+    {
+        command = build_command_string();
+        output_add(&o, command, strlen(command));
+        output_add(&o, "\n", 1);
+        o.data_start = strlen(command) + 1;
+        free(command);
+    }
+
+    while(1)
+    {
+        struct pollfd pfd[2];
+        int res;
+        long timeout = FLUSH_MS;
+
+        if (o.len > 0)
+            timeout = ms_until(&o.flush_time);
+        if (o.peek_new > 0 && ms_until(&o.peek_time) < timeout)
+            timeout = ms_until(&o.peek_time);
+        if (timeout < 0)
+            timeout = 0;
+
+        pfd[0].fd = fd_in;
+        pfd[0].events = POLLIN;
+        pfd[0].revents = 0;
+        pfd[1].fd = server_socket;
+        pfd[1].events = POLLIN;
+        pfd[1].revents = 0;
+        res = poll(pfd, o.listening ? 2 : 1, timeout);
+        if (res == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            error("poll on the job output");
+        }
+
+        if (pfd[1].revents)
+            o.listening = output_server_msg(&o);
+
+        if (pfd[0].revents)
+        {
+            res = read(fd_in, buf, ZFRAME_SIZE);
+            if (res == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                error("reading the job output");
+            }
+            if (res == 0)
+                break; /* All the writers closed it */
+            output_add(&o, buf, res);
+            peek_add_output(&o, buf, res);
+            output_feed_consumers(&o, buf, res);
+        }
+
+        if (o.len > 0 && ms_until(&o.flush_time) <= 0)
+            output_flush(&o);
+        if (o.peek_new > 0 && ms_until(&o.peek_time) <= 0)
+            peek_send(&o);
+
+        /* Nothing to read for a while. Maybe the job ended, and some
+         * process it left behind keeps the pipe open. */
+        if (res == 0 && waitpid(pid, status, WNOHANG) == pid)
+        {
+            exited = 1;
+            break;
+        }
+    }
+
+    output_flush(&o);
+    output_stream_end(&o);
+    peek_send(&o);
+    peek_free(&o.peek);
+    close(o.fd);
+    if (o.tindex != NULL)
+        tindex_close(o.tindex);
+    close(fd_in);
+    free(o.buf);
+    free(buf);
+
+    while(!exited)
+    {
+        if (waitpid(pid, status, 0) == pid)
+            exited = 1;
+        else if (errno != EINTR)
+            error("waiting for the job");
+    }
+}
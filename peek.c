@@ -0,0 +1,80 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2009  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "main.h"
+
+/* The last bytes of the output of a running job (TS_PEEKSIZE), kept in a
+ * ring. The job runner keeps one, and sends what got in it from time to
+ * time to the server, which keeps another for ts --peek. */
+
+void peek_init(struct Peek *p) {
+    p->buf = NULL;
+    p->size = 0;
+    p->start = 0;
+    p->len = 0;
+}
+
+void peek_free(struct Peek *p) {
+    free(p->buf);
+    peek_init(p);
+}
+
+/* The ring is allocated on the first data, of 'size' bytes */
+void peek_add(struct Peek *p, int size, const char *data, int len) {
+    int end;
+    int chunk;
+
+    if (p->buf == NULL) {
+        if (size > PEEK_MAX)
+            size = PEEK_MAX;
+        if (size <= 0)
+            return;
+        p->buf = (char *) malloc(size);
+        if (p->buf == NULL)
+            return;
+        p->size = size;
+    }
+
+    /* Only the last bytes would stay */
+    if (len >= p->size) {
+        memcpy(p->buf, data + len - p->size, p->size);
+        p->start = 0;
+        p->len = p->size;
+        return;
+    }
+
+    end = (p->start + p->len) % p->size;
+    chunk = p->size - end < len ? p->size - end : len;
+    memcpy(p->buf + end, data, chunk);
+    memcpy(p->buf, data + chunk, len - chunk);
+
+    p->len += len;
+    if (p->len > p->size) {
+        p->start = (p->start + p->len - p->size) % p->size;
+        p->len = p->size;
+    }
+}
+
+/* Copies the last n bytes (at most the ones in the ring) into out.
+ * Returns how many. */
+int peek_last(const struct Peek *p, int n, char *out) {
+    int from;
+    int chunk;
+
+    if (n > p->len)
+        n = p->len;
+    if (n == 0)
+        return 0;
+    from = (p->start + p->len - n) % p->size;
+    chunk = p->size - from < n ? p->size - from : n;
+    memcpy(out, p->buf + from, chunk);
+    memcpy(out + chunk, p->buf, n - chunk);
+    return n;
+}
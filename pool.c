@@ -0,0 +1,328 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2013  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "main.h"
+
+/* Warm workers, for the jobs queued with --pool. The server starts them
+ * running the bootstrap command of the pool, and lends an idle one to the
+ * job runner of each job of the pool. The runner writes the job to the
+ * stdin of the worker, and takes its output (see run_pool_child() in
+ * execute.c). */
+
+struct Worker {
+    int pid; /* 0 if not running */
+    int in; /* Its stdin */
+    int out; /* Its stdout and stderr */
+    int jobid; /* -1 if idle */
+};
+
+struct Pool {
+    char *name;
+    char *command;
+    int size;
+    int stopping; /* Gone for the new jobs. Freed when none runs. */
+    struct Worker *workers;
+    struct Pool *next;
+};
+
+static struct Pool *first_pool = 0;
+
+/* Workers stopped, still to be waited for */
+static int *zombies = 0;
+static int num_zombies = 0;
+
+static struct Pool *find_pool(const char *name) {
+    struct Pool *p;
+
+    for (p = first_pool; p != 0; p = p->next)
+        if (!p->stopping && strcmp(p->name, name) == 0)
+            return p;
+    return 0;
+}
+
+static int worker_start(const struct Pool *pool, struct Worker *w) {
+    int in[2];
+    int out[2];
+    int pid;
+    int fd;
+    int max;
+
+    if (pipe(in) == -1)
+        return -1;
+    if (pipe(out) == -1) {
+        close(in[0]);
+        close(in[1]);
+        return -1;
+    }
+
+    pid = fork();
+    switch (pid) {
+        case 0:
+            restore_sigmask();
+            dup2(in[0], 0);
+            dup2(out[1], 1);
+            dup2(out[1], 2);
+            /* Nothing of the server: its clients would not see the end
+             * of their connections */
+            max = sysconf(_SC_OPEN_MAX);
+            for (fd = 3; fd < max; ++fd)
+                close(fd);
+            /* As the jobs, killed as a group by ts -k */
+            setsid();
+            putenv("PYTHONUNBUFFERED=1");
+            execl("/bin/sh", "sh", "-c", pool->command, (char *) NULL);
+            fprintf(stderr, "ts could not run the pool command\n");
+            _exit(-1);
+        case -1:
+            warning("Cannot start a worker of the pool %s", pool->name);
+            close(in[0]);
+            close(in[1]);
+            close(out[0]);
+            close(out[1]);
+            return -1;
+    }
+    close(in[0]);
+    close(out[1]);
+    w->pid = pid;
+    w->in = in[1];
+    w->out = out[0];
+    w->jobid = -1;
+    return 0;
+}
+
+static void worker_stop(struct Worker *w) {
+    if (w->pid == 0)
+        return;
+    close(w->in);
+    close(w->out);
+    kill(-w->pid, SIGTERM);
+    zombies = (int *) realloc(zombies, (num_zombies + 1) * sizeof(int));
+    zombies[num_zombies++] = w->pid;
+    w->pid = 0;
+}
+
+/* Whether the idle worker can take a job. What it wrote while idle
+ * gets dropped. */
+static int worker_ready(struct Worker *w) {
+    struct pollfd pfd;
+    char buf[1024];
+    int i;
+
+    if (w->pid == 0)
+        return 0;
+    pfd.fd = w->out;
+    pfd.events = POLLIN;
+    for (i = 0; i < 64 && poll(&pfd, 1, 0) == 1; ++i)
+        if (read(w->out, buf, sizeof(buf)) <= 0)
+            return 0;
+    return i < 64;
+}
+
+static void free_pool(struct Pool *pool) {
+    struct Pool **pp;
+
+    for (pp = &first_pool; *pp != 0; pp = &(*pp)->next)
+        if (*pp == pool) {
+            *pp = pool->next;
+            break;
+        }
+    free(pool->name);
+    free(pool->command);
+    free(pool->workers);
+    free(pool);
+}
+
+/* Frees the stopping pool, once none of its workers runs a job */
+static void end_stopping(struct Pool *pool) {
+    int i;
+
+    for (i = 0; i < pool->size; ++i)
+        if (pool->workers[i].jobid != -1)
+            return;
+    free_pool(pool);
+}
+
+void s_pool_start(int s, const char *name, int size, const char *command) {
+    struct Pool *pool;
+    char line[200];
+    int i;
+
+    if (find_pool(name) != 0) {
+        snprintf(line, sizeof(line), "The pool %.100s exists.\n", name);
+        send_list_line(s, line);
+        return;
+    }
+    if (size <= 0) {
+        send_list_line(s, "The pool needs some worker.\n");
+        return;
+    }
+
+    pool = (struct Pool *) malloc(sizeof(*pool));
+    if (pool == 0)
+        error("Cannot allocate the pool %s", name);
+    pool->name = strdup(name);
+    pool->command = strdup(command);
+    pool->workers = (struct Worker *) malloc(size * sizeof(struct Worker));
+    if (pool->name == 0 || pool->command == 0 || pool->workers == 0)
+        error("Cannot allocate the pool %s with %i workers", name, size);
+    pool->size = size;
+    pool->stopping = 0;
+    pool->next = first_pool;
+    first_pool = pool;
+
+    for (i = 0; i < size; ++i) {
+        pool->workers[i].pid = 0;
+        pool->workers[i].jobid = -1;
+        /* If it cannot start, it is tried again when needed */
+        worker_start(pool, &pool->workers[i]);
+    }
+}
+
+void s_pool_stop(int s, const char *name) {
+    struct Pool *pool;
+    char line[200];
+    int i;
+
+    pool = find_pool(name);
+    if (pool == 0) {
+        snprintf(line, sizeof(line), "The pool %.100s does not exist.\n",
+                 name);
+        send_list_line(s, line);
+        return;
+    }
+
+    /* The busy workers end their job first */
+    pool->stopping = 1;
+    for (i = 0; i < pool->size; ++i)
+        if (pool->workers[i].jobid == -1)
+            worker_stop(&pool->workers[i]);
+    end_stopping(pool);
+}
+
+void s_list_pools(int s) {
+    struct Pool *pool;
+    char *line;
+    int busy;
+    int i;
+
+    for (pool = first_pool; pool != 0; pool = pool->next) {
+        if (pool->stopping)
+            continue;
+        busy = 0;
+        for (i = 0; i < pool->size; ++i)
+            if (pool->workers[i].jobid != -1)
+                ++busy;
+        line = (char *) malloc(strlen(pool->name) + strlen(pool->command)
+                               + 60);
+        sprintf(line, "%s: %i workers, %i busy: %s\n", pool->name,
+                pool->size, busy, pool->command);
+        send_list_line(s, line);
+        free(line);
+    }
+}
+
+/* Whether a job of the pool can run now. The jobs of a pool that does not
+ * exist run as any other. */
+int s_pool_can_run(const char *name) {
+    struct Pool *pool;
+    int i;
+
+    pool = find_pool(name);
+    if (pool == 0)
+        return 1;
+    for (i = 0; i < pool->size; ++i)
+        if (pool->workers[i].jobid == -1)
+            return 1;
+    return 0;
+}
+
+/* Lends an idle worker of the pool to the job. Returns its pid, with its
+ * stdin and stdout in *in and *out, or 0 if none can take it. */
+int s_pool_take(const char *name, int jobid, int *in, int *out) {
+    struct Pool *pool;
+    struct Worker *w;
+    int i;
+
+    pool = find_pool(name);
+    if (pool == 0)
+        return 0;
+    for (i = 0; i < pool->size; ++i) {
+        w = &pool->workers[i];
+        if (w->jobid != -1)
+            continue;
+        if (!worker_ready(w)) {
+            worker_stop(w);
+            if (worker_start(pool, w) == -1)
+                continue;
+        }
+        w->jobid = jobid;
+        *in = w->in;
+        *out = w->out;
+        return w->pid;
+    }
+    return 0;
+}
+
+/* The job ended. Its worker is idle again if 'reuse', or gets replaced
+ * otherwise, as when the job did not end talking to it. */
+void s_pool_release(int jobid, int reuse) {
+    struct Pool *pool;
+    int i;
+
+    for (pool = first_pool; pool != 0; pool = pool->next)
+        for (i = 0; i < pool->size; ++i) {
+            if (pool->workers[i].jobid != jobid)
+                continue;
+            pool->workers[i].jobid = -1;
+            if (!reuse || pool->stopping)
+                worker_stop(&pool->workers[i]);
+            if (pool->stopping)
+                end_stopping(pool);
+            return;
+        }
+}
+
+/* Called on every server loop. Waits for the workers that ended. */
+void s_pool_reap() {
+    struct Pool *pool;
+    int i;
+
+    for (i = 0; i < num_zombies;) {
+        if (waitpid(zombies[i], NULL, WNOHANG) == 0)
+            ++i;
+        else
+            zombies[i] = zombies[--num_zombies];
+    }
+
+    /* Those that died by themselves get replaced when needed */
+    for (pool = first_pool; pool != 0; pool = pool->next)
+        for (i = 0; i < pool->size; ++i)
+            if (pool->workers[i].pid != 0
+                && waitpid(pool->workers[i].pid, NULL, WNOHANG) != 0) {
+                close(pool->workers[i].in);
+                close(pool->workers[i].out);
+                pool->workers[i].pid = 0;
+            }
+}
+
+/* At the server end */
+void s_pool_end() {
+    struct Pool *pool;
+    int i;
+
+    for (pool = first_pool; pool != 0; pool = pool->next)
+        for (i = 0; i < pool->size; ++i)
+            worker_stop(&pool->workers[i]);
+}
@@ -0,0 +1,117 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2009  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+#include "main.h"
+
+/* Removes the output files of the finished jobs the server forgets
+ * (TS_REAPOUTPUT), in a child process, so the server does not wait on the
+ * filesystem. */
+
+static char **pending;
+static int npending;
+static int allocated;
+static int reaper_pid; /* 0 if none running */
+
+int reaper_enabled() {
+    char *str;
+
+    str = getenv("TS_REAPOUTPUT");
+    return str != NULL && atoi(str) != 0;
+}
+
+void reaper_add(const char *fname) {
+    if (npending == allocated) {
+        allocated = allocated ? allocated * 2 : 16;
+        pending = (char **) realloc(pending, allocated * sizeof(char *));
+        if (pending == NULL)
+            error("Not enough memory for the reaper list");
+    }
+    pending[npending] = (char *) malloc(strlen(fname) + 1);
+    strcpy(pending[npending], fname);
+    ++npending;
+}
+
+/* Removes an output with its .e, its time index and its rotated segments */
+static void remove_output(const char *fname) {
+    char *name;
+    char *dir;
+    const char *base;
+    int i;
+
+    name = (char *) malloc(strlen(fname) + 12);
+    unlink(fname);
+    sprintf(name, "%s.e", fname);
+    unlink(name);
+    sprintf(name, "%s.idx", fname);
+    unlink(name);
+    for (i = 1;; ++i) {
+        sprintf(name, "%s.%i", fname, i);
+        if (unlink(name) == -1 && errno == ENOENT)
+            break;
+    }
+
+    /* The shards of TS_LOGLAYOUT are named by numbers. Drop them if they
+     * got empty. */
+    strcpy(name, fname);
+    dir = dirname(name);
+    base = strrchr(dir, '/');
+    base = base ? base + 1 : dir;
+    if (base[0] != '\0' && strspn(base, "0123456789") == strlen(base))
+        rmdir(dir);
+    free(name);
+}
+
+static void remove_pending() {
+    int i;
+    for (i = 0; i < npending; ++i)
+        remove_output(pending[i]);
+}
+
+static void free_pending() {
+    int i;
+    for (i = 0; i < npending; ++i)
+        free(pending[i]);
+    npending = 0;
+}
+
+/* Called on every server loop. Starts a reaper for the outputs gathered,
+ * if the last one already ended. */
+void reaper_run() {
+    int pid;
+
+    if (reaper_pid != 0) {
+        if (waitpid(reaper_pid, NULL, WNOHANG) == 0)
+            return;
+        reaper_pid = 0;
+    }
+    if (npending == 0)
+        return;
+
+    pid = fork();
+    switch (pid) {
+        case 0:
+            remove_pending();
+            _exit(0);
+        case -1:
+            /* Do it ourselves */
+            remove_pending();
+            break;
+        default:
+            reaper_pid = pid;
+            break;
+    }
+    free_pending();
+}
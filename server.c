@@ -26,6 +26,7 @@
 #include <libgen.h>
 #include <sys/wait.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "main.h"
 
@@ -56,6 +57,8 @@ struct Client_conn {
     int socket;
     int hasjob;
     int jobid;
+    int session; /* ts --session: many requests, until it closes */
+    int hook; /* Runs the hooks of its ended job, in a turn */
 };
 
 /* Globals */
@@ -63,6 +66,16 @@ static struct Client_conn *client_cs;
 static int nconnections;
 static char *path;
 static int max_descriptors;
+static int hooks_running;
+
+/* The runners waiting for a turn for their hooks, in order. They ask again
+ * and again, without keeping a connection. */
+struct HookWait {
+    int jobid;
+    time_t seen; /* The last time it asked */
+};
+static struct HookWait *hook_waits;
+static int num_hook_waits;
 
 /* in jobs.c */
 extern int max_jobs;
@@ -94,6 +107,9 @@ static void sigterm_handler(int n) {
 
     /* path will be initialized for sure, before installing the handler */
     unlink(path);
+    snapshot_close();
+    s_pool_end();
+    s_env_end();
     exit(1);
 }
 
@@ -202,6 +218,9 @@ void server_main(int notify_fd, char *_path) {
 
     initialize_log_dir();
 
+    snapshot_open(path);
+    s_env_init(path);
+
     notify_parent(notify_fd);
 
 #ifndef CPU
@@ -219,8 +238,38 @@ static int get_conn_of_jobid(int jobid) {
     return -1;
 }
 
+/* A job wants the output of 'jobid' as input, through the pipe it passes.
+ * It goes to the job runner of 'jobid', if it takes consumers. */
+static void s_stdin_pipe(int s, int jobid) {
+    struct Msg m = default_msg();
+    enum StreamMode mode;
+    int fd;
+    int conn;
+
+    fd = recv_fd(s);
+    mode = s_stream_mode(jobid);
+    if (mode == STREAM_LIVE) {
+        conn = get_conn_of_jobid(jobid);
+        if (conn == -1 || fd == -1)
+            mode = STREAM_FILE;
+        else {
+            m.type = CONSUMER_PIPE;
+            send_msg(client_cs[conn].socket, &m);
+            send_fd(client_cs[conn].socket, fd);
+        }
+    }
+    if (fd != -1)
+        close(fd);
+
+    m = default_msg();
+    m.type = STDIN_PIPE_OK;
+    m.u.stream = mode;
+    send_msg(s, &m);
+}
+
 static void server_loop(int ls) {
     fd_set readset;
+    fd_set writeset;
     int i;
     int maxfd;
     int keep_loop = 1;
@@ -236,6 +285,7 @@ static void server_loop(int ls) {
         tv.tv_usec = 0;
 
         FD_ZERO(&readset);
+        FD_ZERO(&writeset);
         maxfd = 0;
         /* If we can accept more connections, go on.
          * Otherwise, the system block them (no accept will be done). */
@@ -248,20 +298,25 @@ static void server_loop(int ls) {
             if (client_cs[i].socket > maxfd)
                 maxfd = client_cs[i].socket;
         }
+        /* The watchers with events they did not take yet */
+        maxfd = s_watchers_pending(&writeset, maxfd);
 
         /* timeout mode if there are queued GPU jobs only */
         if (s_count_allocating_jobs() > 0)
-            res = select(maxfd + 1, &readset, NULL, NULL, &tv);
+            res = select(maxfd + 1, &readset, &writeset, NULL, &tv);
         else
-            res = select(maxfd + 1, &readset, NULL, NULL, NULL);
+            res = select(maxfd + 1, &readset, &writeset, NULL, NULL);
 
         if (res != -1) {
+            s_watchers_flush(&writeset);
             if (FD_ISSET(ls, &readset)) {
                 int cs;
                 cs = accept(ls, NULL, NULL);
                 if (cs == -1)
                     error("Accepting from %i", ls);
                 client_cs[nconnections].hasjob = 0;
+                client_cs[nconnections].session = 0;
+                client_cs[nconnections].hook = 0;
                 client_cs[nconnections].socket = cs;
                 ++nconnections;
             }
@@ -281,6 +336,19 @@ static void server_loop(int ls) {
             }
         }
 
+        /* The watchers too far behind */
+        for (i = 0; i < nconnections;)
+            if (s_watcher_dropped(client_cs[i].socket))
+                clean_after_client_disappeared(client_cs[i].socket, i);
+            else
+                ++i;
+
+        /* Outputs of the forgotten jobs (TS_REAPOUTPUT) */
+        reaper_run();
+
+        /* Pool workers ended */
+        s_pool_reap();
+
         /* This will return firstjob->jobid or -1 */
         newjob = next_run_job();
         if (newjob != -1) {
@@ -297,6 +365,9 @@ static void server_loop(int ls) {
                 s_newjob_ok(wake_conn);
             }
         }
+
+        /* What this round changed, for the clients reading it */
+        s_publish_snapshot();
     }
 
     end_server(ls);
@@ -304,28 +375,90 @@ static void server_loop(int ls) {
 
 static void end_server(int ls) {
     close(ls);
+    s_history_finished();
     unlink(path);
+    snapshot_close();
+    s_pool_end();
+    s_env_end();
     /* This comes from the parent, in the fork after server_main.
      * This is the last use of path in this process.*/
     free(path);
     free(client_cs);
+    free(hook_waits);
     free(logdir);
 #ifndef CPU
     cleanupGpu();
 #endif
 }
 
+static int get_hook_slots() {
+    const char *str;
+    int slots;
+
+    str = getenv("TS_HOOKSLOTS");
+    if (str == NULL)
+        return 4;
+    slots = abs(atoi(str));
+    return slots > 0 ? slots : 1;
+}
+
+/* Those not asking for so long are gone */
+enum { HOOK_FORGET = 10 };
+
+/* Whether the runner of the job can run its hooks (TS_ONFINISH, mail) now.
+ * Those waiting the longest go first, as many at once as TS_HOOKSLOTS.
+ * They run once the job has ended, so they hold no slot; the runner
+ * keeps the connection while they run, and closes when done. */
+static int hook_turn(int jobid) {
+    time_t now = time(NULL);
+    int found = -1;
+    int i;
+
+    for (i = 0; i < num_hook_waits;)
+        if (now - hook_waits[i].seen > HOOK_FORGET) {
+            memmove(&hook_waits[i], &hook_waits[i + 1],
+                    (num_hook_waits - i - 1) * sizeof(struct HookWait));
+            --num_hook_waits;
+        } else
+            ++i;
+
+    for (i = 0; i < num_hook_waits; ++i)
+        if (hook_waits[i].jobid == jobid)
+            found = i;
+    if (found == -1) {
+        hook_waits = (struct HookWait *) realloc(hook_waits,
+                (num_hook_waits + 1) * sizeof(struct HookWait));
+        if (hook_waits == 0)
+            error("Cannot allocate the hook waits");
+        found = num_hook_waits++;
+        hook_waits[found].jobid = jobid;
+    }
+    hook_waits[found].seen = now;
+
+    if (found >= get_hook_slots() - hooks_running)
+        return 0;
+    memmove(&hook_waits[found], &hook_waits[found + 1],
+            (num_hook_waits - found - 1) * sizeof(struct HookWait));
+    --num_hook_waits;
+    return 1;
+}
+
 static void remove_connection(int index) {
     int i;
+    int hook;
 
     if (client_cs[index].hasjob) {
         s_removejob(client_cs[index].jobid);
     }
+    hook = client_cs[index].hook;
 
     for (i = index; i < (nconnections - 1); ++i) {
         memcpy(&client_cs[i], &client_cs[i + 1], sizeof(client_cs[0]));
     }
     nconnections--;
+
+    if (hook)
+        --hooks_running;
 }
 
 static void
@@ -345,21 +478,49 @@ clean_after_client_disappeared(int socket, int index) {
 
         warning("JobID %i quit while running.", jobid);
         job_finished(&r, jobid);
+        s_publish_snapshot();
         /* For the dependencies */
         check_notify_list(jobid);
         /* We don't want this connection to do anything
          * more related to the jobid, secially on remove_connection
          * when we receive the EOC. */
         client_cs[index].hasjob = 0;
-    } else
+    } else {
         /* If it doesn't have a running job,
-         * it may well be a notification */
+         * it may well be a notification, or a watcher */
         s_remove_notification(socket);
+        s_remove_watcher(socket);
+    }
 
     close(socket);
     remove_connection(index);
 }
 
+/* The end of an answer of many lines. The connection gets closed, unless it
+ * is a session, which goes on with its next request. */
+static void end_of_lines(int index) {
+    struct Msg m = default_msg();
+
+    if (client_cs[index].session) {
+        m.type = LIST_END;
+        send_msg(client_cs[index].socket, &m);
+        return;
+    }
+    close(client_cs[index].socket);
+    remove_connection(index);
+}
+
+/* The end of a request changing the state, without answer. Once published,
+ * the connection gets closed: the client waits for it, not to read the
+ * snapshot older than its change. A session goes on. */
+static void end_of_write(int index) {
+    s_publish_snapshot();
+    if (client_cs[index].session)
+        return;
+    close(client_cs[index].socket);
+    remove_connection(index);
+}
+
 static enum Break
 client_read(int index) {
     struct Msg m = default_msg();
@@ -405,7 +566,7 @@ client_read(int index) {
                     error("Reading the ofilename");
             }
             s_process_runjob_ok(client_cs[index].jobid, buffer,
-                                m.u.output.pid);
+                                m.u.output.pid, m.u.output.peek_size);
         }
             break;
         case KILL_ALL:
@@ -415,20 +576,17 @@ client_read(int index) {
             term_width = m.u.term_width;
             s_list(s, m.u.list_format);
             /* We must actively close, meaning End of Lines */
-            close(s);
-            remove_connection(index);
+            end_of_lines(index);
             break;
 #ifndef CPU
         case LIST_GPU:
             s_list_gpu(s);
-            close(s);
-            remove_connection(index);
+            end_of_lines(index);
             break;
 #endif
         case INFO:
-            s_job_info(s, m.u.jobid);
-            close(s);
-            remove_connection(index);
+            s_job_info(s, m.u.jobid, client_cs[index].session);
+            end_of_lines(index);
             break;
         case LAST_ID:
             s_send_last_id(s);
@@ -441,6 +599,8 @@ client_read(int index) {
             break;
         case ENDJOB:
             job_finished(&m.u.result, client_cs[index].jobid);
+            /* Before telling the ts -w waiting */
+            s_publish_snapshot();
             /* For the dependencies */
             check_notify_list(client_cs[index].jobid);
             /* We don't want this connection to do anything
@@ -450,6 +610,7 @@ client_read(int index) {
             break;
         case CLEAR_FINISHED:
             s_clear_finished();
+            end_of_write(index);
             break;
         case ASK_OUTPUT:
             s_send_output(s, m.u.jobid);
@@ -489,6 +650,7 @@ client_read(int index) {
             break;
         case SET_MAX_SLOTS:
             s_set_max_slots(m.u.max_slots);
+            end_of_write(index);
             break;
         case GET_MAX_SLOTS:
             s_get_max_slots(s);
@@ -531,6 +693,115 @@ client_read(int index) {
             close(s);
             remove_connection(index);
             break;
+        case STDIN_PIPE:
+            s_stdin_pipe(s, m.u.jobid);
+            break;
+        case STREAM_END:
+            s_stream_end(client_cs[index].jobid);
+            m = default_msg();
+            m.type = STREAM_END_OK;
+            send_msg(s, &m);
+            break;
+        case PEEK_DATA:
+            s_peek_data(s, client_cs[index].jobid, m.u.peek.size,
+                        m.u.peek.ring_size);
+            break;
+        case PEEK:
+            s_peek(s, m.u.jobid);
+            /* We must actively close, meaning End of Lines */
+            end_of_lines(index);
+            break;
+        case LIST_OUTPUTS: {
+            char *label = NULL;
+            int *jobs;
+            int num_jobs;
+            if (m.u.filter.label_size > 0) {
+                label = (char *) malloc(m.u.filter.label_size);
+                recv_bytes(s, label, m.u.filter.label_size);
+            }
+            jobs = recv_ints(s, &num_jobs);
+            s_list_outputs(s, m.u.filter.state, label, jobs, num_jobs);
+            free(label);
+            free(jobs);
+        }
+            /* We must actively close, meaning End of Lines */
+            end_of_lines(index);
+            break;
+        case SESSION:
+            client_cs[index].session = 1;
+            break;
+        case HOOK_WAIT: {
+            int jobid = m.u.jobid;
+            m = default_msg();
+            if (hook_turn(jobid)) {
+                client_cs[index].hook = 1;
+                ++hooks_running;
+                m.type = HOOK_GO;
+            } else
+                m.type = HOOK_LATER;
+            send_msg(s, &m);
+        }
+            break;
+        case WATCH: {
+            char *label = NULL;
+            int *jobs;
+            int num_jobs;
+            if (m.u.filter.label_size > 0) {
+                label = (char *) malloc(m.u.filter.label_size);
+                recv_bytes(s, label, m.u.filter.label_size);
+            }
+            jobs = recv_ints(s, &num_jobs);
+            /* The watcher keeps them */
+            s_watch(s, label, jobs, num_jobs);
+        }
+            break;
+        case WAITJOBS: {
+            char *label = NULL;
+            int *jobs;
+            int num_jobs;
+            if (m.u.filter.label_size > 0) {
+                label = (char *) malloc(m.u.filter.label_size);
+                recv_bytes(s, label, m.u.filter.label_size);
+            }
+            jobs = recv_ints(s, &num_jobs);
+            s_wait_jobs(s, label, jobs, num_jobs);
+        }
+            break;
+        case POOL_START:
+        case POOL_STOP: {
+            char *name;
+            char *command = NULL;
+            name = (char *) malloc(m.u.pool.name_size);
+            recv_bytes(s, name, m.u.pool.name_size);
+            if (m.type == POOL_START) {
+                command = (char *) malloc(m.u.pool.command_size);
+                recv_bytes(s, command, m.u.pool.command_size);
+                s_pool_start(s, name, m.u.pool.size, command);
+            } else
+                s_pool_stop(s, name);
+            free(name);
+            free(command);
+        }
+            /* We must actively close, meaning End of Lines */
+            end_of_lines(index);
+            break;
+        case ASK_ENV_CACHE:
+            m.u.env.key[ENV_KEY_SIZE - 1] = '\0';
+            s_ask_env_cache(s, m.u.env.key, m.u.env.ttl);
+            break;
+        case LIST_POOLS:
+            s_list_pools(s);
+            /* We must actively close, meaning End of Lines */
+            end_of_lines(index);
+            break;
+        case MEM_STATS:
+            s_mem_stats(s);
+            end_of_lines(index);
+            break;
+        case STATS:
+            s_stats(s, m.u.stats.by, m.u.stats.format);
+            end_of_lines(index);
+            break;
         default:
             /* Command not supported */
             /* On unknown message, we close the client,
@@ -565,6 +836,8 @@ static void s_newjob_ok(int index) {
     m.type = NEWJOB_OK;
     m.u.jobid = client_cs[index].jobid;
 
+    /* The client may ask for the new job next, from the snapshot */
+    s_publish_snapshot();
     send_msg(s, &m);
 }
 
@@ -587,6 +860,8 @@ static void dump_conn_struct(FILE *out, const struct Client_conn *p) {
     fprintf(out, "    socket %i\n", p->socket);
     fprintf(out, "    hasjob \"%i\"\n", p->hasjob);
     fprintf(out, "    jobid %i\n", p->jobid);
+    fprintf(out, "    session %i\n", p->session);
+    fprintf(out, "    hook %i\n", p->hook);
 }
 
 void dump_conns_struct(FILE *out) {
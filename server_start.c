@@ -17,6 +17,7 @@
 #include <signal.h>
 
 #include "main.h"
+#include "libts.h"
 
 int server_socket;
 
@@ -26,42 +27,8 @@ static int should_check_owner = 0;
 static int fork_server();
 
 void create_socket_path(char **path) {
-    char *tmpdir;
-    char userid[20];
-    int size;
-
-    /* As a priority, TS_SOCKET mandates over the path creation */
-    *path = getenv("TS_SOCKET");
-    if (*path != 0) {
-        /* We need this in our memory, for forks and future 'free'. */
-        size = strlen(*path) + 1;
-        *path = (char *) malloc(size);
-        strcpy(*path, getenv("TS_SOCKET"));
-
-        /* We don't want to check ownership of the socket here,
-         * as the user may have thought of some shared queue */
-        should_check_owner = 0;
-        return;
-    }
-
-    /* ... if the $TS_SOCKET doesn't exist ... */
-
-    /* Create the path */
-    tmpdir = getenv("TMPDIR");
-    if (tmpdir == NULL)
-        tmpdir = "/tmp";
-
-    sprintf(userid, "%u", (unsigned int) getuid());
-
-    /* Calculate the size */
-    size = strlen(tmpdir) + strlen("/socket-ts.") + strlen(userid) + 1;
-
-    /* Freed after preparing the socket address */
-    *path = (char *) malloc(size);
-
-    sprintf(*path, "%s/socket-ts.%s", tmpdir, userid);
-
-    should_check_owner = 1;
+    /* The same as the programs using libts */
+    *path = ts_socket_path(&should_check_owner);
 }
 
 int try_connect(int s) {
@@ -130,6 +97,36 @@ static int fork_server() {
     return p[0];
 }
 
+/* One more connection to a server already up, or -1 if it is gone */
+int try_connect_server() {
+    int s;
+    int res;
+
+    s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == -1)
+        error("getting the server socket");
+
+    create_socket_path(&socket_path);
+    res = try_connect(s);
+    free(socket_path);
+    if (res == -1) {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+/* Opens one more connection to a server already up */
+int connect_server() {
+    int s;
+
+    s = try_connect_server();
+    if (s == -1)
+        error("c: cannot connect to the server");
+
+    return s;
+}
+
 void notify_parent(int fd) {
     char a = 'a';
     write(fd, &a, 1);
@@ -0,0 +1,325 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2009  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "main.h"
+
+/* ts --session: one connection to the server for many requests, read one
+ * per line from stdin, as the options of ts (-l, -s 3, -i, ...). All the
+ * lines at hand are sent before reading their answers, which the server
+ * gives in order. Each answer is written to stdout as a line with "ok" or
+ * "error" and the size of what follows, and then that many bytes. */
+
+enum {
+    LINE_MAX_SIZE = 4096,
+    /* Requests sent before reading their answers. Few enough that they
+     * fit in the socket buffer, so the server never blocks on us. */
+    PIPELINE_MAX = 64
+};
+
+enum SessionRequest {
+    S_LIST,
+    S_STATE,
+    S_INFO,
+    S_LAST_ID,
+    S_COUNT_RUNNING,
+    S_GET_SLOTS,
+    S_SET_SLOTS,
+    S_OUTPUT,
+    S_PID,
+    S_CMD,
+    S_REMOVE,
+    S_WRONG
+};
+
+struct Answer {
+    char *data;
+    int len;
+    int size;
+    int error;
+};
+
+static enum SessionRequest pending[PIPELINE_MAX];
+static int npending;
+
+static void add(struct Answer *a, const char *data, int len) {
+    if (a->len + len > a->size) {
+        a->size = (a->len + len) * 2;
+        a->data = (char *) realloc(a->data, a->size);
+        if (a->data == NULL)
+            error("Not enough memory for the session answers");
+    }
+    memcpy(a->data + a->len, data, len);
+    a->len += len;
+}
+
+static void add_printf(struct Answer *a, const char *fmt, int value) {
+    char tmp[100];
+    int len;
+
+    len = snprintf(tmp, sizeof tmp, fmt, value);
+    add(a, tmp, len);
+}
+
+static void recv_answer_msg(struct Msg *m) {
+    int res;
+
+    res = recv_msg(server_socket, m);
+    if (res == 0)
+        error("The server closed the session");
+    if (res != sizeof(*m))
+        error("Error receiving a session answer");
+}
+
+/* The string of a LIST_LINE, NUL included by the server */
+static void add_line(struct Answer *a, const struct Msg *m) {
+    char *buffer;
+
+    buffer = (char *) malloc(m->u.size);
+    if (recv_bytes(server_socket, buffer, m->u.size) != m->u.size)
+        error("Error receiving a session answer line");
+    add(a, buffer, strlen(buffer));
+    free(buffer);
+}
+
+/* The answers that end with LIST_END instead of closing the connection */
+static void recv_lines(struct Answer *a) {
+    struct Msg m = default_msg();
+
+    while (1) {
+        recv_answer_msg(&m);
+        if (m.type == LIST_END)
+            break;
+        if (m.type == LIST_LINE)
+            add_line(a, &m);
+        else if (m.type == INFO_DATA && m.u.size > 0) {
+            char *buffer = (char *) malloc(m.u.size);
+            if (recv_bytes(server_socket, buffer, m.u.size) != m.u.size)
+                error("Error receiving the job information");
+            add(a, buffer, m.u.size);
+            free(buffer);
+        }
+    }
+}
+
+/* A line as "-s 3": the request goes to the server, without waiting */
+static enum SessionRequest send_request(char *line) {
+    struct Msg m = default_msg();
+    enum SessionRequest r;
+    char *opt;
+    char *arg;
+    int jobid;
+
+    opt = strtok(line, " \t");
+    arg = strtok(NULL, " \t");
+    if (opt == NULL || strlen(opt) != 2 || opt[0] != '-')
+        return S_WRONG;
+    jobid = arg ? atoi(arg) : -1;
+
+    switch (opt[1]) {
+        case 'l':
+        case 'M':
+            r = S_LIST;
+            m.type = LIST;
+            m.u.term_width = term_width;
+            m.u.list_format = DEFAULT;
+            if (opt[1] == 'M' && arg != NULL) {
+                if (strcmp(arg, "json") == 0)
+                    m.u.list_format = JSON;
+                else if (strcmp(arg, "tab") == 0)
+                    m.u.list_format = TAB;
+                else if (strcmp(arg, "default") != 0)
+                    return S_WRONG;
+            }
+            break;
+        case 's':
+            r = S_STATE;
+            m.type = GET_STATE;
+            m.u.jobid = jobid;
+            break;
+        case 'i':
+            r = S_INFO;
+            m.type = INFO;
+            m.u.jobid = jobid;
+            break;
+        case 'q':
+            r = S_LAST_ID;
+            m.type = LAST_ID;
+            break;
+        case 'R':
+            r = S_COUNT_RUNNING;
+            m.type = COUNT_RUNNING;
+            break;
+        case 'S':
+            if (arg == NULL) {
+                r = S_GET_SLOTS;
+                m.type = GET_MAX_SLOTS;
+            } else {
+                r = S_SET_SLOTS;
+                m.type = SET_MAX_SLOTS;
+                m.u.max_slots = atoi(arg);
+                if (m.u.max_slots < 1)
+                    return S_WRONG;
+            }
+            break;
+        case 'o':
+        case 'p':
+            r = opt[1] == 'o' ? S_OUTPUT : S_PID;
+            m.type = ASK_OUTPUT;
+            m.u.jobid = jobid;
+            break;
+        case 'F':
+            r = S_CMD;
+            m.type = GET_CMD;
+            m.u.jobid = jobid;
+            break;
+        case 'r':
+            r = S_REMOVE;
+            m.type = REMOVEJOB;
+            m.u.jobid = jobid;
+            break;
+        default:
+            return S_WRONG;
+    }
+    send_msg(server_socket, &m);
+    return r;
+}
+
+static void recv_answer(enum SessionRequest r, struct Answer *a) {
+    struct Msg m = default_msg();
+
+    if (r == S_WRONG) {
+        a->error = 1;
+        add(a, "Wrong request\n", 14);
+        return;
+    }
+    if (r == S_SET_SLOTS)
+        return; /* No answer */
+    if (r == S_LIST || r == S_INFO) {
+        recv_lines(a);
+        return;
+    }
+
+    recv_answer_msg(&m);
+    switch (m.type) {
+        case ANSWER_STATE:
+            add(a, jstate2string(m.u.state), strlen(jstate2string(m.u.state)));
+            add(a, "\n", 1);
+            break;
+        case LAST_ID:
+            add_printf(a, "%i\n", m.u.jobid);
+            break;
+        case COUNT_RUNNING:
+            add_printf(a, "%i\n", m.u.count_running);
+            break;
+        case GET_MAX_SLOTS_OK:
+            add_printf(a, "%i\n", m.u.max_slots);
+            break;
+        case ANSWER_OUTPUT:
+            if (r == S_PID) {
+                add_printf(a, "%i\n", m.u.output.pid);
+                /* The file name comes anyway */
+            }
+            if (m.u.output.store_output && m.u.output.ofilename_size > 0) {
+                char *fname = (char *) malloc(m.u.output.ofilename_size);
+                recv_bytes(server_socket, fname, m.u.output.ofilename_size);
+                if (r == S_OUTPUT) {
+                    add(a, fname, strlen(fname));
+                    add(a, "\n", 1);
+                }
+                free(fname);
+            } else if (r == S_OUTPUT) {
+                a->error = 1;
+                add(a, "The output is not stored.\n", 26);
+            }
+            break;
+        case LIST_LINE:
+            add_line(a, &m);
+            if (r == S_CMD)
+                add(a, "\n", 1);
+            else
+                a->error = 1; /* The answer for a wrong job */
+            break;
+        case REMOVEJOB_OK:
+            break;
+        default:
+            error("Wrong internal message %i in the session", m.type);
+    }
+}
+
+/* Reads the answers of the requests sent, in order */
+static void flush_pending() {
+    struct Answer a;
+    int i;
+
+    for (i = 0; i < npending; ++i) {
+        memset(&a, 0, sizeof(a));
+        recv_answer(pending[i], &a);
+        printf("%s %i\n", a.error ? "error" : "ok", a.len);
+        fwrite(a.data, 1, a.len, stdout);
+        free(a.data);
+    }
+    npending = 0;
+    fflush(stdout);
+}
+
+static void request(char *line) {
+    if (line[0] == '\0')
+        return;
+    if (npending == PIPELINE_MAX)
+        flush_pending();
+    pending[npending++] = send_request(line);
+}
+
+void c_session() {
+    struct Msg m = default_msg();
+    char *buf;
+    int len = 0;
+
+    m.type = SESSION;
+    send_msg(server_socket, &m);
+
+    buf = (char *) malloc(LINE_MAX_SIZE);
+    while (1) {
+        char *start;
+        char *nl;
+        int res;
+
+        res = read(0, buf + len, LINE_MAX_SIZE - len);
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            break;
+        len += res;
+
+        /* All the lines we have go to the server, and then their answers
+         * come back */
+        start = buf;
+        while ((nl = memchr(start, '\n', len - (start - buf))) != NULL) {
+            *nl = '\0';
+            request(start);
+            start = nl + 1;
+        }
+        len -= start - buf;
+        memmove(buf, start, len);
+        if (len == LINE_MAX_SIZE) {
+            fprintf(stderr, "Too long session line\n");
+            exit(-1);
+        }
+        flush_pending();
+    }
+    if (len > 0) {
+        buf[len] = '\0';
+        request(buf);
+    }
+    flush_pending();
+    free(buf);
+}
@@ -11,7 +11,7 @@
 #include "main.h"
 
 /* Some externs refer to this variable */
-static sigset_t normal_sigmask;
+sigset_t normal_sigmask; /* as extern in execute.c, for posix_spawn */
 
 /* as extern in execute.c */
 int signals_child_pid; /* 0, not set. otherwise, set. */
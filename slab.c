@@ -0,0 +1,68 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2013  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <stdlib.h>
+
+#include "main.h"
+
+/* Records of a fixed size, cut from big chunks instead of a malloc() each:
+ * there is no malloc header per record, and the records of a kind stay
+ * close in memory, for the walks through the lists. The chunks are never
+ * given back; the records freed are reused. */
+
+enum {
+    SLAB_CHUNK_RECORDS = 256
+};
+
+static void add_chunk(struct Slab *s) {
+    char *chunk;
+    int i;
+
+    /* Room for the free list link, and aligned for pointers */
+    if (s->record_size < (int) sizeof(void *))
+        s->record_size = sizeof(void *);
+    s->record_size = (s->record_size + sizeof(void *) - 1)
+                     & ~(sizeof(void *) - 1);
+
+    chunk = (char *) malloc((size_t) s->record_size * SLAB_CHUNK_RECORDS);
+    if (chunk == 0)
+        error("Cannot allocate a chunk of %i records", SLAB_CHUNK_RECORDS);
+    for (i = SLAB_CHUNK_RECORDS - 1; i >= 0; --i) {
+        void **record = (void **) (chunk + (size_t) i * s->record_size);
+        *record = s->free_list;
+        s->free_list = record;
+    }
+    ++s->chunks;
+}
+
+void *slab_alloc(struct Slab *s) {
+    void **record;
+
+    if (s->free_list == 0)
+        add_chunk(s);
+    record = (void **) s->free_list;
+    s->free_list = *record;
+    ++s->used;
+    return record;
+}
+
+void slab_free(struct Slab *s, void *record) {
+    if (record == 0)
+        return;
+    *(void **) record = s->free_list;
+    s->free_list = record;
+    --s->used;
+}
+
+/* Bytes taken from the system */
+long slab_bytes(const struct Slab *s) {
+    return (long) s->chunks * SLAB_CHUNK_RECORDS * s->record_size;
+}
+
+/* Records that fit in the chunks */
+int slab_capacity(const struct Slab *s) {
+    return s->chunks * SLAB_CHUNK_RECORDS;
+}
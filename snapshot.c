@@ -0,0 +1,469 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2009  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "main.h"
+
+/* From jobs.c */
+extern int busy_slots;
+extern int max_slots;
+
+/* The server keeps the state of the queue in a file next to the socket
+ * (the socket path with ".snap"), mapped in memory, for the clients asking
+ * only about it (-s, -l, -q, -R, -S) to read without waking the server.
+ *
+ * The server rewrites it after each round of its loop, if it changed, and
+ * counts the writes in 'seq': odd while writing. A reader copies what it
+ * needs and takes it only if 'seq' was even and the same before and after
+ * the copy; otherwise it tries again, and in the end asks the server. */
+
+enum {
+    SNAPSHOT_MAGIC = 0x54535331, /* "TSS1" */
+    SNAPSHOT_INITIAL_SIZE = 64 * 1024,
+    /* Copies tried by a reader while the server writes */
+    SNAPSHOT_TRIES = 100
+};
+
+struct SnapshotHeader {
+    int magic;
+    int version;        /* PROTOCOL_VERSION */
+    atomic_uint seq;
+    int server_pid;
+    int size;           /* Of the file */
+    int used;           /* Bytes of the job records */
+    int num_jobs;
+    int busy_slots;
+    int max_slots;
+    int last_id;        /* As ts -q */
+    int last_jobid;     /* The job of ts -s without id. -1 for none */
+};
+
+/* A job, followed by its depend_on and the strings, each of them padded
+ * to an int */
+struct SnapshotJob {
+    int jobid;
+    int state;
+    int store_output;
+    int errorlevel;
+    int died_by_signal;
+    int signal;
+    float real_ms;
+    long long eta;      /* Expected end. 0 if unknown */
+    int num_gpus;
+    int depend_on_size;
+    int label_size;     /* NUL included. 0 for none */
+    int command_size;
+    int output_size;
+};
+
+/* Server side */
+static char *snap_path;
+static int snap_fd = -1;
+static struct SnapshotHeader *snap_map;
+/* The records being built, and the last ones written */
+static char *records;
+static int records_len;
+static int records_size;
+static char *written;
+static int written_len;
+static int num_jobs;
+
+static char *snapshot_path(const char *socket_path) {
+    char *p;
+
+    p = (char *) malloc(strlen(socket_path) + sizeof(".snap"));
+    if (p == 0)
+        error("Cannot allocate the snapshot path");
+    sprintf(p, "%s.snap", socket_path);
+    return p;
+}
+
+static int padded(int size) {
+    return (size + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+}
+
+static void *map(int fd, int size, int prot) {
+    void *p;
+
+    p = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/* Without the snapshot, the clients simply ask the server */
+void snapshot_open(const char *socket_path) {
+    snap_path = snapshot_path(socket_path);
+    snap_fd = open(snap_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (snap_fd == -1) {
+        warning("Cannot create the snapshot %s", snap_path);
+        return;
+    }
+    if (ftruncate(snap_fd, SNAPSHOT_INITIAL_SIZE) == -1
+        || (snap_map = map(snap_fd, SNAPSHOT_INITIAL_SIZE,
+                           PROT_READ | PROT_WRITE)) == NULL) {
+        warning("Cannot map the snapshot %s", snap_path);
+        snapshot_close();
+        return;
+    }
+    snap_map->magic = SNAPSHOT_MAGIC;
+    snap_map->version = PROTOCOL_VERSION;
+    atomic_init(&snap_map->seq, 0);
+    snap_map->server_pid = getpid();
+    snap_map->size = SNAPSHOT_INITIAL_SIZE;
+    snap_map->used = 0;
+    snap_map->num_jobs = 0;
+    snap_map->last_jobid = -1;
+}
+
+void snapshot_close() {
+    if (snap_map != NULL)
+        munmap(snap_map, snap_map->size);
+    snap_map = NULL;
+    if (snap_fd != -1) {
+        close(snap_fd);
+        unlink(snap_path);
+    }
+    snap_fd = -1;
+}
+
+static void add(const void *data, int len) {
+    int size = padded(len);
+
+    if (records_len + size > records_size) {
+        records_size = (records_len + size) * 2;
+        records = (char *) realloc(records, records_size);
+        if (records == NULL)
+            error("Cannot allocate the snapshot");
+    }
+    memcpy(records + records_len, data, len);
+    memset(records + records_len + len, 0, size - len);
+    records_len += size;
+}
+
+static int string_size(const char *str) {
+    return str ? strlen(str) + 1 : 0;
+}
+
+void snapshot_begin() {
+    records_len = 0;
+    num_jobs = 0;
+}
+
+void snapshot_add_job(const struct Job *p) {
+    struct SnapshotJob j;
+
+    if (snap_map == NULL)
+        return;
+    memset(&j, 0, sizeof(j));
+    j.jobid = p->jobid;
+    j.state = p->state;
+    j.store_output = p->store_output;
+    j.errorlevel = p->result.errorlevel;
+    j.died_by_signal = p->result.died_by_signal;
+    j.signal = p->result.signal;
+    j.real_ms = p->result.real_ms;
+    j.eta = p->eta;
+    j.num_gpus = p->num_gpus;
+    j.depend_on_size = p->depend_on_size;
+    j.label_size = string_size(p->label);
+    j.command_size = string_size(p->command);
+    j.output_size = string_size(p->output_filename);
+    add(&j, sizeof(j));
+    if (j.depend_on_size > 0)
+        add(p->depend_on, j.depend_on_size * sizeof(int));
+    if (j.label_size > 0)
+        add(p->label, j.label_size);
+    if (j.command_size > 0)
+        add(p->command, j.command_size);
+    if (j.output_size > 0)
+        add(p->output_filename, j.output_size);
+    ++num_jobs;
+}
+
+/* The file only grows, so the readers of a smaller map see it in 'size'
+ * and map it again */
+static int grow(int used) {
+    int size = snap_map->size;
+    struct SnapshotHeader *m;
+
+    while (size < (int) sizeof(*snap_map) + used)
+        size *= 2;
+    if (size == snap_map->size)
+        return 0;
+    if (ftruncate(snap_fd, size) == -1
+        || (m = map(snap_fd, size, PROT_READ | PROT_WRITE)) == NULL) {
+        warning("Cannot grow the snapshot to %i bytes", size);
+        return -1;
+    }
+    munmap(snap_map, snap_map->size);
+    snap_map = m;
+    snap_map->size = size;
+    return 0;
+}
+
+void snapshot_commit(int last_id, int last_jobid) {
+    struct SnapshotHeader *h = snap_map;
+    unsigned seq;
+
+    if (h == NULL)
+        return;
+    /* Nothing new, nothing to write */
+    if (atomic_load_explicit(&h->seq, memory_order_relaxed) != 0
+        && records_len == written_len && h->num_jobs == num_jobs
+        && h->busy_slots == busy_slots && h->max_slots == max_slots
+        && h->last_id == last_id && h->last_jobid == last_jobid
+        && memcmp(records, written, records_len) == 0)
+        return;
+
+    if (grow(records_len) == -1) {
+        /* Better nothing than an old state */
+        snapshot_close();
+        return;
+    }
+    h = snap_map;
+
+    seq = atomic_load_explicit(&h->seq, memory_order_relaxed);
+    atomic_store_explicit(&h->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    h->used = records_len;
+    h->num_jobs = num_jobs;
+    h->busy_slots = busy_slots;
+    h->max_slots = max_slots;
+    h->last_id = last_id;
+    h->last_jobid = last_jobid;
+    memcpy(h + 1, records, records_len);
+
+    atomic_store_explicit(&h->seq, seq + 2, memory_order_release);
+
+    written = (char *) realloc(written, records_len > 0 ? records_len : 1);
+    if (written == NULL)
+        error("Cannot allocate the snapshot");
+    memcpy(written, records, records_len);
+    written_len = records_len;
+}
+
+/* Client side */
+
+struct Snapshot {
+    struct SnapshotHeader h;
+    char *records;
+};
+
+static int server_alive(int pid) {
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+/* A consistent copy of the snapshot, or -1 */
+static int snapshot_read(struct Snapshot *s) {
+    char *path;
+    char *sockpath;
+    struct stat st;
+    struct SnapshotHeader *h = NULL;
+    int mapped = 0;
+    int fd;
+    int i;
+    int res = -1;
+
+    create_socket_path(&sockpath);
+    path = snapshot_path(sockpath);
+    free(sockpath);
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &st) == -1 || st.st_uid != getuid()
+        || st.st_size < (off_t) sizeof(*h)) {
+        close(fd);
+        return -1;
+    }
+
+    s->records = NULL;
+    for (i = 0; i < SNAPSHOT_TRIES; ++i) {
+        unsigned seq;
+        int size;
+
+        if (h == NULL) {
+            if (fstat(fd, &st) == -1)
+                break;
+            mapped = st.st_size;
+            h = map(fd, mapped, PROT_READ);
+            if (h == NULL)
+                break;
+            if (h->magic != SNAPSHOT_MAGIC || h->version != PROTOCOL_VERSION
+                || !server_alive(h->server_pid))
+                break;
+        }
+
+        /* Odd while written, and 0 before the first write */
+        seq = atomic_load_explicit(&h->seq, memory_order_acquire);
+        if ((seq & 1) || seq == 0)
+            continue;
+        size = h->size;
+        if (size > mapped) {
+            /* It grew: map it again */
+            munmap(h, mapped);
+            h = NULL;
+            continue;
+        }
+        memcpy(&s->h, h, sizeof(s->h));
+        if (s->h.used < 0 || s->h.used > mapped - (int) sizeof(*h))
+            continue;
+        s->records = (char *) realloc(s->records, s->h.used > 0 ? s->h.used : 1);
+        if (s->records == NULL)
+            break;
+        memcpy(s->records, h + 1, s->h.used);
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&h->seq, memory_order_relaxed) == seq) {
+            res = 0;
+            break;
+        }
+    }
+    if (h != NULL)
+        munmap(h, mapped);
+    close(fd);
+    if (res == -1)
+        free(s->records);
+    return res;
+}
+
+/* The job records, as struct Job with pointers into the records */
+static struct Job *snapshot_jobs(const struct Snapshot *s) {
+    struct Job *jobs;
+    const char *ptr = s->records;
+    int i;
+
+    jobs = (struct Job *) calloc(s->h.num_jobs > 0 ? s->h.num_jobs : 1,
+                                 sizeof(*jobs));
+    if (jobs == NULL)
+        error("Cannot allocate the snapshot jobs");
+    for (i = 0; i < s->h.num_jobs; ++i) {
+        struct SnapshotJob j;
+        struct Job *p = &jobs[i];
+
+        memcpy(&j, ptr, sizeof(j));
+        ptr += padded(sizeof(j));
+        p->jobid = j.jobid;
+        p->state = j.state;
+        p->store_output = j.store_output;
+        p->result.errorlevel = j.errorlevel;
+        p->result.died_by_signal = j.died_by_signal;
+        p->result.signal = j.signal;
+        p->result.real_ms = j.real_ms;
+        p->eta = (time_t) j.eta;
+        p->num_gpus = j.num_gpus;
+        p->depend_on_size = j.depend_on_size;
+        if (j.depend_on_size > 0) {
+            p->depend_on = (int *) ptr;
+            ptr += padded(j.depend_on_size * sizeof(int));
+        }
+        if (j.label_size > 0) {
+            p->label = (char *) ptr;
+            ptr += padded(j.label_size);
+        }
+        if (j.command_size > 0) {
+            p->command = (char *) ptr;
+            ptr += padded(j.command_size);
+        } else
+            p->command = "";
+        if (j.output_size > 0) {
+            p->output_filename = (char *) ptr;
+            ptr += padded(j.output_size);
+        }
+    }
+    return jobs;
+}
+
+static void list_jobs(const struct Snapshot *s, const struct Job *jobs) {
+    char *line;
+    int i;
+
+    busy_slots = s->h.busy_slots;
+    max_slots = s->h.max_slots;
+    line = joblist_headers();
+    fputs(line, stdout);
+    free(line);
+    for (i = 0; i < s->h.num_jobs; ++i) {
+        if (jobs[i].state == HOLDING_CLIENT)
+            continue;
+        line = joblist_line(&jobs[i]);
+        fputs(line, stdout);
+        free(line);
+    }
+}
+
+/* Answers the request from the snapshot, if it can: returns 1 then. Else,
+ * as for a job not there, the server has to answer. */
+int c_snapshot_query() {
+    struct Snapshot s;
+    struct Job *jobs;
+    int jobid;
+    int answered = 1;
+    int i;
+
+    switch (command_line.request) {
+        case c_GET_STATE:
+        case c_COUNT_RUNNING:
+        case c_LAST_ID:
+        case c_GET_MAX_SLOTS:
+            break;
+        case c_LIST:
+            if (command_line.list_format != DEFAULT)
+                return 0;
+            break;
+        default:
+            return 0;
+    }
+    if (getenv("TS_SNAPSHOT") != NULL && strcmp(getenv("TS_SNAPSHOT"), "0") == 0)
+        return 0;
+    if (snapshot_read(&s) == -1)
+        return 0;
+    jobs = snapshot_jobs(&s);
+
+    switch (command_line.request) {
+        case c_GET_STATE:
+            jobid = command_line.jobid == -1 ? s.h.last_jobid : command_line.jobid;
+            for (i = 0; i < s.h.num_jobs; ++i)
+                if (jobs[i].jobid == jobid)
+                    break;
+            if (jobid == -1 || i == s.h.num_jobs)
+                answered = 0;
+            else
+                printf("%s\n", jstate2string(jobs[i].state));
+            break;
+        case c_COUNT_RUNNING:
+            jobid = 0;
+            for (i = 0; i < s.h.num_jobs; ++i)
+                if (jobs[i].state == RUNNING)
+                    ++jobid;
+            printf("%i\n", jobid);
+            break;
+        case c_LAST_ID:
+            printf("%d\n", s.h.last_id);
+            break;
+        case c_GET_MAX_SLOTS:
+            printf("%i\n", s.h.max_slots);
+            break;
+        case c_LIST:
+            list_jobs(&s, jobs);
+            break;
+        default:
+            answered = 0;
+    }
+    free(jobs);
+    free(s.records);
+    return answered;
+}
@@ -0,0 +1,260 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2013  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "cjson/cJSON.h"
+
+/* ts --stats: counts and times of the finished jobs, those of the history
+ * (TS_HISTORY) and those the server keeps, in groups. Each job is seen
+ * once; the percentiles come from histograms of the times, not from the
+ * times themselves. */
+
+enum {
+    /* Buckets of a histogram, in ms: exact up to 16, then 16 for each power
+     * of two, up to 2^40 ms. The value of a bucket is 3% off at most. */
+    HIST_EXACT = 16,
+    HIST_MAX_BIT = 40,
+    HIST_BUCKETS = 16 * (HIST_MAX_BIT - 2)
+};
+
+struct Group {
+    char *key;
+    int jobs;
+    int failed;
+    int ran; /* Jobs with times: not the skipped */
+    double run_sum;
+    double wait_sum;
+    unsigned int run_hist[HIST_BUCKETS];
+    unsigned int wait_hist[HIST_BUCKETS];
+    struct Group *next;
+};
+
+struct Stats {
+    enum StatsBy by;
+    struct Group *first;
+    struct Group *last;
+};
+
+static int bucket_of(float seconds) {
+    unsigned long long ms;
+    int e;
+
+    if (seconds <= 0)
+        return 0;
+    ms = (unsigned long long) (seconds * 1000);
+    if (ms < HIST_EXACT)
+        return (int) ms;
+    for (e = 4; e < HIST_MAX_BIT && (ms >> (e + 1)) != 0; ++e)
+        ;
+    if ((ms >> (e + 1)) != 0)
+        return HIST_BUCKETS - 1;
+    return 16 * (e - 3) + (int) ((ms >> (e - 4)) & 15);
+}
+
+/* In seconds, the middle of the bucket */
+static double bucket_value(int b) {
+    unsigned long long low;
+    unsigned long long width;
+    int e;
+
+    if (b < HIST_EXACT)
+        return b / 1000.;
+    e = b / 16 + 3;
+    width = 1ULL << (e - 4);
+    low = (unsigned long long) (b % 16 + 16) << (e - 4);
+    return (low + (width - 1) / 2.) / 1000.;
+}
+
+static double percentile(const unsigned int *hist, int count, double q) {
+    unsigned int rank;
+    unsigned int seen = 0;
+    int b;
+
+    if (count == 0)
+        return 0;
+    rank = (unsigned int) (q * count);
+    if (rank < q * count || rank == 0)
+        ++rank;
+    for (b = 0; b < HIST_BUCKETS; ++b) {
+        seen += hist[b];
+        if (seen >= rank)
+            return bucket_value(b);
+    }
+    return bucket_value(HIST_BUCKETS - 1);
+}
+
+static const char *by_title(enum StatsBy by) {
+    switch (by) {
+        case STATS_LABEL:
+            return "Label";
+        case STATS_STATE:
+            return "State";
+        case STATS_EXIT:
+            return "Exit";
+        default:
+            return "Jobs";
+    }
+}
+
+static void group_key(enum StatsBy by, const struct Job *p, char *key,
+                      int size) {
+    switch (by) {
+        case STATS_LABEL:
+            snprintf(key, size, "%s", p->label != 0 ? p->label : "(none)");
+            break;
+        case STATS_STATE:
+            snprintf(key, size, "%s", jstate2string(p->state));
+            break;
+        case STATS_EXIT:
+            if (p->state == SKIPPED)
+                snprintf(key, size, "skipped");
+            else if (p->result.died_by_signal)
+                snprintf(key, size, "signal %i", p->result.signal);
+            else
+                snprintf(key, size, "%i", p->result.errorlevel);
+            break;
+        default:
+            snprintf(key, size, "all");
+    }
+}
+
+static struct Group *find_group(struct Stats *st, const char *key) {
+    struct Group *g;
+
+    for (g = st->first; g != 0; g = g->next)
+        if (strcmp(g->key, key) == 0)
+            return g;
+
+    g = (struct Group *) calloc(1, sizeof(*g));
+    if (g == 0)
+        error("Cannot allocate a group of --stats");
+    g->key = strdup(key);
+    if (st->last == 0)
+        st->first = g;
+    else
+        st->last->next = g;
+    st->last = g;
+    return g;
+}
+
+static void add_job(const struct Job *p, void *data) {
+    struct Stats *st = (struct Stats *) data;
+    struct Group *g;
+    char key[200];
+    float wait;
+
+    group_key(st->by, p, key, sizeof(key));
+    g = find_group(st, key);
+    ++g->jobs;
+    if (p->state == FINISHED
+        && (p->result.errorlevel != 0 || p->result.died_by_signal))
+        ++g->failed;
+
+    wait = pinfo_time_queued(&p->info);
+    if (wait < 0)
+        return;
+    ++g->ran;
+    g->run_sum += p->result.real_ms;
+    g->wait_sum += wait;
+    ++g->run_hist[bucket_of(p->result.real_ms)];
+    ++g->wait_hist[bucket_of(wait)];
+}
+
+static void send_table(int s, const struct Stats *st) {
+    const struct Group *g;
+    char line[400];
+
+    snprintf(line, sizeof(line),
+             "%-20s %6s %6s %6s %10s %9s %9s %9s %9s %9s %9s\n",
+             by_title(st->by), "Count", "Failed", "Fail%", "Run-sum",
+             "Run-mean", "Run-p50", "Run-p95", "Wait-mean", "Wait-p50",
+             "Wait-p95");
+    send_list_line(s, line);
+    for (g = st->first; g != 0; g = g->next) {
+        int ran = g->ran > 0 ? g->ran : 1;
+
+        snprintf(line, sizeof(line),
+                 "%-20s %6i %6i %5.1f%% %9.2fs %8.2fs %8.2fs %8.2fs "
+                 "%8.2fs %8.2fs %8.2fs\n",
+                 g->key, g->jobs, g->failed, 100. * g->failed / g->jobs,
+                 g->run_sum, g->run_sum / ran,
+                 percentile(g->run_hist, g->ran, 0.5),
+                 percentile(g->run_hist, g->ran, 0.95),
+                 g->wait_sum / ran,
+                 percentile(g->wait_hist, g->ran, 0.5),
+                 percentile(g->wait_hist, g->ran, 0.95));
+        send_list_line(s, line);
+    }
+}
+
+static void send_json(int s, const struct Stats *st) {
+    const struct Group *g;
+    cJSON *groups;
+    char *buffer;
+
+    groups = cJSON_CreateArray();
+    if (groups == NULL)
+        error("Error initializing JSON array.");
+    for (g = st->first; g != 0; g = g->next) {
+        cJSON *o = cJSON_CreateObject();
+        int ran = g->ran > 0 ? g->ran : 1;
+
+        if (o == NULL)
+            error("Error initializing JSON object for the group %s.", g->key);
+        cJSON_AddItemToArray(groups, o);
+        cJSON_AddStringToObject(o, by_title(st->by), g->key);
+        cJSON_AddNumberToObject(o, "Count", g->jobs);
+        cJSON_AddNumberToObject(o, "Failed", g->failed);
+        cJSON_AddNumberToObject(o, "Run_sum", g->run_sum);
+        cJSON_AddNumberToObject(o, "Run_mean", g->run_sum / ran);
+        cJSON_AddNumberToObject(o, "Run_p50",
+                                percentile(g->run_hist, g->ran, 0.5));
+        cJSON_AddNumberToObject(o, "Run_p95",
+                                percentile(g->run_hist, g->ran, 0.95));
+        cJSON_AddNumberToObject(o, "Wait_sum", g->wait_sum);
+        cJSON_AddNumberToObject(o, "Wait_mean", g->wait_sum / ran);
+        cJSON_AddNumberToObject(o, "Wait_p50",
+                                percentile(g->wait_hist, g->ran, 0.5));
+        cJSON_AddNumberToObject(o, "Wait_p95",
+                                percentile(g->wait_hist, g->ran, 0.95));
+    }
+
+    buffer = cJSON_PrintUnformatted(groups);
+    if (buffer == NULL)
+        error("Error converting the stats to JSON.");
+    buffer = realloc(buffer, strlen(buffer) + 2);
+    strcat(buffer, "\n");
+    send_list_line(s, buffer);
+    free(buffer);
+    cJSON_Delete(groups);
+}
+
+void s_stats(int s, enum StatsBy by, enum ListFormat format) {
+    struct Stats st;
+    struct Group *g;
+
+    st.by = by;
+    st.first = 0;
+    st.last = 0;
+    history_each(add_job, &st);
+    s_each_finished(add_job, &st);
+
+    if (format == JSON)
+        send_json(s, &st);
+    else
+        send_table(s, &st);
+
+    while (st.first != 0) {
+        g = st.first;
+        st.first = g->next;
+        free(g->key);
+        free(g);
+    }
+}
@@ -4,6 +4,7 @@
 
     Please find the license in the provided COPYING file.
 */
+#define _GNU_SOURCE /* memrchr */
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
@@ -11,28 +12,22 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
-#include <sys/select.h>
+#include <poll.h>
 #include <stdlib.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/sendfile.h>
+#endif
 
 #include <sys/time.h> /* Dep de main.h */
 
 #include "main.h"
 
-enum { BSIZE=1024 };
-
-static int min(int a, int b)
-{
-    if (a < b)
-        return a;
-    return b;
-}
-
-static int max(int a, int b)
+enum
 {
-    if (a > b)
-        return a;
-    return b;
-}
+    BSIZE=64*1024,
+    DIRECT_SIZE=1024*1024*1024 /* Max bytes per in-kernel copy call */
+};
 
 static void tail_error(const char *str)
 {
@@ -42,174 +37,680 @@ static void tail_error(const char *str)
     exit(-1);
 }
 
+/* Last newline in buf, or NULL */
+const char *last_newline(const char *buf, size_t len)
+{
+#ifdef __GLIBC__
+    return (const char *) memrchr(buf, '\n', len);
+#else
+    while(len > 0)
+    {
+        --len;
+        if (buf[len] == '\n')
+            return buf + len;
+    }
+    return NULL;
+#endif
+}
+
+/* Leave the file cursor at the start of the 'lines' last lines.
+ * It reads backwards in big blocks, so on a huge file it only touches
+ * the end of it. */
 static void seek_at_last_lines(int fd, int lines)
 {
-    char buf[BSIZE];
+    char *buf;
+    off_t pos;
+    off_t start = 0;
     int lines_found = 0;
-    int last_lseek = BSIZE;
-    int last_read = 0; /* Only to catch not doing any loop */
-    int move_offset;
-    int i = -1; /* Only to catch not doing any loop */
+    int first = 1;
 
-    last_lseek = lseek(fd, 0, SEEK_END);
+    pos = lseek(fd, 0, SEEK_END);
+    if (pos == -1)
+        tail_error("Error seeking");
 
-    do
-    {
-        int next_read;
-        next_read = min(last_lseek, BSIZE);
-
-        /* we should end looping if last_lseek == 0
-         * This means we already read all the file. */
-        if (next_read <= 0)
-            break;
+    if (lines == 0)
+        return;
 
-        /* last_lseek will be -1 at the beginning of the file,
-         * if we wanted to go farer than it. */
-        last_lseek = lseek(fd, -next_read, SEEK_CUR);
+    buf = (char *) malloc(BSIZE);
+    if (buf == NULL)
+        tail_error("Not enough memory");
 
-        if (last_lseek == -1)
-            last_lseek = lseek(fd, 0, SEEK_SET);
+    while(pos > 0)
+    {
+        size_t next_read;
+        ssize_t last_read;
+        const char *nl;
 
-        last_read = read(fd, buf, next_read);
+        next_read = pos < BSIZE ? (size_t) pos : BSIZE;
+        last_read = pread(fd, buf, next_read, pos - next_read);
         if (last_read == -1)
         {
             if (errno == EINTR)
                 continue;
             tail_error("Error reading");
         }
+        if ((size_t) last_read != next_read)
+            break; /* Truncated under us. Show it all. */
+        pos -= next_read;
 
+        /* The newline ending the file closes the last line, it does not
+         * start a new one */
+        if (first && buf[last_read - 1] == '\n')
+            --last_read;
+        first = 0;
 
-        for(i = last_read-1; i >= 0; --i)
+        while((nl = last_newline(buf, last_read)) != NULL)
         {
-            if (buf[i] == '\n')
-            {
-                ++lines_found;
-                if (lines_found > lines)
-                    /* We will use 'i' to calculate where to
-                     * put the file cursor, before return. */
-                    break;
-            }
+            if (++lines_found == lines)
+                break;
+            last_read = nl - buf;
         }
-        
-        /* Go back the read bytes */
-        last_lseek = lseek(fd, -last_read, SEEK_CUR);
-    } while(lines_found < lines);
+        if (nl != NULL)
+        {
+            start = pos + (nl - buf) + 1;
+            break;
+        }
+    }
+    free(buf);
 
-    /* Calculate the position */
-    move_offset = i+1;
-    lseek(fd, move_offset, SEEK_CUR);
+    lseek(fd, start, SEEK_SET);
 }
 
-static void set_non_blocking(int fd)
+/* How many bytes of buf make up to '*lines' complete lines.
+ * It decrements *lines by the lines found. */
+static int head_length(const char *buf, int len, int *lines)
 {
-    long arg;
+    const char *ptr = buf;
+    const char *end = buf + len;
 
-    arg = O_RDONLY | O_NONBLOCK;
-    fcntl(fd, F_SETFL, arg);
+    while(*lines > 0 && ptr < end)
+    {
+        const char *nl;
+        nl = (const char *) memchr(ptr, '\n', end - ptr);
+        if (nl == NULL)
+            return len;
+        ptr = nl + 1;
+        --*lines;
+    }
+    return ptr - buf;
 }
 
-/* if last_lines == -1, go on from the start of the file */
-int tail_file(const char *fname, int last_lines)
+/* One output file followed by tail_many() */
+struct Follow
 {
+    char *fname;
+    int jobid;
     int fd;
-    int res;
-    int waiting_end = 1;
-    int end_res = 0;
-    int endfile_reached = 0;
-    int could_write = 1;
-
-    fd_set readset, errorset;
-
-    fd = open(fname, O_RDONLY);
+    int socket; /* waiting for the job end on it; -1 once it arrived */
+    int wd;     /* inotify watch descriptor */
+    int dirty;  /* there may be new data to read */
+    int lines_left; /* lines still to show, or -1 if not limited */
+    enum Compression comp; /* how the file is compressed, if it is */
+    off_t zoff; /* next frame to show, in a compressed file */
+    int zskip;  /* bytes of that frame already shown */
+    off_t end_off; /* where to stop showing, or -1 if not limited */
+    int skip;   /* the command line is still to be skipped (SKIP_*) */
+    int end_res;
+};
+
+static int could_write;
+static int last_shown = -1; /* Follow index of the last header printed */
+
+static void write_all(const char *buf, int len)
+{
+    while(len > 0 && could_write)
+    {
+        int wres;
+        wres = write(1, buf, len);
+        /* Maybe the listener doesn't want to receive more */
+        if (wres < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            could_write = 0;
+            break;
+        }
+        buf += wres;
+        len -= wres;
+    }
+}
 
-    if (fd == -1)
-        tail_error("Error: cannot open the output file");
+static void show_header(struct Follow *f, int index, int headers)
+{
+    char line[64];
+    int len;
+
+    if (!headers || last_shown == index)
+        return;
+    len = snprintf(line, sizeof line, "%s==> job %i <==\n",
+            last_shown == -1 ? "" : "\n", f->jobid);
+    write_all(line, len);
+    last_shown = index;
+}
 
-    if (last_lines >= 0)
-        seek_at_last_lines(fd, last_lines);
+#ifdef __linux__
+/* How the output can go to stdout without passing through our buffer */
+static enum
+{
+    COPY_UNKNOWN,
+    COPY_RANGE,    /* copy_file_range(), stdout is a regular file */
+    COPY_SPLICE,   /* splice(), stdout is a pipe */
+    COPY_SENDFILE, /* sendfile(), anything else */
+    COPY_BUFFER    /* read() and write() */
+} copy_mode = COPY_UNKNOWN;
+
+static void choose_copy_mode()
+{
+    struct stat st;
+
+    if (fstat(1, &st) == -1)
+        copy_mode = COPY_BUFFER;
+    else if (S_ISREG(st.st_mode))
+        copy_mode = COPY_RANGE;
+    else if (S_ISFIFO(st.st_mode))
+        copy_mode = COPY_SPLICE;
+    else
+        copy_mode = COPY_SENDFILE;
+}
+#endif
 
-    /* we don't want the next read calls to block. */
-    set_non_blocking(fd);
+/* Copy the file from its offset up to its end into stdout, in the kernel.
+ * Returns -1 if it could not, and the caller has to read() and write() from
+ * the offset where it stopped. */
+static int copy_direct(int fd)
+{
+#ifdef __linux__
+    if (copy_mode == COPY_UNKNOWN)
+        choose_copy_mode();
 
-    do
+    while(copy_mode != COPY_BUFFER && could_write)
     {
-        char buf[BSIZE];
-        int maxfd;
+        ssize_t res;
 
-        FD_ZERO(&readset);
-        maxfd = -1;
-        if (!endfile_reached)
+        if (copy_mode == COPY_RANGE)
+            res = copy_file_range(fd, NULL, 1, NULL, DIRECT_SIZE, 0);
+        else if (copy_mode == COPY_SPLICE)
+            res = splice(fd, NULL, 1, NULL, DIRECT_SIZE, SPLICE_F_MORE);
+        else
+            res = sendfile(1, fd, NULL, DIRECT_SIZE);
+
+        if (res == 0)
+            return 0;
+        if (res > 0)
+            continue;
+        if (errno == EINTR)
+            continue;
+        if (errno == EPIPE)
         {
-            FD_SET(fd, &readset);
-            maxfd = fd;
+            could_write = 0;
+            return 0;
         }
-        if (waiting_end)
+        /* Not possible for these files (O_APPEND, other filesystem, old
+         * kernel...). Try the next way. */
+        if (copy_mode == COPY_RANGE)
+            copy_mode = COPY_SENDFILE;
+        else
+            copy_mode = COPY_BUFFER;
+    }
+#endif
+    return -1;
+}
+
+static void bad_frame(const struct Follow *f)
+{
+    fprintf(stderr, "Error: bad compressed frame in %s at offset %lld\n",
+            f->fname, (long long) f->zoff);
+    exit(-1);
+}
+
+/* Leave f->zoff at the frame holding the start of the 'lines' last lines
+ * of the compressed file. The frame headers tell where every frame is, and
+ * only the frames at the end have to be decompressed. */
+static void seek_frames_last_lines(struct Follow *f, int lines)
+{
+    off_t *offsets = NULL;
+    int noffsets = 0;
+    int allocated = 0;
+    off_t off = ZHEADER_SIZE;
+    unsigned int raw_len, comp_len;
+    int lines_found = 0;
+    int first = 1;
+    int i;
+
+    while(zframes_read_header(f->fd, off, &raw_len, &comp_len) == 1)
+    {
+        if (noffsets == allocated)
         {
-            FD_SET(server_socket, &readset);
-            maxfd = max(maxfd, server_socket);
+            allocated = allocated ? allocated * 2 : 64;
+            offsets = (off_t *) realloc(offsets, allocated * sizeof(off_t));
+            if (offsets == NULL)
+                tail_error("Not enough memory");
         }
+        offsets[noffsets++] = off;
+        off += ZFRAME_HEADER_SIZE + comp_len;
+    }
 
-        FD_ZERO(&errorset);
-        FD_SET(1, &errorset);
-        maxfd = max(maxfd, server_socket);
+    f->zoff = ZHEADER_SIZE;
+    f->zskip = 0;
+    if (lines == 0)
+        f->zoff = off;
 
-        /* If we don't have fd's to wait for, let's sleep */
-        if (maxfd == -1)
+    for(i = noffsets - 1; i >= 0 && lines > 0; --i)
+    {
+        char *data;
+        int len;
+        const char *nl;
+
+        f->zoff = offsets[i];
+        zframes_read_header(f->fd, offsets[i], &raw_len, &comp_len);
+        data = zframes_decode(f->fd, f->comp, offsets[i], raw_len, comp_len);
+        if (data == NULL)
+            bad_frame(f);
+
+        len = raw_len;
+        if (first && len > 0 && data[len - 1] == '\n')
+            --len;
+        first = 0;
+
+        while((nl = last_newline(data, len)) != NULL)
         {
-            usleep(1 /* sec */* 1000000);
-        } else
+            if (++lines_found == lines)
+                break;
+            len = nl - data;
+        }
+        if (nl != NULL)
+            f->zskip = nl - data + 1;
+        free(data);
+        if (nl != NULL)
+            break;
+    }
+    free(offsets);
+}
+
+/* How many bytes of data belong yet to the command line. Also for
+ * ts --grep. */
+int skip_length(int *skip, const char *data, int len)
+{
+    const char *nl;
+    int n = 0;
+
+    if (*skip == SKIP_LINE)
+    {
+        nl = (const char *) memchr(data, '\n', len);
+        if (nl == NULL)
+            return len;
+        n = nl - data + 1;
+        *skip = SKIP_NUL;
+    }
+    if (*skip == SKIP_NUL && n < len)
+    {
+        if (data[n] == '\0')
+            ++n;
+        *skip = SKIP_NONE;
+    }
+    return n;
+}
+
+/* Shows the complete frames from f->zoff on */
+static void drain_frames(struct Follow *f, int index, int headers)
+{
+    unsigned int raw_len, comp_len;
+    int res;
+
+    while(could_write)
+    {
+        char *data;
+        int len;
+
+        res = zframes_read_header(f->fd, f->zoff, &raw_len, &comp_len);
+        if (res == 0)
+            break; /* Not fully written yet */
+        if (res == -1)
+            bad_frame(f);
+        data = zframes_decode(f->fd, f->comp, f->zoff, raw_len, comp_len);
+        if (data == NULL)
+            bad_frame(f);
+
+        if (f->skip != SKIP_NONE)
+            f->zskip += skip_length(&f->skip, data + f->zskip, raw_len - f->zskip);
+        len = raw_len - f->zskip;
+        if (len > 0)
         {
-            /* Otherwise, do a normal select */
-            struct timeval tv = {1 /*sec*/, 0 };
-            res = select(maxfd + 1, &readset, 0, &errorset, &tv);
+            if (f->lines_left > 0)
+                len = head_length(data + f->zskip, len, &f->lines_left);
+            show_header(f, index, headers);
+            write_all(data + f->zskip, len);
         }
+        free(data);
+        f->zskip = 0;
+        f->zoff += ZFRAME_HEADER_SIZE + comp_len;
 
-        if (FD_ISSET(server_socket, &readset))
+        if (f->lines_left == 0)
         {
-            end_res = c_wait_job_recv();
-            waiting_end = 0;
+            f->socket = -1;
+            break;
         }
+    }
+}
 
-        /* We always read when select awakes */
-        res = read(fd, buf, BSIZE);
-        if (res == -1)
+/* Read everything available in the file, up to its current end */
+static void drain(struct Follow *f, int index, int headers)
+{
+    char buf[BSIZE];
+    struct stat st;
+    int res;
+
+    f->dirty = 0;
+    if (f->lines_left == 0)
+        return;
+    if (f->comp != COMPRESS_NONE)
+    {
+        drain_frames(f, index, headers);
+        return;
+    }
+    /* The ring output policy cuts the start of the file */
+    if (fstat(f->fd, &st) == 0 && st.st_size < lseek(f->fd, 0, SEEK_CUR))
+        lseek(f->fd, 0, SEEK_SET);
+    /* With headers or a limit, we have to look at the data */
+    if (!headers && f->lines_left == -1 && f->end_off == -1
+        && f->skip == SKIP_NONE && copy_direct(f->fd) == 0)
+        return;
+    do
+    {
+        int want = BSIZE;
+        if (f->end_off != -1)
         {
-            if (errno == EINTR || errno == EAGAIN)
+            off_t left = f->end_off - lseek(f->fd, 0, SEEK_CUR);
+            if (left <= 0)
             {
-                res = 1; /* Hack for the while condition */
-                continue;
+                f->lines_left = 0; /* Nothing more to show */
+                break;
             }
+            if (left < want)
+                want = left;
+        }
+        res = read(f->fd, buf, want);
+        if (res == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
             tail_error("Error reading");
         }
+        if (res > 0)
+        {
+            int skip = f->skip != SKIP_NONE ? skip_length(&f->skip, buf, res) : 0;
+            int len = res - skip;
+            if (len == 0)
+                continue;
+            if (f->lines_left > 0)
+                len = head_length(buf + skip, len, &f->lines_left);
+            show_header(f, index, headers);
+            write_all(buf + skip, len);
+            if (f->lines_left == 0)
+            {
+                /* We have shown all we wanted. Don't wait for the end. */
+                f->socket = -1;
+                break;
+            }
+        }
+    } while(res > 0 && could_write);
+}
 
-        if (res == 0)
-            endfile_reached = 1;
-        else
-            endfile_reached = 0;
+/* Places the file at the time range of --since or --between, looking it up
+ * in the time index of the output */
+static void seek_at_time(struct Follow *f)
+{
+    struct stat st;
+    off_t start;
+    off_t end;
+
+    if (f->comp != COMPRESS_NONE
+        || tindex_lookup(f->fname, command_line.time_since,
+            command_line.time_until, &start, &end) == -1)
+        tail_error("Error: the output has no time index (see --time-index)");
+
+    if (start == -1)
+        start = lseek(f->fd, 0, SEEK_END);
+    else
+        lseek(f->fd, start, SEEK_SET);
+
+    if (end == -2)
+        end = fstat(f->fd, &st) == 0 ? st.st_size : start;
+    f->end_off = end;
+    /* A closed range is there already. Don't wait for the job. */
+    if (end != -1)
+        f->socket = -1;
+}
+
+/* Whether the output file got rotated, and the name has a new file */
+static int replaced(const struct Follow *f)
+{
+    struct stat st_name;
+    struct stat st_fd;
+
+    if (stat(f->fname, &st_name) == -1 || fstat(f->fd, &st_fd) == -1)
+        return 0;
+    return st_name.st_ino != st_fd.st_ino || st_name.st_dev != st_fd.st_dev;
+}
+
+static void watch(struct Follow *f, int ifd)
+{
+#ifdef __linux__
+    if (ifd != -1)
+        f->wd = inotify_add_watch(ifd, f->fname, IN_MODIFY | IN_CLOSE_WRITE
+                | IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB);
+#endif
+}
+
+/* Goes on with the new file under the name. Returns 0 if it could not. */
+static int reopen(struct Follow *f, int ifd)
+{
+    int fd;
+
+    fd = open(f->fname, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    close(f->fd);
+#ifdef __linux__
+    if (ifd != -1 && f->wd != -1)
+        inotify_rm_watch(ifd, f->wd);
+#endif
+    f->fd = fd;
+    f->comp = zframes_check(fd);
+    f->zoff = ZHEADER_SIZE;
+    f->zskip = 0;
+    f->dirty = 1;
+    watch(f, ifd);
+    return 1;
+}
+
+/* Blocks until some file or server socket has something new.
+ * ifd is the inotify descriptor, or -1 if we have to poll the files. */
+static void wait_events(struct Follow *f, int num, int ifd)
+{
+    struct pollfd *pfd;
+    int npfd = 0;
+    int i;
+    int res;
+
+    pfd = (struct pollfd *) malloc((num + 2) * sizeof(*pfd));
+
+    /* We only want to know if the reader of our stdout went away */
+    pfd[npfd].fd = 1;
+    pfd[npfd++].events = 0;
+    if (ifd != -1)
+    {
+        pfd[npfd].fd = ifd;
+        pfd[npfd++].events = POLLIN;
+    }
+    for(i = 0; i < num; ++i)
+    {
+        pfd[npfd].fd = f[i].socket; /* poll() ignores the negative ones */
+        pfd[npfd++].events = POLLIN;
+    }
+
+    /* Without inotify, wake up every second to look at the files */
+    res = poll(pfd, npfd, ifd == -1 ? 1000 : -1);
+    if (res == -1)
+    {
+        free(pfd);
+        if (errno == EINTR)
+            return;
+        tail_error("Error in poll");
+    }
+
+    /* Also if stdout got closed, or we would poll it again and again */
+    if (pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+        could_write = 0;
+
+    if (ifd == -1)
+    {
+        for(i = 0; i < num; ++i)
+            f[i].dirty = 1;
+    }
+#ifdef __linux__
+    else if (pfd[1].revents & POLLIN)
+    {
+        char evbuf[4096]
+            __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        int len;
 
-        if (!FD_ISSET(1, &errorset))
+        while((len = read(ifd, evbuf, sizeof evbuf)) > 0)
         {
-            while(res > 0)
+            char *ptr;
+            for(ptr = evbuf; ptr < evbuf + len;
+                    ptr += sizeof(struct inotify_event)
+                        + ((struct inotify_event *) ptr)->len)
             {
-                int wres;
-                wres = write(1, buf, res);
-                /* Maybe the listener doesn't want to receive more */
-                if (wres < 0)
-                {
-                    could_write = 0;
-                    break;
-                }
-                res -= wres;
+                const struct inotify_event *ev;
+                ev = (const struct inotify_event *) ptr;
+                /* On IN_Q_OVERFLOW (wd -1), events got lost: look at all */
+                for(i = 0; i < num; ++i)
+                    if (f[i].wd == ev->wd || (ev->mask & IN_Q_OVERFLOW))
+                        f[i].dirty = 1;
             }
         }
-        else
+    }
+#endif
+
+    for(i = 0; i < num; ++i)
+    {
+        if (f[i].socket != -1 && (pfd[npfd - num + i].revents & POLLIN))
         {
-            could_write = 0;
-            break;
+            f[i].end_res = c_wait_job_recv_from(f[i].socket);
+            f[i].socket = -1;
+            /* Pick up whatever was written before the job ended */
+            f[i].dirty = 1;
+        }
+    }
+    free(pfd);
+}
+
+/* Follows the output files of the given jobs until all of them end.
+ * sockets[i] is the server connection where the end of jobids[i] will be
+ * notified. If last_lines == -1, go on from the start of the files, and if
+ * it is TAIL_NO_HEADER, from past their command line.
+ * If head_lines != -1, stop following a file once that many lines from its
+ * start were shown. The time range of --since and --between goes before
+ * last_lines.
+ * The file names are freed. Returns the last non-zero errorlevel, if any. */
+int tail_many(char **fnames, const int *jobids, const int *sockets, int num,
+        int last_lines, int head_lines)
+{
+    struct Follow *f;
+    int ifd = -1;
+    int i;
+    int end_res = 0;
+    int headers = num > 1;
+
+    could_write = 1;
+    f = (struct Follow *) malloc(num * sizeof(*f));
+
+#ifdef __linux__
+    ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+
+    for(i = 0; i < num; ++i)
+    {
+        f[i].fname = fnames[i];
+        f[i].jobid = jobids[i];
+        f[i].socket = sockets[i];
+        f[i].end_res = 0;
+        f[i].dirty = 1;
+        f[i].wd = -1;
+        f[i].lines_left = head_lines;
+        f[i].fd = open(fnames[i], O_RDONLY);
+        if (f[i].fd == -1)
+            tail_error("Error: cannot open the output file");
+
+        f[i].comp = zframes_check(f[i].fd);
+        f[i].zoff = ZHEADER_SIZE;
+        f[i].zskip = 0;
+        f[i].end_off = -1;
+        f[i].skip = SKIP_NONE;
+        if (command_line.time_since != -1)
+            seek_at_time(&f[i]);
+        else if (last_lines == TAIL_NO_HEADER)
+            f[i].skip = SKIP_LINE;
+        else if (head_lines == -1 && last_lines >= 0)
+        {
+            if (f[i].comp != COMPRESS_NONE)
+                seek_frames_last_lines(&f[i], last_lines);
+            else
+                seek_at_last_lines(f[i].fd, last_lines);
+        }
+
+        watch(&f[i], ifd);
+        if (ifd != -1 && f[i].wd == -1)
+        {
+            /* Fall back to polling all the files */
+            close(ifd);
+            ifd = -1;
         }
-    } while((!endfile_reached || waiting_end) && could_write);
+    }
+
+    do
+    {
+        int waiting = 0;
+
+        for(i = 0; i < num && could_write; ++i)
+            if (f[i].dirty)
+                drain(&f[i], i, headers);
+
+        /* Rotated outputs: the old file was drained above */
+        for(i = 0; i < num && could_write; ++i)
+            if (f[i].lines_left != 0 && replaced(&f[i]) && reopen(&f[i], ifd))
+                drain(&f[i], i, headers);
 
-    close(fd);
-    free((char*) fname);
+        for(i = 0; i < num; ++i)
+            if (f[i].socket != -1)
+                waiting = 1;
+
+        if (!waiting || !could_write)
+            break;
+
+        wait_events(f, num, ifd);
+    } while(could_write);
+
+    if (ifd != -1)
+        close(ifd);
+    for(i = 0; i < num; ++i)
+    {
+        close(f[i].fd);
+        free(f[i].fname);
+        if (f[i].end_res != 0)
+            end_res = f[i].end_res;
+    }
+    free(f);
     return end_res;
 }
+
+int tail_file(const char *fname, int last_lines)
+{
+    char *name = (char *) fname;
+
+    return tail_many(&name, &command_line.jobid, &server_socket, 1,
+            last_lines, command_line.head_lines);
+}
@@ -157,3 +157,39 @@ if [ $? -ne 0 ]; then
 fi
 
 ./ts -K
+
+# Test watching the events of a job
+./ts -K
+./ts > /dev/null
+J1=`./ts sleep 1`
+J2=`./ts false`
+EVENTS=`timeout 20 ./ts --watch $J1 $J2`
+if [ $? -ne 1 ]; then
+  echo "Error in the errorlevel of watch."
+  exit 1
+fi
+LINES=`echo "$EVENTS" | grep -c '"Event":"finished"'`
+if [ $LINES -ne 2 ]; then
+  echo "Error watching the jobs."
+  exit 1
+fi
+
+./ts -K
+
+# Test grep, which does not look into the command line
+./ts > /dev/null
+./ts true onlycmd > /dev/null
+J1=`./ts echo printed`
+./ts -w
+./ts --grep onlycmd > /dev/null
+if [ $? -ne 1 ]; then
+  echo "Error in grep, matching the command line."
+  exit 1
+fi
+LINES=`./ts --grep printed`
+if [ "$LINES" != "$J1:printed" ]; then
+  echo "Error in grep."
+  exit 1
+fi
+
+./ts -K
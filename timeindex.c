@@ -0,0 +1,199 @@
+/*
+    Task Spooler - a task queue system for the unix user
+    Copyright (C) 2007-2009  Lluís Batlle i Rossell
+
+    Please find the license in the provided COPYING file.
+*/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "main.h"
+
+/* The time index of an output file is in the file name plus ".idx".
+ * It has a header and then a record per second in which some line started:
+ * the time and the offset of the first line started in that second.
+ * The records are sorted, so a time can be found by binary search. */
+
+static const char magic[4] = { '\x89', 'T', 'S', 'I' };
+
+enum
+{
+    TINDEX_VERSION = 1,
+    TINDEX_HEADER_SIZE = 8
+};
+
+struct TimeIndexRecord
+{
+    long long time;
+    long long offset;
+};
+
+struct TimeIndex
+{
+    int fd;
+    time_t last;   /* Second of the last record */
+    time_t want;   /* Second waiting for a line start to be recorded, or -1 */
+    int at_line_start;
+};
+
+static char *index_name(const char *ofname)
+{
+    char *name;
+
+    name = (char *) malloc(strlen(ofname) + 5);
+    sprintf(name, "%s.idx", ofname);
+    return name;
+}
+
+struct TimeIndex *tindex_create(const char *ofname)
+{
+    struct TimeIndex *t;
+    char header[TINDEX_HEADER_SIZE];
+    char *name;
+
+    t = (struct TimeIndex *) malloc(sizeof(*t));
+    name = index_name(ofname);
+    t->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    free(name);
+    if (t->fd == -1)
+    {
+        warning("Cannot create the time index of %s", ofname);
+        free(t);
+        return NULL;
+    }
+    memset(header, 0, sizeof header);
+    memcpy(header, magic, sizeof magic);
+    header[4] = TINDEX_VERSION;
+    write(t->fd, header, sizeof header);
+
+    t->last = -1;
+    t->want = -1;
+    t->at_line_start = 1;
+    return t;
+}
+
+/* Called with the output data, before writing it at 'offset' in the file */
+void tindex_add(struct TimeIndex *t, const char *data, int len,
+        long long offset)
+{
+    time_t now;
+
+    if (len <= 0)
+        return;
+
+    now = time(NULL);
+    if (now != t->last)
+        t->want = now;
+
+    if (t->want != -1)
+    {
+        const char *nl = NULL;
+        int pos = -1;
+
+        if (t->at_line_start)
+            pos = 0;
+        else if ((nl = (const char *) memchr(data, '\n', len)) != NULL)
+            pos = nl - data + 1;
+
+        if (pos != -1)
+        {
+            struct TimeIndexRecord r;
+            r.time = t->want;
+            r.offset = offset + pos;
+            if (write(t->fd, &r, sizeof r) != sizeof r)
+                warning("Cannot write the time index");
+            t->last = t->want;
+            t->want = -1;
+        }
+    }
+    t->at_line_start = data[len - 1] == '\n';
+}
+
+void tindex_close(struct TimeIndex *t)
+{
+    close(t->fd);
+    free(t);
+}
+
+static int read_record(int fd, long long i, struct TimeIndexRecord *r)
+{
+    return pread(fd, r, sizeof *r, TINDEX_HEADER_SIZE + i * sizeof *r)
+        == sizeof *r;
+}
+
+/* Index of the first record with time > 'time' (or >= with 'or_equal'),
+ * or 'num' if none */
+static long long find_record(int fd, long long num, time_t time, int or_equal)
+{
+    long long low = 0;
+    long long high = num;
+
+    while(low < high)
+    {
+        long long mid = low + (high - low) / 2;
+        struct TimeIndexRecord r;
+
+        if (!read_record(fd, mid, &r))
+            return num;
+        if (r.time > time || (or_equal && r.time == time))
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    return low;
+}
+
+/* Finds in the time index of ofname the offsets of the lines started from
+ * 'since' (*start) until 'until' (*end), both included. With until == -1,
+ * *end is -1. Returns -1 if there is no index. */
+int tindex_lookup(const char *ofname, time_t since, time_t until,
+        off_t *start, off_t *end)
+{
+    char *name;
+    char header[TINDEX_HEADER_SIZE];
+    struct stat st;
+    struct TimeIndexRecord r;
+    long long num;
+    long long i;
+    int fd;
+
+    name = index_name(ofname);
+    fd = open(name, O_RDONLY);
+    free(name);
+    if (fd == -1)
+        return -1;
+    if (pread(fd, header, sizeof header, 0) != sizeof header
+        || memcmp(header, magic, sizeof magic) != 0
+        || fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    num = (st.st_size - TINDEX_HEADER_SIZE) / sizeof r;
+
+    /* Past all the records, the start is the end of the output */
+    *start = -1;
+    i = find_record(fd, num, since, 1);
+    if (i < num && read_record(fd, i, &r))
+        *start = r.offset;
+
+    *end = -1;
+    if (until != -1)
+    {
+        i = find_record(fd, num, until, 0);
+        if (i < num && read_record(fd, i, &r))
+            *end = r.offset;
+        else
+            *end = -2; /* Up to the end of the file as it is now */
+    }
+    close(fd);
+    return 0;
+}